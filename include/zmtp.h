@@ -30,8 +30,15 @@
 
 //  Public API classes
 
+#include "zmtp_msg_pool.h"
 #include "zmtp_msg.h"
 #include "zmtp_dealer.h"
+#include "zmtp_poller.h"
+#include "zmtp_pub.h"
+#include "zmtp_sub.h"
+#include "zmtp_router.h"
+#include "zmtp_push.h"
+#include "zmtp_pull.h"
 
 enum zmtp_socket_type {
     ZMTP_PAIR = 0,
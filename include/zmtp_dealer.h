@@ -17,6 +17,35 @@
 extern "C" {
 #endif
 
+//  I/O engines, for zmtp_dealer_set_engine
+enum {
+    ZMTP_ENGINE_SYSCALL = 0,    //  Plain system calls; the default
+    ZMTP_ENGINE_URING = 1,      //  Linux io_uring
+};
+
+//  Policies at the send high-water mark, for zmtp_dealer_set_send_queue
+enum {
+    ZMTP_HWM_BLOCK = 0,         //  Wait until the queue has room
+    ZMTP_HWM_EAGAIN = 1,        //  Fail with EAGAIN
+};
+
+//  Socket options, for zmtp_dealer_set_sockopt
+enum {
+    ZMTP_SOCKOPT_NODELAY = 0,   //  1 sends small frames without delay
+    ZMTP_SOCKOPT_QUICKACK = 1,  //  1 acknowledges received data at once
+    ZMTP_SOCKOPT_BUSY_POLL = 2, //  Usecs to busy-poll the device on receive
+    ZMTP_SOCKOPT_SNDBUF = 3,    //  Kernel send buffer size, in bytes
+    ZMTP_SOCKOPT_RCVBUF = 4,    //  Kernel receive buffer size, in bytes
+    ZMTP_SOCKOPT_CORK = 5,      //  1 holds back partial segments in batches
+};
+
+//  Socket option profiles, for zmtp_dealer_set_profile
+enum {
+    ZMTP_PROFILE_DEFAULT = 0,       //  System defaults
+    ZMTP_PROFILE_LOW_LATENCY = 1,   //  Nodelay, quickack and busy-poll
+    ZMTP_PROFILE_BULK = 2,          //  Corked batches and large buffers
+};
+
 //  Opaque class structure
 typedef struct _zmtp_dealer_t zmtp_dealer_t;
 
@@ -29,6 +58,25 @@ zmtp_dealer_t *
 void
     zmtp_dealer_destroy (zmtp_dealer_t **self_p);
 
+//  Set how long connect calls wait for the peer, in msecs; -1, the
+//  default, waits for ever, or while reconnecting, as long as the current
+//  reconnect interval
+void
+    zmtp_dealer_set_connect_timeout (zmtp_dealer_t *self, int timeout);
+
+//  Reconnect after failing to connect or losing the connection, waiting
+//  ivl msecs at first and doubling the wait up to ivl_max, for each
+//  endpoint on its own. While reconnecting, connect succeeds; while no
+//  peer is connected, sends are queued and receives block. An ivl of 0,
+//  the default, turns this off. Set before connecting.
+void
+    zmtp_dealer_set_reconnect (zmtp_dealer_t *self, int ivl, int ivl_max);
+
+//  Set how many messages are queued while reconnecting; past this, sends
+//  fail with EAGAIN. The default is 1000.
+void
+    zmtp_dealer_set_queue_limit (zmtp_dealer_t *self, size_t limit);
+
 int
     zmtp_dealer_ipc_connect (zmtp_dealer_t *self, const char *addr);
 
@@ -36,18 +84,143 @@ int
     zmtp_dealer_tcp_connect (zmtp_dealer_t *self,
                              const char *addr, unsigned short port);
 
+//  Connect to a peer at endpoint. A socket may have any number of peers,
+//  connected or accepted. Returns 0 if OK, -1 on error.
 int
     zmtp_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str);
 
+//  Accept any number of peers on endpoint. Peers are taken in while the
+//  socket sends and receives; a socket with no other peers waits for the
+//  first one to connect before it sends. Returns 0 if OK, -1 on error.
 int
     zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str);
 
+//  Send a message frame. Frames with ZMTP_MSG_MORE are held until the
+//  last frame of their message, and the whole message goes to the next
+//  peer in turn. A peer that fails is closed, and the message goes to the
+//  peer after it. Returns 0 if OK, -1 on error.
 int
     zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg);
 
+//  Send an array of messages on a socket, coalescing them into as few
+//  system calls as possible; the whole batch goes to one peer. Frames of
+//  an unfinished message at the end wait for the rest of it.
+int
+    zmtp_dealer_send_batch (zmtp_dealer_t *self,
+                            zmtp_msg_t **msgs, size_t count);
+
+//  Send message bodies of threshold bytes or more without copying them
+//  into the kernel; 16 KB is a fair start. Sent messages are referenced
+//  until the kernel is done with them, and constant data must stay valid
+//  until then. A threshold of 0 turns this off. The socket must be
+//  connected over TCP, or listening; peers that come later get the same
+//  threshold. Returns 0 if OK, -1 if not supported.
+int
+    zmtp_dealer_set_zerocopy (zmtp_dealer_t *self, size_t threshold);
+
+//  Queue sent messages for a background thread to send, so that send
+//  calls return at once rather than wait for the network. The thread
+//  sends what is queued to one peer at a time, in turn. If a peer fails,
+//  messages written to it in whole are not sent again; the rest go to
+//  the next peer, whole, including one the peer got only the first
+//  frames of. The queue holds up to hwm messages and hwm_bytes bytes of
+//  message data, 0 meaning no limit; past that, sends block
+//  (ZMTP_HWM_BLOCK) or fail with EAGAIN (ZMTP_HWM_EAGAIN). While
+//  reconnecting, sends are queued the same way. Can be called again to
+//  change the limits. Destroying the socket waits until queued messages
+//  are sent, or the connection fails. Cannot be combined with zero-copy
+//  or io_uring I/O. Returns 0 if OK, -1 on error.
+int
+    zmtp_dealer_set_send_queue (zmtp_dealer_t *self,
+                                size_t hwm, size_t hwm_bytes, int policy);
+
+//  Set the largest frame the socket accepts, in bytes; 0, the default,
+//  sets no limit. Larger frames are skipped without being stored, along
+//  with the rest of their message, and the receive call fails with
+//  EMSGSIZE; parts of the message received before are the caller's to
+//  drop. Frames received with zmtp_dealer_recv_header are not checked.
+void
+    zmtp_dealer_set_maxmsgsize (zmtp_dealer_t *self, size_t size);
+
+//  Set the most bytes of message data the socket may hold at a time,
+//  for a hard memory ceiling per connection; 0, the default, sets no
+//  limit. This covers the frame being received, which is rejected as
+//  above if it does not fit, and messages queued while reconnecting,
+//  which fail with ENOBUFS when the queue is full.
+void
+    zmtp_dealer_set_budget (zmtp_dealer_t *self, size_t budget);
+
+//  Set a socket option; see ZMTP_SOCKOPT_*. Options stay set across
+//  reconnects. Options that do not apply to the transport, or that the
+//  system refuses (busy-polling may need privileges), are ignored.
+//  Returns 0 if OK, -1 if the option or value is invalid.
+int
+    zmtp_dealer_set_sockopt (zmtp_dealer_t *self, int option, int value);
+
+//  Set all socket options from a profile; see ZMTP_PROFILE_*. Use
+//  ZMTP_PROFILE_LOW_LATENCY for request-reply traffic, where Nagle's
+//  algorithm would otherwise hold back small frames until the peer
+//  acknowledges, and ZMTP_PROFILE_BULK for streaming. Returns 0 if OK, -1
+//  if the profile is unknown.
+int
+    zmtp_dealer_set_profile (zmtp_dealer_t *self, int profile);
+
+//  Do socket I/O with the given engine. The io_uring engine keeps a
+//  receive armed on the socket, so messages arrive with fewer system
+//  calls; it stays once set. Each peer gets a ring of its own, so sends to
+//  several peers take a system call each, as without it. The socket must
+//  be connected or listening. Returns 0 if OK, -1 if not supported.
+int
+    zmtp_dealer_set_engine (zmtp_dealer_t *self, int engine);
+
+//  Receive a message frame. Peers with messages waiting are taken in turn,
+//  one message each. Returns NULL on error.
 zmtp_msg_t *
     zmtp_dealer_recv (zmtp_dealer_t *self);
 
+//  Receive the header of the next frame, leaving its body to be pulled
+//  with zmtp_dealer_recv_body; use this for frames too large to hold in
+//  memory. Stores the message flags and body size. Returns 0 if OK, -1
+//  on error; fails with EBUSY while a body is still pending, and with
+//  ENOTSUP if the socket has several peers.
+int
+    zmtp_dealer_recv_header (zmtp_dealer_t *self, byte *flags, size_t *size);
+
+//  Receive up to max bytes of the body announced by the last header into
+//  buffer, or skip them if buffer is NULL. Blocks only if nothing of the
+//  body is available. Returns the number of bytes received, 0 once the
+//  whole body is received, or -1 on error.
+ssize_t
+    zmtp_dealer_recv_body (zmtp_dealer_t *self, void *buffer, size_t max);
+
+//  Receive up to max messages from a socket into the out array. Blocks
+//  only if no message is available. Returns the number of messages
+//  received, or -1 on error.
+ssize_t
+    zmtp_dealer_recv_batch (zmtp_dealer_t *self,
+                            zmtp_msg_t **out, size_t max);
+
+//  Return file descriptor that becomes readable when the socket may have
+//  input or a peer is connecting; call zmtp_dealer_events to find out.
+//  Check zmtp_dealer_has_input before waiting on it, as messages may
+//  already be buffered. The descriptor stays the same while peers come
+//  and go. Where the system cannot provide that, this is the descriptor
+//  of the only peer, and -1 if the socket has no peer or several.
+int
+    zmtp_dealer_fd (zmtp_dealer_t *self);
+
+//  Return true if data is waiting that the descriptor does not signal,
+//  as it is buffered already. Does no system calls.
+bool
+    zmtp_dealer_has_input (zmtp_dealer_t *self);
+
+//  Take in peers that are connecting, without waiting, and return the
+//  events the socket is ready for: ZMTP_POLLIN if a message can be
+//  received, ZMTP_POLLOUT if a send will not wait for a peer to connect
+//  or for room in the send queue.
+int
+    zmtp_dealer_events (zmtp_dealer_t *self);
+
 //  Self test of this class
 void
     zmtp_dealer_test (bool verbose);
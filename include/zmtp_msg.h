@@ -27,11 +27,16 @@ enum {
 typedef struct _zmtp_msg_t zmtp_msg_t;
 
 //  @interface
-//  Constructor; it allocates buffer for message data.
-//  The initial content of the allocated buffer is undefined.
+//  Constructor; it allocates buffer for message data from the calling
+//  thread's pool. The initial content of the allocated buffer is undefined.
 zmtp_msg_t *
     zmtp_msg_new (byte flags, size_t size);
 
+//  Constructor; allocates message and its data buffer from the given pool.
+//  The initial content of the allocated buffer is undefined.
+zmtp_msg_t *
+    zmtp_msg_new_pooled (zmtp_msg_pool_t *pool, byte flags, size_t size);
+
 //  Constructor; takes ownership of data and frees it when destroying the
 //  message. Nullifies the data reference.
 zmtp_msg_t *
@@ -42,10 +47,22 @@ zmtp_msg_t *
 zmtp_msg_t *
     zmtp_msg_from_const_data (byte flags, void *data, size_t size);
 
-//  Destructor; frees message data and destroys the message
+//  Destructor; drops a reference to the message, and frees message data
+//  and destroys the message once the last reference is gone
 void
     zmtp_msg_destroy (zmtp_msg_t **self_p);
 
+//  Take another reference to the message; the message is shared, not
+//  copied. Safe to call from any thread. Returns the message. Note that
+//  constant data must stay valid until the last reference is dropped.
+zmtp_msg_t *
+    zmtp_msg_ref (zmtp_msg_t *self);
+
+//  Drop a reference to the message and nullify the reference; same as
+//  zmtp_msg_destroy
+void
+    zmtp_msg_unref (zmtp_msg_t **self_p);
+
 //  Return message flags property
 byte
     zmtp_msg_flags (zmtp_msg_t *self);
@@ -0,0 +1,63 @@
+/*  =========================================================================
+    zmtp_msg_pool - message memory pool class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_MSG_POOL_H_INCLUDED__
+#define __ZMTP_MSG_POOL_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Largest block the pool caches; larger blocks come from the heap
+#define ZMTP_MSG_POOL_BLOCK_MAX 8192
+
+//  Opaque class structure
+typedef struct _zmtp_msg_pool_t zmtp_msg_pool_t;
+
+//  @interface
+//  Constructor; creates an empty pool. A pool may be shared by threads.
+zmtp_msg_pool_t *
+    zmtp_msg_pool_new (void);
+
+//  Destructor; releases cached memory. Blocks still held by messages go
+//  back to the system as they are freed, and the pool itself goes away
+//  with the last of them.
+void
+    zmtp_msg_pool_destroy (zmtp_msg_pool_t **self_p);
+
+//  Return the default pool of the calling thread, creating it if needed.
+//  The calling thread allocates from and frees to it without locking;
+//  other threads may free blocks to it too. The pool is destroyed when
+//  the thread exits.
+zmtp_msg_pool_t *
+    zmtp_msg_pool_thread (void);
+
+//  Allocate a block of size bytes. The initial content of the block is
+//  undefined. Returns NULL if out of memory.
+void *
+    zmtp_msg_pool_alloc (zmtp_msg_pool_t *self, size_t size);
+
+//  Return a block to the pool it was allocated from; size must be the
+//  size it was allocated with. Any thread may return a block.
+void
+    zmtp_msg_pool_free (zmtp_msg_pool_t *self, void *block, size_t size);
+
+//  Self test of this class
+void
+    zmtp_msg_pool_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*  =========================================================================
+    zmtp_poller - poller class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_POLLER_H_INCLUDED__
+#define __ZMTP_POLLER_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Definitions of poller events.
+enum {
+    ZMTP_POLLIN = 1,            //  Message or data can be received
+    ZMTP_POLLOUT = 2,           //  Data can be sent
+    ZMTP_POLLERR = 4,           //  Error or hang-up; reported always
+    ZMTP_POLLET = 8,            //  Edge-triggered; for file descriptors
+};
+
+//  Opaque class structure
+typedef struct _zmtp_poller_t zmtp_poller_t;
+
+//  Event reported by zmtp_poller_wait
+typedef struct {
+    void *arg;                  //  Argument given when registering
+    int events;                 //  ZMTP_POLLIN, ZMTP_POLLOUT, ZMTP_POLLERR
+} zmtp_poller_event_t;
+
+//  @interface
+//  Constructor
+zmtp_poller_t *
+    zmtp_poller_new (void);
+
+//  Destructor; does not touch the registered sockets
+void
+    zmtp_poller_destroy (zmtp_poller_t **self_p);
+
+//  Register a dealer socket for the given events. The arg is reported
+//  back with each event. Dealers are always polled level-triggered, and
+//  stay registered across their peers coming and going. Returns 0 if OK,
+//  -1 on error.
+int
+    zmtp_poller_add_dealer (zmtp_poller_t *self, zmtp_dealer_t *dealer,
+                            int events, void *arg);
+
+//  Stop polling a dealer socket. Returns 0 if OK, -1 if not registered.
+int
+    zmtp_poller_remove_dealer (zmtp_poller_t *self, zmtp_dealer_t *dealer);
+
+//  Register a file descriptor for the given events. Add ZMTP_POLLET to
+//  have the descriptor reported only when it becomes ready. Returns 0 if
+//  OK, -1 on error.
+int
+    zmtp_poller_add_fd (zmtp_poller_t *self, int fd, int events, void *arg);
+
+//  Stop polling a file descriptor. Returns 0 if OK, -1 if not registered.
+int
+    zmtp_poller_remove_fd (zmtp_poller_t *self, int fd);
+
+//  Return a descriptor that becomes readable when a registered item may
+//  be ready, so that the poller can be waited on by another; -1 if the
+//  platform has none
+int
+    zmtp_poller_fd (zmtp_poller_t *self);
+
+//  Wait up to timeout msecs (-1 for ever) until at least one registered
+//  item is ready, and store up to max events. Dealers with buffered
+//  messages are reported readable without waiting. Returns the number of
+//  events, 0 on timeout, or -1 on error (e.g. interrupted).
+int
+    zmtp_poller_wait (zmtp_poller_t *self,
+                      zmtp_poller_event_t *events, int max, int timeout);
+
+//  Self test of this class
+void
+    zmtp_poller_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*  =========================================================================
+    zmtp_pub - PUB socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_PUB_H_INCLUDED__
+#define __ZMTP_PUB_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_pub_t zmtp_pub_t;
+
+//  @interface
+//  Constructor
+zmtp_pub_t *
+    zmtp_pub_new (void);
+
+//  Destructor; closes all subscriber connections
+void
+    zmtp_pub_destroy (zmtp_pub_t **self_p);
+
+//  Accept subscribers on endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_pub_bind (zmtp_pub_t *self, const char *endpoint_str);
+
+//  Connect to a subscriber at endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_pub_connect (zmtp_pub_t *self, const char *endpoint_str);
+
+//  Send message to every subscriber with a subscription that is a prefix
+//  of its first frame. Frames with ZMTP_MSG_MORE are held until the last
+//  frame, so that subscribers get whole messages or nothing. Messages are
+//  referenced, not copied, by each subscriber they go to; constant data
+//  must stay valid until all are done. Subscribers that cannot take a
+//  message without blocking miss it. Takes time in the length of the
+//  topic and the number of matching subscribers, not the number of
+//  subscriptions. Returns 0 if OK, -1 on error.
+int
+    zmtp_pub_send (zmtp_pub_t *self, zmtp_msg_t *msg);
+
+//  Wait up to timeout msecs (-1 for ever) for new subscribers and
+//  subscriptions and take them in; sends do this as well, without
+//  waiting. Returns 0 if OK, -1 on error.
+int
+    zmtp_pub_wait (zmtp_pub_t *self, int timeout);
+
+//  Return number of connected subscribers
+size_t
+    zmtp_pub_subscribers (zmtp_pub_t *self);
+
+//  Self test of this class
+void
+    zmtp_pub_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
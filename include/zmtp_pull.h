@@ -0,0 +1,56 @@
+/*  =========================================================================
+    zmtp_pull - PULL socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_PULL_H_INCLUDED__
+#define __ZMTP_PULL_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_pull_t zmtp_pull_t;
+
+//  @interface
+//  Constructor
+zmtp_pull_t *
+    zmtp_pull_new (void);
+
+//  Destructor; closes all peer connections
+void
+    zmtp_pull_destroy (zmtp_pull_t **self_p);
+
+//  Accept peers on endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_pull_bind (zmtp_pull_t *self, const char *endpoint_str);
+
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_pull_connect (zmtp_pull_t *self, const char *endpoint_str);
+
+//  Receive a frame. Peers with messages waiting are taken in turn, one
+//  message each, so that a busy peer cannot starve the others. Returns
+//  NULL on error, with errno set to ENOTCONN if there are no peers and
+//  none can come.
+zmtp_msg_t *
+    zmtp_pull_recv (zmtp_pull_t *self);
+
+//  Self test of this class
+void
+    zmtp_pull_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/*  =========================================================================
+    zmtp_push - PUSH socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_PUSH_H_INCLUDED__
+#define __ZMTP_PUSH_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_push_t zmtp_push_t;
+
+//  @interface
+//  Constructor
+zmtp_push_t *
+    zmtp_push_new (void);
+
+//  Destructor; waits until messages on their way are written, then
+//  closes all peer connections
+void
+    zmtp_push_destroy (zmtp_push_t **self_p);
+
+//  Accept peers on endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_push_bind (zmtp_push_t *self, const char *endpoint_str);
+
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_push_connect (zmtp_push_t *self, const char *endpoint_str);
+
+//  Send a frame. Frames with ZMTP_MSG_MORE are held until the last frame,
+//  and the whole message goes to the next peer in turn that can take it
+//  without blocking; peers whose send buffers are full are skipped. Waits
+//  while no peer can take it, including while none is connected. A
+//  message the peer takes only part of is written out as it makes room,
+//  on later sends and by zmtp_push_wait. Messages are referenced, not
+//  copied; constant data must stay valid until sent. Returns 0 if OK, -1
+//  on error, with errno set to ENOTCONN if there are no peers and none
+//  can come.
+int
+    zmtp_push_send (zmtp_push_t *self, zmtp_msg_t *msg);
+
+//  Wait up to timeout msecs (-1 for ever) for new peers and take them in,
+//  writing out messages peers took only part of as they make room;
+//  returns early once one does. Returns 0 if OK, -1 on error.
+int
+    zmtp_push_wait (zmtp_push_t *self, int timeout);
+
+//  Return number of connected peers
+size_t
+    zmtp_push_peers (zmtp_push_t *self);
+
+//  Self test of this class
+void
+    zmtp_push_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/*  =========================================================================
+    zmtp_router - ROUTER socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_ROUTER_H_INCLUDED__
+#define __ZMTP_ROUTER_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Size of routing identities the router gives its peers
+#define ZMTP_ROUTER_ID_SIZE 5
+
+//  Opaque class structure
+typedef struct _zmtp_router_t zmtp_router_t;
+
+//  @interface
+//  Constructor
+zmtp_router_t *
+    zmtp_router_new (void);
+
+//  Destructor; waits until replies on their way are written, then closes
+//  all peer connections
+void
+    zmtp_router_destroy (zmtp_router_t **self_p);
+
+//  Accept peers on endpoint, taking in as many as are waiting at once.
+//  Returns 0 if OK, -1 on error.
+int
+    zmtp_router_bind (zmtp_router_t *self, const char *endpoint_str);
+
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_router_connect (zmtp_router_t *self, const char *endpoint_str);
+
+//  Send a frame. The first frame of each message is the routing identity
+//  of a peer, as received, with ZMTP_MSG_MORE set; it fails with
+//  EHOSTUNREACH if there is no such peer, and the rest of the message
+//  must not follow. The other frames are held until the last, and go out
+//  together. If the peer cannot take the message without blocking, the
+//  last frame fails with EAGAIN and the message is dropped. A message the
+//  peer takes only part of is written out as it makes room, on later
+//  sends and while receiving. Messages are referenced, not copied;
+//  constant data must stay valid until sent.
+//  Routing does not allocate memory. Returns 0 if OK, -1 on error.
+int
+    zmtp_router_send (zmtp_router_t *self, zmtp_msg_t *msg);
+
+//  Receive a frame. Each message from a peer starts with a frame holding
+//  the routing identity of the peer, followed by the frames it sent.
+//  Peers are taken in turn between messages. While waiting, writes out
+//  replies peers took only part of. Returns NULL on error.
+zmtp_msg_t *
+    zmtp_router_recv (zmtp_router_t *self);
+
+//  Return number of connected peers
+size_t
+    zmtp_router_peers (zmtp_router_t *self);
+
+//  Self test of this class
+void
+    zmtp_router_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*  =========================================================================
+    zmtp_sub - SUB socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_SUB_H_INCLUDED__
+#define __ZMTP_SUB_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_sub_t zmtp_sub_t;
+
+//  @interface
+//  Constructor
+zmtp_sub_t *
+    zmtp_sub_new (void);
+
+//  Destructor; closes all publisher connections
+void
+    zmtp_sub_destroy (zmtp_sub_t **self_p);
+
+//  Accept publishers on endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_sub_bind (zmtp_sub_t *self, const char *endpoint_str);
+
+//  Connect to a publisher at endpoint. Returns 0 if OK, -1 on error.
+int
+    zmtp_sub_connect (zmtp_sub_t *self, const char *endpoint_str);
+
+//  Receive messages whose first frame starts with prefix. An empty prefix
+//  matches all messages. Subscriptions are counted, and go to publishers
+//  connected now and later. Returns 0 if OK, -1 on error.
+int
+    zmtp_sub_subscribe (zmtp_sub_t *self, const void *prefix, size_t size);
+
+//  Take back one subscription to prefix; publishers hear of it once the
+//  last one is gone. Returns 0 if OK, -1 on error.
+int
+    zmtp_sub_unsubscribe (zmtp_sub_t *self, const void *prefix, size_t size);
+
+//  Receive the next frame of a subscribed message, taking publishers in
+//  turn between messages. Messages that match no subscription are
+//  dropped, in case a publisher sends more than asked for. Returns NULL
+//  on error, with errno set to ENOTCONN if there are no publishers and
+//  none can come.
+zmtp_msg_t *
+    zmtp_sub_recv (zmtp_sub_t *self);
+
+//  Self test of this class
+void
+    zmtp_sub_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+/*  =========================================================================
+    local_lat - latency benchmark, echo side
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Listens on the endpoint and echoes every message back to whichever
+//  remote_lat is connected, serving one run after another until killed.
+//
+//      local_lat <endpoint>
+
+#include "zmtp.h"
+
+int main (int argc, char *argv [])
+{
+    if (argc != 2) {
+        fprintf (stderr, "usage: local_lat <endpoint>\n");
+        return 1;
+    }
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_profile (dealer, ZMTP_PROFILE_LOW_LATENCY);
+    if (zmtp_dealer_listen (dealer, argv [1]) == -1) {
+        fprintf (stderr, "local_lat: cannot listen on %s: %s\n",
+            argv [1], strerror (errno));
+        zmtp_dealer_destroy (&dealer);
+        return 1;
+    }
+    zmtp_msg_t *msg;
+    while ((msg = zmtp_dealer_recv (dealer))) {
+        const int rc = zmtp_dealer_send (dealer, msg);
+        zmtp_msg_destroy (&msg);
+        if (rc == -1)
+            break;
+    }
+    zmtp_dealer_destroy (&dealer);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*  =========================================================================
+    local_thr - throughput benchmark, receiving side
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Listens on the endpoint and receives count messages of each size from
+//  remote_thr, which must be given the same count and sizes. Times each
+//  run from its first message to its last, and prints one JSON object
+//  per size.
+//
+//      local_thr <endpoint> <count> [size ...]
+
+#include "zmtp.h"
+
+static const size_t s_default_sizes [] = {
+    1, 64, 256, 1024, 4096, 16384, 65536
+};
+
+static int64_t
+s_clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main (int argc, char *argv [])
+{
+    if (argc < 3 || atol (argv [2]) <= 0) {
+        fprintf (stderr, "usage: local_thr <endpoint> <count> [size ...]\n");
+        return 1;
+    }
+    const char *endpoint = argv [1];
+    const size_t count = (size_t) atol (argv [2]);
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    if (zmtp_dealer_listen (dealer, endpoint) == -1) {
+        fprintf (stderr, "local_thr: cannot listen on %s: %s\n",
+            endpoint, strerror (errno));
+        zmtp_dealer_destroy (&dealer);
+        return 1;
+    }
+    const size_t nbr_sizes = argc > 3?
+        (size_t) (argc - 3): sizeof s_default_sizes / sizeof *s_default_sizes;
+    int rc = 0;
+    for (size_t index = 0; index < nbr_sizes && rc == 0; index++) {
+        const size_t size = argc > 3?
+            (size_t) atol (argv [3 + index]): s_default_sizes [index];
+        int64_t start = 0;
+        size_t received = 0;
+        while (received < count) {
+            zmtp_msg_t *msgs [64];
+            const size_t max = count - received < 64? count - received: 64;
+            const ssize_t n = zmtp_dealer_recv_batch (dealer, msgs, max);
+            if (n == -1) {
+                rc = -1;
+                break;
+            }
+            if (received == 0)
+                start = s_clock_ns ();
+            for (ssize_t i = 0; i < n; i++) {
+                if (zmtp_msg_size (msgs [i]) != size)
+                    rc = -1;
+                zmtp_msg_destroy (&msgs [i]);
+            }
+            received += n;
+        }
+        if (rc == -1) {
+            fprintf (stderr, "local_thr: bad or missing message\n");
+            break;
+        }
+        //  The clock starts with the first message, so we time count - 1
+        //  messages; with count 1 there is nothing to time
+        const double elapsed = (s_clock_ns () - start) / 1e9;
+        const double rate = elapsed > 0? (count - 1) / elapsed: 0;
+        printf ("{\"bench\":\"throughput\",\"endpoint\":\"%s\","
+                "\"size\":%zu,\"count\":%zu,\"elapsed_us\":%.0f,"
+                "\"msgs_per_sec\":%.0f,\"mb_per_sec\":%.3f}\n",
+            endpoint, size, count, elapsed * 1e6,
+            rate, rate * size / 1e6);
+        fflush (stdout);
+    }
+    zmtp_dealer_destroy (&dealer);
+    return rc == 0? 0: 1;
+}
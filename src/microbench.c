@@ -0,0 +1,343 @@
+/*  =========================================================================
+    microbench - micro-benchmarks of the layers under the sockets
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Times frame header encoding and decoding, message churn against plain
+//  malloc and free, frame decoding through a channel, the ZMTP handshake,
+//  and subscription prefix matching with each implementation the CPU
+//  supports, without network noise. Each benchmark prints one JSON object
+//  with nanoseconds and heap allocations per operation; prefix matching
+//  adds prefix compares per second. Allocations are counted where the C
+//  library lets us wrap malloc, and reported as -1 otherwise.
+//
+//      microbench [iterations]
+
+#include "zmtp_classes.h"
+
+//  Count heap allocations by wrapping the glibc allocator; the library
+//  resolves malloc to these as well
+
+#if defined (__GLIBC__)
+static size_t s_allocs;
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+    __atomic_add_fetch (&s_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc (ptr, size);
+}
+#   define ZMTP_COUNT_ALLOCS
+#endif
+
+//  Keeps the compiler from optimizing benchmarked work away
+static volatile size_t s_sink;
+
+typedef struct {
+    const char *name;
+    int64_t start;
+    size_t allocs;
+} bench_t;
+
+static int64_t
+s_clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+s_bench_start (bench_t *bench, const char *name)
+{
+    bench->name = name;
+#if defined (ZMTP_COUNT_ALLOCS)
+    bench->allocs = __atomic_load_n (&s_allocs, __ATOMIC_RELAXED);
+#endif
+    bench->start = s_clock_ns ();
+}
+
+static void
+s_bench_end_extra (bench_t *bench, size_t ops, const char *extra)
+{
+    const int64_t elapsed = s_clock_ns () - bench->start;
+#if defined (ZMTP_COUNT_ALLOCS)
+    const double allocs = (double)
+        (__atomic_load_n (&s_allocs, __ATOMIC_RELAXED) - bench->allocs) / ops;
+#else
+    const double allocs = -1;
+#endif
+    printf ("{\"bench\":\"%s\",\"ops\":%zu,"
+            "\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f%s}\n",
+        bench->name, ops, (double) elapsed / ops, allocs, extra);
+    fflush (stdout);
+}
+
+static void
+s_bench_end (bench_t *bench, size_t ops)
+{
+    s_bench_end_extra (bench, ops, "");
+}
+
+//  Time encoding of headers for messages of the given size
+static void
+s_encode (const char *name, size_t size, size_t iterations)
+{
+    zmtp_msg_t *msg = zmtp_msg_new (0, size);
+    assert (msg);
+    byte header [9];
+    bench_t bench;
+    s_bench_start (&bench, name);
+    for (size_t i = 0; i < iterations; i++) {
+        s_sink += zmtp_channel_encode_header (header, msg);
+        s_sink += header [1];
+    }
+    s_bench_end (&bench, iterations);
+    zmtp_msg_destroy (&msg);
+}
+
+//  Time decoding of a buffer full of headers for messages of given size
+static void
+s_decode (const char *name, size_t size, size_t iterations)
+{
+    zmtp_msg_t *msg = zmtp_msg_new (0, size);
+    assert (msg);
+    byte buffer [64 * 9];
+    size_t length = 0;
+    for (int i = 0; i < 64; i++)
+        length += zmtp_channel_encode_header (buffer + length, msg);
+    zmtp_msg_destroy (&msg);
+
+    bench_t bench;
+    s_bench_start (&bench, name);
+    size_t offset = 0;
+    for (size_t i = 0; i < iterations; i++) {
+        byte flags;
+        size_t decoded;
+        offset += zmtp_channel_decode_header (buffer + offset, &flags, &decoded);
+        s_sink += decoded;
+        if (offset == length)
+            offset = 0;
+    }
+    s_bench_end (&bench, iterations);
+}
+
+//  Time creating and destroying messages of given size, from the thread's
+//  default pool if pool is NULL, else from the shared pool
+static void
+s_churn (const char *name, zmtp_msg_pool_t *pool, size_t size,
+         size_t iterations)
+{
+    bench_t bench;
+    s_bench_start (&bench, name);
+    for (size_t i = 0; i < iterations; i++) {
+        zmtp_msg_t *msg = pool?
+            zmtp_msg_new_pooled (pool, 0, size): zmtp_msg_new (0, size);
+        s_sink += (size_t) zmtp_msg_data (msg);
+        zmtp_msg_destroy (&msg);
+    }
+    s_bench_end (&bench, iterations);
+}
+
+//  Time allocating and freeing a message structure and body of given size
+//  straight from the heap, as a baseline for the pools
+static void
+s_churn_malloc (const char *name, size_t size, size_t iterations)
+{
+    bench_t bench;
+    s_bench_start (&bench, name);
+    for (size_t i = 0; i < iterations; i++) {
+        void *msg = calloc (1, 64);
+        byte *data = (byte *) malloc (size);
+        assert (msg && data);
+        s_sink += (size_t) msg + (size_t) data;
+        free (data);
+        free (msg);
+    }
+    s_bench_end (&bench, iterations);
+}
+
+//  Feed the peer's half of a handshake into fd: greeting and READY
+static void
+s_feed_handshake (int fd)
+{
+    byte handshake [64 + 8] = {
+        0xff, 0, 0, 0, 0, 0, 0, 0, 1, 0x7f, 3, 0, 'N', 'U', 'L', 'L'
+    };
+    memcpy (handshake + 64, "\4\6\5READY", 8);
+    const ssize_t rc = send (fd, handshake, sizeof handshake, 0);
+    assert (rc == sizeof handshake);
+}
+
+//  Take our half of the handshake out of fd
+static void
+s_drain (int fd)
+{
+    byte buffer [4096];
+    while (recv (fd, buffer, sizeof buffer, MSG_DONTWAIT) > 0)
+        ;
+}
+
+//  Time decoding of frames of given size through a channel, with the
+//  peer's bytes written ahead into a socket pair
+static void
+s_recv (const char *name, size_t size, size_t iterations)
+{
+    int fds [2];
+    int rc = socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+    assert (rc == 0);
+    s_feed_handshake (fds [1]);
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_attach (channel, fds [0]);
+    assert (rc == 0);
+    s_drain (fds [1]);
+
+    //  Write frames in rounds that fit in the socket buffer
+    zmtp_msg_t *msg = zmtp_msg_new (0, size);
+    assert (msg);
+    byte header [9];
+    const size_t header_size = zmtp_channel_encode_header (header, msg);
+    const size_t frame_size = header_size + size;
+    const size_t per_round = 65536 / frame_size? 65536 / frame_size: 1;
+    byte *round = (byte *) malloc (per_round * frame_size);
+    assert (round);
+    for (size_t i = 0; i < per_round; i++) {
+        memcpy (round + i * frame_size, header, header_size);
+        memcpy (round + i * frame_size + header_size,
+            zmtp_msg_data (msg), size);
+    }
+    zmtp_msg_destroy (&msg);
+
+    bench_t bench;
+    s_bench_start (&bench, name);
+    size_t received = 0;
+    while (received < iterations) {
+        rc = send (fds [1], round, per_round * frame_size, 0);
+        assert (rc == (ssize_t) (per_round * frame_size));
+        for (size_t i = 0; i < per_round; i++) {
+            msg = zmtp_channel_recv (channel);
+            assert (msg);
+            zmtp_msg_destroy (&msg);
+        }
+        received += per_round;
+    }
+    s_bench_end (&bench, received);
+
+    free (round);
+    zmtp_channel_destroy (&channel);
+    close (fds [1]);
+}
+
+//  Time the handshake of a channel over a socket pair
+static void
+s_handshake (const char *name, size_t iterations)
+{
+    bench_t bench;
+    s_bench_start (&bench, name);
+    for (size_t i = 0; i < iterations; i++) {
+        int fds [2];
+        int rc = socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+        assert (rc == 0);
+        s_feed_handshake (fds [1]);
+        zmtp_channel_t *channel = zmtp_channel_new ();
+        assert (channel);
+        rc = zmtp_channel_attach (channel, fds [0]);
+        assert (rc == 0);
+        zmtp_channel_destroy (&channel);
+        close (fds [1]);
+    }
+    s_bench_end (&bench, iterations);
+}
+
+//  Time matching of one topic against count prefixes, of which one matches;
+//  also reports the rate of prefix compares, count per topic matched
+static void
+s_prefixes (const char *name, int impl, size_t count, size_t iterations)
+{
+    zmtp_prefixes_t *prefixes = zmtp_prefixes_new ();
+    assert (prefixes);
+    if (zmtp_prefixes_set_impl (prefixes, impl) == -1) {
+        zmtp_prefixes_destroy (&prefixes);
+        return;                     //  Not on this CPU
+    }
+    char prefix [16];
+    for (size_t index = 0; index < count; index++) {
+        snprintf (prefix, sizeof prefix, "md.%06zu.", index);
+        int rc = zmtp_prefixes_add (
+            prefixes, (const byte *) prefix, strlen (prefix));
+        assert (rc == 0);
+    }
+    const char *topic = "md.000007.EURUSD.bid";
+    bench_t bench;
+    s_bench_start (&bench, name);
+    for (size_t i = 0; i < iterations; i++)
+        s_sink += zmtp_prefixes_match (
+            prefixes, (const byte *) topic, strlen (topic), NULL);
+    const int64_t elapsed = s_clock_ns () - bench.start;
+    char extra [80];
+    snprintf (extra, sizeof extra,
+        ",\"prefixes\":%zu,\"compares_per_sec\":%.0f",
+        count, (double) iterations * count * 1e9 / elapsed);
+    s_bench_end_extra (&bench, iterations, extra);
+    zmtp_prefixes_destroy (&prefixes);
+}
+
+int main (int argc, char *argv [])
+{
+    const size_t iterations = argc > 1? (size_t) atol (argv [1]): 1000000;
+    if (iterations == 0) {
+        fprintf (stderr, "usage: microbench [iterations]\n");
+        return 1;
+    }
+    s_encode ("encode_header_small", 100, iterations);
+    s_encode ("encode_header_large", 100000, iterations);
+    s_decode ("decode_header_small", 100, iterations);
+    s_decode ("decode_header_large", 100000, iterations);
+    //  Bodies of 512 bytes share a pool block with the message; larger
+    //  than ZMTP_MSG_POOL_BLOCK_MAX, they take one of their own
+    zmtp_msg_pool_t *pool = zmtp_msg_pool_new ();
+    s_churn ("msg_churn_thread_512", NULL, 512, iterations);
+    s_churn ("msg_churn_shared_512", pool, 512, iterations);
+    s_churn_malloc ("msg_churn_malloc_512", 512, iterations);
+    s_churn ("msg_churn_thread_16384", NULL, 16384, iterations);
+    s_churn ("msg_churn_shared_16384", pool, 16384, iterations);
+    s_churn_malloc ("msg_churn_malloc_16384", 16384, iterations);
+    zmtp_msg_pool_destroy (&pool);
+    //  Slower benchmarks run fewer times, but at least once
+    const size_t tenth = iterations / 10? iterations / 10: 1;
+    s_recv ("channel_recv_64", 64, iterations);
+    s_recv ("channel_recv_4096", 4096, tenth);
+    s_handshake ("handshake", iterations / 100? iterations / 100: 1);
+    s_prefixes ("prefixes_scalar_64", ZMTP_PREFIXES_SCALAR, 64, iterations);
+    s_prefixes ("prefixes_sse2_64", ZMTP_PREFIXES_SSE2, 64, iterations);
+    s_prefixes ("prefixes_avx2_64", ZMTP_PREFIXES_AVX2, 64, iterations);
+    s_prefixes ("prefixes_scalar_1024", ZMTP_PREFIXES_SCALAR, 1024, tenth);
+    s_prefixes ("prefixes_sse2_1024", ZMTP_PREFIXES_SSE2, 1024, tenth);
+    s_prefixes ("prefixes_avx2_1024", ZMTP_PREFIXES_AVX2, 1024, tenth);
+    return 0;
+}
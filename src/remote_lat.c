@@ -0,0 +1,132 @@
+/*  =========================================================================
+    remote_lat - latency benchmark, measuring side
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Connects to local_lat and times round trips of messages of each size,
+//  after a warm-up. Prints one JSON object per size, with round-trip
+//  times in microseconds.
+//
+//      remote_lat <endpoint> <roundtrips> [size ...]
+
+#include "zmtp.h"
+
+static const size_t s_default_sizes [] = {
+    1, 64, 256, 1024, 4096, 16384, 65536
+};
+
+static int64_t
+s_clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+s_compare (const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *) a;
+    const int64_t y = *(const int64_t *) b;
+    return x < y? -1: x > y;
+}
+
+//  Return sample at quantile q of sorted samples, in microseconds
+static double
+s_quantile (const int64_t *samples, size_t count, double q)
+{
+    return samples [(size_t) (q * (count - 1))] / 1000.0;
+}
+
+//  Send message and wait for it to come back. Returns 0 if OK.
+static int
+s_roundtrip (zmtp_dealer_t *dealer, zmtp_msg_t *msg)
+{
+    if (zmtp_dealer_send (dealer, msg) == -1)
+        return -1;
+    zmtp_msg_t *reply = zmtp_dealer_recv (dealer);
+    if (!reply)
+        return -1;
+    const bool same = zmtp_msg_size (reply) == zmtp_msg_size (msg);
+    zmtp_msg_destroy (&reply);
+    return same? 0: -1;
+}
+
+int main (int argc, char *argv [])
+{
+    if (argc < 3 || atol (argv [2]) <= 0) {
+        fprintf (stderr,
+            "usage: remote_lat <endpoint> <roundtrips> [size ...]\n");
+        return 1;
+    }
+    const char *endpoint = argv [1];
+    const size_t roundtrips = (size_t) atol (argv [2]);
+    const size_t warmup = roundtrips / 10 < 1000? roundtrips / 10: 1000;
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_profile (dealer, ZMTP_PROFILE_LOW_LATENCY);
+    //  Wait for local_lat to come up
+    zmtp_dealer_set_reconnect (dealer, 100, 100);
+    if (zmtp_dealer_connect (dealer, endpoint) == -1) {
+        fprintf (stderr, "remote_lat: cannot connect to %s: %s\n",
+            endpoint, strerror (errno));
+        zmtp_dealer_destroy (&dealer);
+        return 1;
+    }
+    int64_t *samples = (int64_t *) malloc (roundtrips * sizeof *samples);
+    assert (samples);
+
+    const size_t nbr_sizes = argc > 3?
+        (size_t) (argc - 3): sizeof s_default_sizes / sizeof *s_default_sizes;
+    int rc = 0;
+    for (size_t index = 0; index < nbr_sizes && rc == 0; index++) {
+        const size_t size = argc > 3?
+            (size_t) atol (argv [3 + index]): s_default_sizes [index];
+        zmtp_msg_t *msg = zmtp_msg_new (0, size);
+        assert (msg);
+        memset (zmtp_msg_data (msg), 'L', size);
+
+        for (size_t i = 0; i < warmup && rc == 0; i++)
+            rc = s_roundtrip (dealer, msg);
+        int64_t total = 0;
+        for (size_t i = 0; i < roundtrips && rc == 0; i++) {
+            const int64_t start = s_clock_ns ();
+            rc = s_roundtrip (dealer, msg);
+            samples [i] = s_clock_ns () - start;
+            total += samples [i];
+        }
+        zmtp_msg_destroy (&msg);
+        if (rc == -1) {
+            fprintf (stderr, "remote_lat: round trip failed: %s\n",
+                strerror (errno));
+            break;
+        }
+        qsort (samples, roundtrips, sizeof *samples, s_compare);
+        printf ("{\"bench\":\"latency\",\"endpoint\":\"%s\","
+                "\"size\":%zu,\"roundtrips\":%zu,"
+                "\"rtt_mean_us\":%.3f,\"rtt_min_us\":%.3f,"
+                "\"rtt_p50_us\":%.3f,\"rtt_p90_us\":%.3f,"
+                "\"rtt_p99_us\":%.3f,\"rtt_p999_us\":%.3f,"
+                "\"rtt_max_us\":%.3f}\n",
+            endpoint, size, roundtrips,
+            total / 1000.0 / roundtrips,
+            s_quantile (samples, roundtrips, 0),
+            s_quantile (samples, roundtrips, 0.5),
+            s_quantile (samples, roundtrips, 0.9),
+            s_quantile (samples, roundtrips, 0.99),
+            s_quantile (samples, roundtrips, 0.999),
+            s_quantile (samples, roundtrips, 1));
+        fflush (stdout);
+    }
+    free (samples);
+    zmtp_dealer_destroy (&dealer);
+    return rc == 0? 0: 1;
+}
@@ -0,0 +1,63 @@
+/*  =========================================================================
+    remote_thr - throughput benchmark, sending side
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Connects to local_thr, waiting for it to come up if need be, and sends
+//  count messages of each size, one message per send call.
+//
+//      remote_thr <endpoint> <count> [size ...]
+
+#include "zmtp.h"
+
+static const size_t s_default_sizes [] = {
+    1, 64, 256, 1024, 4096, 16384, 65536
+};
+
+int main (int argc, char *argv [])
+{
+    if (argc < 3 || atol (argv [2]) <= 0) {
+        fprintf (stderr, "usage: remote_thr <endpoint> <count> [size ...]\n");
+        return 1;
+    }
+    const char *endpoint = argv [1];
+    const size_t count = (size_t) atol (argv [2]);
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    //  Wait for local_thr to come up before sending; a reconnecting dealer
+    //  would only queue messages up to its limit, and then fail
+    while (zmtp_dealer_connect (dealer, endpoint) == -1) {
+        if (errno != ECONNREFUSED && errno != ENOENT) {
+            fprintf (stderr, "remote_thr: cannot connect to %s: %s\n",
+                endpoint, strerror (errno));
+            zmtp_dealer_destroy (&dealer);
+            return 1;
+        }
+        usleep (100000);
+    }
+    const size_t nbr_sizes = argc > 3?
+        (size_t) (argc - 3): sizeof s_default_sizes / sizeof *s_default_sizes;
+    int rc = 0;
+    for (size_t index = 0; index < nbr_sizes && rc == 0; index++) {
+        const size_t size = argc > 3?
+            (size_t) atol (argv [3 + index]): s_default_sizes [index];
+        zmtp_msg_t *msg = zmtp_msg_new (0, size);
+        assert (msg);
+        memset (zmtp_msg_data (msg), 'T', size);
+        for (size_t i = 0; i < count && rc == 0; i++)
+            rc = zmtp_dealer_send (dealer, msg);
+        zmtp_msg_destroy (&msg);
+    }
+    if (rc == -1)
+        fprintf (stderr, "remote_thr: send failed: %s\n", strerror (errno));
+    zmtp_dealer_destroy (&dealer);
+    return rc == 0? 0: 1;
+}
@@ -11,6 +11,21 @@
 */
 
 #include "zmtp_classes.h"
+#include <poll.h>
+
+#if defined (__UTYPE_LINUX)
+#   include <linux/errqueue.h>
+#   include <linux/sockios.h>
+#   include <sys/ioctl.h>
+#endif
+#if defined (SO_ZEROCOPY) && defined (MSG_ZEROCOPY) \
+ && defined (SO_EE_ORIGIN_ZEROCOPY)
+#   define ZMTP_HAVE_ZEROCOPY
+#endif
+
+//  Zero-copy turns off after this many completions in a row where the
+//  kernel copied the data anyway
+#define ZMTP_ZEROCOPY_COPIED_MAX 8
 
 //  ZMTP greeting (64 bytes)
 
@@ -22,18 +37,148 @@ struct zmtp_greeting {
     byte filler [31];
 };
 
+//  This is our greeting
+
+static const struct zmtp_greeting s_greeting = {
+    .signature = { 0xff, 0, 0, 0, 0, 0, 0, 0, 1, 0x7f },
+    .version   = { 3, 0 },
+    .mechanism = { 'N', 'U', 'L', 'L', '\0' }
+};
+
+//  Maximum number of frames handed to one sendmsg call; each frame takes
+//  up to two I/O vector entries
+
+#if (!defined (IOV_MAX))
+#   define IOV_MAX 1024
+#endif
+#if (IOV_MAX > 1024)
+#   define ZMTP_SEND_BATCH_MAX 512
+#else
+#   define ZMTP_SEND_BATCH_MAX (IOV_MAX / 2)
+#endif
+
+//  Lets the header of a zero-copy frame wait for its body, where supported
+
+#if (!defined (MSG_MORE))
+#   define MSG_MORE 0
+#endif
+
+//  A peer that goes away must not kill us with SIGPIPE
+
+#if (!defined (MSG_NOSIGNAL))
+#   define MSG_NOSIGNAL 0
+#endif
+
+//  Size of per-channel read-ahead buffer
+
+#define ZMTP_CHANNEL_BUFFER_SIZE 8192
+
+//  Frame waiting to be sent in non-blocking mode
+
+struct out_frame {
+    byte header [9];            //  Encoded frame header
+    size_t header_size;         //  Size of encoded header
+    zmtp_msg_t *msg;            //  Reference to message
+};
+
+//  Frame body sent with MSG_ZEROCOPY. The kernel numbers zero-copy send
+//  calls on each socket, and reports ranges of numbers as it is done
+//  with their pages; the body must not change or go away until then.
+
+struct zc_frame {
+    zmtp_msg_t *msg;            //  Reference to message
+    uint32_t first;             //  Number of first send call for body
+    uint32_t last;              //  Number of last send call for body
+    uint32_t pending;           //  Calls not reported complete yet
+};
+
 //  Structure of our class
 
 struct _zmtp_channel_t {
     int fd;             //  BSD socket handle
+    zmtp_engine_t *engine;  //  Moves bytes in and out of the socket
+    int engine_type;        //  ZMTP_ENGINE_SYSCALL or ZMTP_ENGINE_URING
+    bool nonblocking;   //  Return EAGAIN instead of waiting for I/O
+    bool handshaking;   //  Non-blocking handshake not finished yet
+    bool greeted;       //  Peer's greeting received and checked
+    int sockopts [ZMTP_SOCKOPT_COUNT];  //  Socket options, -1 if unset
+    int connect_timeout;    //  Msecs to wait for connect, -1 for ever
+    size_t rd_pos;      //  Start of unread data in buffer
+    size_t rd_end;      //  End of unread data in buffer
+    zmtp_msg_pool_t *pool;  //  Pool for received messages
+    zmtp_msg_t *in_msg;     //  Message being received, if any
+    size_t in_read;         //  Bytes of its body received so far
+    size_t in_body;         //  Bytes of streamed body not received yet
+    size_t in_discard;      //  Bytes of rejected frame left to skip
+    bool in_discard_more;   //  Rejected message has more frames to skip
+    size_t maxmsgsize;      //  Largest frame accepted; 0 if no limit
+    size_t budget;          //  Most bytes held in messages; 0 if no limit
+    size_t held;            //  Bytes of messages held by the channel
+    struct out_frame *out_queue;    //  Frames waiting to be sent
+    size_t out_head;        //  First frame in queue
+    size_t out_tail;        //  End of frames in queue
+    size_t out_max;         //  Allocated size of queue
+    size_t out_offset;      //  Bytes of first frame sent already
+    size_t sent;            //  Bytes written to the socket so far
+    size_t zc_threshold;    //  Smallest body sent zero-copy; 0 if off
+    uint32_t zc_seqno;      //  Number of next zero-copy send call
+    struct zc_frame *zc_queue;      //  Bodies still owned by the kernel
+    size_t zc_head;         //  First body in queue
+    size_t zc_tail;         //  End of bodies in queue
+    size_t zc_max;          //  Allocated size of queue
+    size_t zc_copied;       //  Completions in a row that were copied
+    byte buffer [ZMTP_CHANNEL_BUFFER_SIZE];
 };
 
-static zmtp_endpoint_t *
-    s_endpoint_from_str (const char *endpoint_str);
 static int
     s_negotiate (zmtp_channel_t *self);
+static int
+    s_send_greeting (zmtp_channel_t *self);
+static bool
+    s_signature_ok (zmtp_channel_t *self);
+static int
+    s_take_greeting (zmtp_channel_t *self);
+static bool
+    s_is_ready (zmtp_msg_t *msg);
+static void
+    s_apply_sockopt (zmtp_channel_t *self, int option);
+static void
+    s_apply_sockopts (zmtp_channel_t *self);
+static size_t
+    s_decode_header (zmtp_channel_t *self, byte *msg_flags, size_t *size);
+static bool
+    s_has_frame (zmtp_channel_t *self);
+static int
+    s_recv_header (zmtp_channel_t *self, byte *msg_flags, size_t *size);
+static bool
+    s_acceptable (zmtp_channel_t *self, size_t size);
+static size_t
+    s_room (zmtp_channel_t *self);
+static int
+    s_discard (zmtp_channel_t *self);
+static zmtp_msg_t *
+    s_decode_buffered (zmtp_channel_t *self);
+static int
+    s_send_nowait (zmtp_channel_t *self, zmtp_msg_t **msgs, size_t count);
+static void
+    s_queue_frame (zmtp_channel_t *self, zmtp_msg_t *msg);
+static int
+    s_send_zerocopy (zmtp_channel_t *self, zmtp_msg_t *msg);
+static int
+    s_zerocopy_reap (zmtp_channel_t *self, int timeout);
+static void
+    s_zerocopy_complete (zmtp_channel_t *self, uint32_t lo, uint32_t hi);
+static void
+    s_zerocopy_release (zmtp_channel_t *self);
+static int
+    s_fill (zmtp_channel_t *self, size_t min_bytes);
+static ssize_t
+    s_fill_nowait (zmtp_channel_t *self);
 static int
     s_tcp_send (int fd, const void *data, size_t len);
+static int
+    s_tcp_sendv (zmtp_channel_t *self,
+                 struct iovec *iov, int iovcnt, int flags);
 static int
     s_tcp_recv (int fd, void *buffer, size_t len);
 
@@ -47,6 +192,13 @@ zmtp_channel_new ()
     zmtp_channel_t *self = (zmtp_channel_t *) zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
     self->fd = -1;
+    self->connect_timeout = -1;
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        self->sockopts [option] = -1;
+    self->engine = (zmtp_engine_t *) zmtp_sys_engine_new ();
+    assert (self->engine);
+    self->engine_type = ZMTP_ENGINE_SYSCALL;
+    self->pool = zmtp_msg_pool_new ();
     return self;
 }
 
@@ -60,14 +212,35 @@ zmtp_channel_destroy (zmtp_channel_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_channel_t *self = *self_p;
+        s_zerocopy_release (self);
+        free (self->zc_queue);
+        zmtp_engine_destroy (&self->engine);
         if (self->fd != -1)
             close (self->fd);
+        for (size_t index = self->out_head; index < self->out_tail; index++)
+            zmtp_msg_destroy (&self->out_queue [index].msg);
+        free (self->out_queue);
+        zmtp_msg_destroy (&self->in_msg);
+        zmtp_msg_pool_destroy (&self->pool);
         free (self);
         *self_p = NULL;
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Set how long connect calls wait for the peer, in msecs; -1, the
+//  default, waits for ever. A connect that times out fails with errno set
+//  to ETIMEDOUT.
+
+void
+zmtp_channel_set_connect_timeout (zmtp_channel_t *self, int timeout)
+{
+    assert (self);
+    self->connect_timeout = timeout;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Connect channel to local endpoint
 
@@ -84,11 +257,12 @@ zmtp_channel_ipc_connect (zmtp_channel_t *self, const char *path)
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
 
+    s_apply_sockopts (self);
     if (s_negotiate (self) == -1) {
         close (self->fd);
         self->fd = -1;
@@ -116,11 +290,12 @@ zmtp_channel_tcp_connect (zmtp_channel_t *self,
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
 
+    s_apply_sockopts (self);
     if (s_negotiate (self) == -1) {
         close (self->fd);
         self->fd = -1;
@@ -142,15 +317,16 @@ zmtp_channel_connect (zmtp_channel_t *self, const char *endpoint_str)
     if (self->fd != -1)
         return -1;
 
-    zmtp_endpoint_t *endpoint = s_endpoint_from_str (endpoint_str);
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_new (endpoint_str);
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
 
+    s_apply_sockopts (self);
     if (s_negotiate (self) == -1) {
         close (self->fd);
         self->fd = -1;
@@ -172,7 +348,7 @@ zmtp_channel_listen (zmtp_channel_t *self, const char *endpoint_str)
     if (self->fd != -1)
         return -1;
 
-    zmtp_endpoint_t *endpoint = s_endpoint_from_str (endpoint_str);
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_new (endpoint_str);
     if (endpoint == NULL)
         return -1;
 
@@ -181,6 +357,7 @@ zmtp_channel_listen (zmtp_channel_t *self, const char *endpoint_str)
     if (self->fd == -1)
         return -1;
 
+    s_apply_sockopts (self);
     if (s_negotiate (self) == -1) {
         close (self->fd);
         self->fd = -1;
@@ -190,203 +367,1424 @@ zmtp_channel_listen (zmtp_channel_t *self, const char *endpoint_str)
     return 0;
 }
 
-static zmtp_endpoint_t *
-s_endpoint_from_str (const char *endpoint_str)
+
+//  --------------------------------------------------------------------------
+//  Negotiate a ZMTP channel over a connected socket, e.g. one accepted by
+//  a listener. The channel takes ownership of the socket, and closes it
+//  if negotiation fails. Returns 0 if OK, -1 on error.
+
+int
+zmtp_channel_attach (zmtp_channel_t *self, int fd)
 {
-    if (strncmp (endpoint_str, "ipc://", 6) == 0)
-        return (zmtp_endpoint_t *)
-            zmtp_ipc_endpoint_new (endpoint_str + 6);
-    else
-    if (strncmp (endpoint_str, "tcp://", 6) == 0) {
-        char *colon = strrchr (endpoint_str + 6, ':');
-        if (colon == NULL)
-            return NULL;
-        else {
-            const size_t addr_len = colon - endpoint_str - 6;
-            char addr [addr_len + 1];
-            memcpy (addr, endpoint_str + 6, addr_len);
-            addr [addr_len] = '\0';
-            const unsigned short port = atoi (colon + 1);
-            return (zmtp_endpoint_t *)
-                zmtp_tcp_endpoint_new (addr, port);
+    assert (self);
+    assert (fd != -1);
+
+    if (self->fd != -1) {
+        close (fd);
+        return -1;
+    }
+
+    self->fd = fd;
+    s_apply_sockopts (self);
+    if (s_negotiate (self) == -1) {
+        close (self->fd);
+        self->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Shut the connection down both ways, so that calls blocked on it in
+//  other threads fail at once. The channel is still to be destroyed.
+
+void
+zmtp_channel_shutdown (zmtp_channel_t *self)
+{
+    assert (self);
+    if (self->fd != -1)
+        shutdown (self->fd, SHUT_RDWR);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start negotiating a ZMTP channel over a connected socket without
+//  waiting for the peer: switches the socket to non-blocking mode and
+//  sends our greeting. Call zmtp_channel_handshake each time the socket
+//  is readable to finish. The channel takes ownership of the socket, and
+//  closes it on failure. Returns 0 if OK, -1 on error.
+
+int
+zmtp_channel_attach_nowait (zmtp_channel_t *self, int fd)
+{
+    assert (self);
+    assert (fd != -1);
+
+    if (self->fd != -1) {
+        close (fd);
+        return -1;
+    }
+
+    self->fd = fd;
+    s_apply_sockopts (self);
+    //  A new connection has room for our greeting in its send buffer
+    if (zmtp_channel_set_nonblocking (self, true) == -1
+    ||  s_send_greeting (self) == -1) {
+        close (self->fd);
+        self->fd = -1;
+        self->nonblocking = false;
+        return -1;
+    }
+    self->handshaking = true;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Continue a handshake started with zmtp_channel_attach_nowait, taking
+//  what the peer has sent so far. Returns 0 once the channel is ready, and
+//  -1 with errno set to EAGAIN while the peer has more to send, or to any
+//  other value if the handshake failed. The channel is then left in
+//  non-blocking mode.
+
+int
+zmtp_channel_handshake (zmtp_channel_t *self)
+{
+    assert (self);
+    if (!self->handshaking)
+        return 0;
+
+    if (s_fill_nowait (self) == -1) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (!self->greeted) {
+        const size_t available = self->rd_end - self->rd_pos;
+        //  Whatever talks to us, if not ZMTP, gets dropped at once
+        if (available >= 10 && !s_signature_ok (self)) {
+            errno = EPROTO;
+            return -1;
         }
+        if (available < sizeof (struct zmtp_greeting)) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (s_take_greeting (self) == -1) {
+            errno = EPROTO;
+            return -1;
+        }
+        self->greeted = true;
     }
-    else
-        return NULL;
+    zmtp_msg_t *ready = s_decode_buffered (self);
+    if (!ready) {
+        //  A command we refuse, or one larger than our buffer, never
+        //  makes it
+        errno = s_has_frame (self)
+             || self->rd_end - self->rd_pos == ZMTP_CHANNEL_BUFFER_SIZE
+              ? EPROTO: EAGAIN;
+        return -1;
+    }
+    const bool is_ready = s_is_ready (ready);
+    zmtp_msg_destroy (&ready);
+    if (!is_ready) {
+        errno = EPROTO;
+        return -1;
+    }
+    self->handshaking = false;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Negotiate a ZMTP channel
+//  This currently does only ZMTP v3, and will reject older protocols.
+//  Since we never fall back to an older protocol, there is no need to
+//  exchange the greeting piecemeal: we send our whole greeting and READY
+//  command in one go, and read the peer's through the read-ahead buffer.
+
+static int
+s_negotiate (zmtp_channel_t *self)
+{
+    assert (self);
+    assert (self->fd != -1);
+
+    if (s_send_greeting (self) == -1)
+        goto io_error;
+
+    //  Check protocol signature
+    if (s_fill (self, 10) == -1 || !s_signature_ok (self))
+        goto io_error;
+
+    //  Read the rest of greeting
+    if (s_fill (self, sizeof (struct zmtp_greeting)) == -1
+    ||  s_take_greeting (self) == -1)
+        goto io_error;
+
+    //  Receive READY command
+    zmtp_msg_t *ready = zmtp_channel_recv (self);
+    if (!ready)
+        goto io_error;
+    const bool is_ready = s_is_ready (ready);
+    zmtp_msg_destroy (&ready);
+    if (!is_ready)
+        goto io_error;
+
+    return 0;
+
+io_error:
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send our greeting and READY command
+
+static int
+s_send_greeting (zmtp_channel_t *self)
+{
+    zmtp_msg_t *ready =
+        zmtp_msg_from_const_data (ZMTP_MSG_COMMAND, "\5READY", 6);
+    assert (ready);
+    byte ready_header [9];
+    struct iovec iov [3] = {
+        { .iov_base = (void *) &s_greeting,
+          .iov_len = sizeof s_greeting },
+        { .iov_base = ready_header,
+          .iov_len = zmtp_channel_encode_header (ready_header, ready) },
+        { .iov_base = zmtp_msg_data (ready),
+          .iov_len = zmtp_msg_size (ready) }
+    };
+    const int rc = s_tcp_sendv (self, iov, 3, 0);
+    zmtp_msg_destroy (&ready);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if the buffer starts with a ZMTP signature; at least 10
+//  bytes must be buffered
+
+static bool
+s_signature_ok (zmtp_channel_t *self)
+{
+    const byte *signature = self->buffer + self->rd_pos;
+    return signature [0] == 0xff && (signature [9] & 1) == 1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Check and consume the peer's greeting, which must be buffered. Returns
+//  0 if we can talk to the peer, -1 if not.
+
+static int
+s_take_greeting (zmtp_channel_t *self)
+{
+    struct zmtp_greeting incoming;
+    memcpy (&incoming, self->buffer + self->rd_pos, sizeof incoming);
+    self->rd_pos += sizeof incoming;
+    if (incoming.signature [0] != 0xff
+    || (incoming.signature [9] & 1) != 1
+    ||  incoming.version [0] < 3
+    ||  memcmp (incoming.mechanism,
+                s_greeting.mechanism, sizeof incoming.mechanism) != 0)
+        return -1;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if message is a READY command
+
+static bool
+s_is_ready (zmtp_msg_t *msg)
+{
+    return (zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND
+        && zmtp_msg_size (msg) >= 6
+        && memcmp (zmtp_msg_data (msg), "\5READY", 6) == 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send a ZMTP message to the channel
+
+int
+zmtp_channel_send (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    if (self->nonblocking)
+        return s_send_nowait (self, &msg, 1);
+    if (self->zc_threshold > 0 && zmtp_msg_size (msg) >= self->zc_threshold)
+        return zmtp_channel_send_batch (self, &msg, 1);
+
+    //  Frame header and body go out in a single system call
+    byte header [9];
+    struct iovec iov [2] = {
+        { .iov_base = header,
+          .iov_len = zmtp_channel_encode_header (header, msg) },
+        { .iov_base = zmtp_msg_data (msg),
+          .iov_len = zmtp_msg_size (msg) }
+    };
+    return s_tcp_sendv (self, iov, iov [1].iov_len > 0? 2: 1, 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send an array of ZMTP messages to the channel, encoding all frame
+//  headers up front and flushing with as few system calls as IOV_MAX
+//  allows.
+
+int
+zmtp_channel_send_batch (zmtp_channel_t *self,
+                         zmtp_msg_t **msgs, size_t count)
+{
+    assert (self);
+    assert (msgs || count == 0);
+
+    if (self->nonblocking)
+        return s_send_nowait (self, msgs, count);
+
+    byte headers [ZMTP_SEND_BATCH_MAX][9];
+    struct iovec iov [2 * ZMTP_SEND_BATCH_MAX];
+
+    size_t index = 0;
+    while (index < count) {
+        int iovcnt = 0;
+        zmtp_msg_t *zerocopy_msg = NULL;
+        for (int i = 0; i < ZMTP_SEND_BATCH_MAX && index < count; i++) {
+            zmtp_msg_t *msg = msgs [index++];
+            assert (msg);
+            iov [iovcnt].iov_base = headers [i];
+            iov [iovcnt].iov_len =
+                zmtp_channel_encode_header (headers [i], msg);
+            iovcnt++;
+            //  Large bodies go out on their own, after what we have so far
+            if (self->zc_threshold > 0
+            &&  zmtp_msg_size (msg) >= self->zc_threshold) {
+                zerocopy_msg = msg;
+                break;
+            }
+            if (zmtp_msg_size (msg) > 0) {
+                iov [iovcnt].iov_base = zmtp_msg_data (msg);
+                iov [iovcnt].iov_len = zmtp_msg_size (msg);
+                iovcnt++;
+            }
+        }
+        //  Corked, all but the last write leave partial segments for the
+        //  next one to fill
+        const bool more = zerocopy_msg != NULL
+            || (index < count && self->sockopts [ZMTP_SOCKOPT_CORK] == 1);
+        if (s_tcp_sendv (self, iov, iovcnt, more? MSG_MORE: 0) == -1)
+            return -1;
+        if (zerocopy_msg && s_send_zerocopy (self, zerocopy_msg) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send frame bodies of threshold bytes or more with MSG_ZEROCOPY, so the
+//  kernel reads them straight from the message instead of copying them
+//  into the socket buffer. The channel keeps a reference to each such
+//  message until the kernel is done with it; constant data must stay
+//  valid until then, or until the channel is destroyed. Destroying the
+//  channel does not wait for the kernel: if data of such bodies is still
+//  unsent, it resets the connection rather than let that data go out
+//  after the memory is reused. Pays off for bodies upwards of 10 KB or
+//  so. Applies to blocking sends only. Zero-copy turns itself off when
+//  the kernel keeps copying anyway, as over loopback. A threshold of 0
+//  turns zero-copy off. The channel must be a connected TCP channel.
+//  Returns 0 if OK, -1 on error.
+
+int
+zmtp_channel_set_zerocopy (zmtp_channel_t *self, size_t threshold)
+{
+    assert (self);
+    if (self->fd == -1)
+        return -1;
+    if (threshold == 0) {
+        self->zc_threshold = 0;
+        return 0;
+    }
+#if defined (ZMTP_HAVE_ZEROCOPY)
+    const int on = 1;
+    if (setsockopt (self->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) == -1)
+        return -1;
+    self->zc_threshold = threshold;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the largest frame the channel accepts, in bytes; 0, the default,
+//  sets no limit. Larger frames are skipped without being stored, along
+//  with the rest of their message, and the receive call fails with
+//  EMSGSIZE; frames of the message received before are the caller's to
+//  drop. Streamed frames are not checked.
+
+void
+zmtp_channel_set_maxmsgsize (zmtp_channel_t *self, size_t size)
+{
+    assert (self);
+    self->maxmsgsize = size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the most bytes of message data the channel may hold at a time;
+//  0, the default, sets no limit. This covers the frame being received,
+//  frames queued by non-blocking sends, and bodies lent to the kernel for
+//  zero-copy sends. Frames that do not fit are rejected as if over the
+//  maximum message size, non-blocking sends fail with ENOBUFS, and
+//  zero-copy sends fall back to copying.
+
+void
+zmtp_channel_set_budget (zmtp_channel_t *self, size_t budget)
+{
+    assert (self);
+    self->budget = budget;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set a socket option (ZMTP_SOCKOPT_*) on the channel's socket, now if
+//  connected and on connecting otherwise. Options that do not apply to
+//  the transport, or that the system refuses, are ignored. Returns 0 if
+//  OK, -1 if the option or value is invalid.
+
+int
+zmtp_channel_set_sockopt (zmtp_channel_t *self, int option, int value)
+{
+    assert (self);
+    if (option < 0 || option >= ZMTP_SOCKOPT_COUNT || value < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    self->sockopts [option] = value;
+    if (self->fd != -1)
+        s_apply_sockopt (self, option);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Store the socket options of a profile (ZMTP_PROFILE_*) into an array
+//  of ZMTP_SOCKOPT_COUNT values; options the profile leaves alone are -1.
+//  Returns 0 if OK, -1 if the profile is unknown.
+
+int
+zmtp_channel_profile_sockopts (int profile, int *sockopts)
+{
+    assert (sockopts);
+    //  Switches are set either way, so that profiles can replace each
+    //  other; buffer sizes are only ever raised
+    switch (profile) {
+        case ZMTP_PROFILE_DEFAULT:
+            sockopts [ZMTP_SOCKOPT_NODELAY] = 0;
+            sockopts [ZMTP_SOCKOPT_QUICKACK] = 0;
+            sockopts [ZMTP_SOCKOPT_BUSY_POLL] = 0;
+            sockopts [ZMTP_SOCKOPT_SNDBUF] = -1;
+            sockopts [ZMTP_SOCKOPT_RCVBUF] = -1;
+            sockopts [ZMTP_SOCKOPT_CORK] = 0;
+            return 0;
+        case ZMTP_PROFILE_LOW_LATENCY:
+            sockopts [ZMTP_SOCKOPT_NODELAY] = 1;
+            sockopts [ZMTP_SOCKOPT_QUICKACK] = 1;
+            sockopts [ZMTP_SOCKOPT_BUSY_POLL] = 50;
+            sockopts [ZMTP_SOCKOPT_SNDBUF] = -1;
+            sockopts [ZMTP_SOCKOPT_RCVBUF] = -1;
+            sockopts [ZMTP_SOCKOPT_CORK] = 0;
+            return 0;
+        case ZMTP_PROFILE_BULK:
+            sockopts [ZMTP_SOCKOPT_NODELAY] = 0;
+            sockopts [ZMTP_SOCKOPT_QUICKACK] = 0;
+            sockopts [ZMTP_SOCKOPT_BUSY_POLL] = 0;
+            sockopts [ZMTP_SOCKOPT_SNDBUF] = 4 * 1024 * 1024;
+            sockopts [ZMTP_SOCKOPT_RCVBUF] = 4 * 1024 * 1024;
+            sockopts [ZMTP_SOCKOPT_CORK] = 1;
+            return 0;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set socket option on connected socket; errors are ignored, as options
+//  are hints and TCP options fail on IPC sockets. Buffer sizes set after
+//  connecting still take effect: Linux scales the receive window for the
+//  largest buffer the system allows unless the size was set beforehand.
+
+static void
+s_apply_sockopt (zmtp_channel_t *self, int option)
+{
+    const int value = self->sockopts [option];
+    if (value == -1)
+        return;
+    switch (option) {
+        case ZMTP_SOCKOPT_NODELAY:
+            setsockopt (self->fd,
+                IPPROTO_TCP, TCP_NODELAY, &value, sizeof value);
+            break;
+#if defined (TCP_QUICKACK)
+        case ZMTP_SOCKOPT_QUICKACK:
+            setsockopt (self->fd,
+                IPPROTO_TCP, TCP_QUICKACK, &value, sizeof value);
+            break;
+#endif
+#if defined (SO_BUSY_POLL)
+        case ZMTP_SOCKOPT_BUSY_POLL:
+            setsockopt (self->fd,
+                SOL_SOCKET, SO_BUSY_POLL, &value, sizeof value);
+            break;
+#endif
+        case ZMTP_SOCKOPT_SNDBUF:
+            setsockopt (self->fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof value);
+            break;
+        case ZMTP_SOCKOPT_RCVBUF:
+            setsockopt (self->fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof value);
+            break;
+        default:
+            //  Applies when sending
+            break;
+    }
+}
+
+static void
+s_apply_sockopts (zmtp_channel_t *self)
+{
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        s_apply_sockopt (self, option);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Switch channel to or from non-blocking mode. In non-blocking mode, send
+//  and receive calls fail with EAGAIN instead of waiting for the socket,
+//  and partly written or read frames are completed by later calls. The
+//  channel must be connected. Returns 0 if OK, -1 on error.
+
+int
+zmtp_channel_set_nonblocking (zmtp_channel_t *self, bool nonblocking)
+{
+    assert (self);
+    if (self->fd == -1)
+        return -1;
+
+    int flags = fcntl (self->fd, F_GETFL, 0);
+    if (flags == -1)
+        return -1;
+    if (nonblocking)
+        flags |= O_NONBLOCK;
+    else
+        flags &= ~O_NONBLOCK;
+    if (fcntl (self->fd, F_SETFL, flags) == -1)
+        return -1;
+    self->nonblocking = nonblocking;
+
+    //  Blocking sends must not overtake queued frames
+    return nonblocking? 0: zmtp_channel_flush (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write frames left over by non-blocking sends. Returns 0 when all output
+//  is written, -1 with errno set to EAGAIN when some is still pending, or
+//  -1 on any other error. In blocking mode, waits until all is written.
+
+int
+zmtp_channel_flush (zmtp_channel_t *self)
+{
+    assert (self);
+
+    while (self->out_head < self->out_tail) {
+        struct iovec iov [2 * ZMTP_SEND_BATCH_MAX];
+        int iovcnt = 0;
+        size_t skip = self->out_offset;
+        for (size_t index = self->out_head; index < self->out_tail
+                && iovcnt < 2 * ZMTP_SEND_BATCH_MAX; index++) {
+            struct out_frame *frame = &self->out_queue [index];
+            if (skip < frame->header_size) {
+                iov [iovcnt].iov_base = frame->header + skip;
+                iov [iovcnt].iov_len = frame->header_size - skip;
+                iovcnt++;
+                skip = 0;
+            }
+            else
+                skip -= frame->header_size;
+            const size_t size = zmtp_msg_size (frame->msg);
+            if (skip < size) {
+                iov [iovcnt].iov_base = zmtp_msg_data (frame->msg) + skip;
+                iov [iovcnt].iov_len = size - skip;
+                iovcnt++;
+                skip = 0;
+            }
+            else
+                skip -= size;
+        }
+        struct msghdr msghdr = {
+            .msg_iov = iov,
+            .msg_iovlen = iovcnt
+        };
+        const ssize_t rc = zmtp_engine_sendmsg (self->engine,
+            self->fd, &msghdr,
+            MSG_NOSIGNAL | (self->nonblocking? MSG_DONTWAIT: 0));
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return -1;
+        self->sent += rc;
+
+        //  Retire frames that went out completely
+        size_t bytes_sent = self->out_offset + rc;
+        while (self->out_head < self->out_tail) {
+            struct out_frame *frame = &self->out_queue [self->out_head];
+            const size_t frame_size =
+                frame->header_size + zmtp_msg_size (frame->msg);
+            if (bytes_sent < frame_size)
+                break;
+            bytes_sent -= frame_size;
+            self->held -= zmtp_msg_size (frame->msg);
+            zmtp_msg_destroy (&frame->msg);
+            self->out_head++;
+        }
+        self->out_offset = bytes_sent;
+    }
+    self->out_head = 0;
+    self->out_tail = 0;
+    self->out_offset = 0;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of bytes written to the socket so far, frame headers
+//  included. After a failed send, the difference tells how much of it went
+//  out.
+
+size_t
+zmtp_channel_sent (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->sent;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if frames left over by non-blocking sends are waiting to
+//  be written
+
+bool
+zmtp_channel_has_output (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->out_head < self->out_tail;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue messages for sending and write as much as the socket accepts
+//  without blocking. Fails with EAGAIN, accepting none of the messages,
+//  if earlier output is still pending or nothing could be written.
+
+static int
+s_send_nowait (zmtp_channel_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    if (zmtp_channel_flush (self) == -1)
+        return -1;
+
+    if (self->budget > 0) {
+        size_t bytes = 0;
+        for (size_t index = 0; index < count; index++)
+            bytes += zmtp_msg_size (msgs [index]);
+        if (bytes > s_room (self)) {
+            errno = ENOBUFS;
+            return -1;
+        }
+    }
+    for (size_t index = 0; index < count; index++)
+        s_queue_frame (self, msgs [index]);
+    if (zmtp_channel_flush (self) == -1 && errno != EAGAIN)
+        return -1;
+
+    //  Take the messages back if none of their bytes went out
+    if (self->out_tail > 0 && self->out_head == 0 && self->out_offset == 0) {
+        for (size_t index = 0; index < self->out_tail; index++) {
+            self->held -= zmtp_msg_size (self->out_queue [index].msg);
+            zmtp_msg_destroy (&self->out_queue [index].msg);
+        }
+        self->out_tail = 0;
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append frame for message to the output queue, taking a reference to
+//  the message
+
+static void
+s_queue_frame (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+    assert (msg);
+    if (self->out_tail == self->out_max) {
+        self->out_max = self->out_max? 2 * self->out_max: 16;
+        self->out_queue = (struct out_frame *) realloc (
+            self->out_queue, self->out_max * sizeof *self->out_queue);
+        assert (self->out_queue);   //  For now, memory exhaustion is fatal
+    }
+    struct out_frame *frame = &self->out_queue [self->out_tail++];
+    frame->header_size = zmtp_channel_encode_header (frame->header, msg);
+    frame->msg = zmtp_msg_ref (msg);
+    self->held += zmtp_msg_size (msg);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send the body of a message with MSG_ZEROCOPY and queue a reference to
+//  the message until the kernel reports it is done with the body.
+
+static int
+s_send_zerocopy (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+#if defined (ZMTP_HAVE_ZEROCOPY)
+    const byte *data = zmtp_msg_data (msg);
+    const size_t size = zmtp_msg_size (msg);
+    const uint32_t first = self->zc_seqno;
+    int rc = 0;
+
+    //  Bodies lent to the kernel count against our budget
+    if (size > s_room (self)) {
+        if (s_zerocopy_reap (self, 0) == -1)
+            return -1;
+        if (size > s_room (self)) {
+            if (s_tcp_send (self->fd, data, size) == -1)
+                return -1;
+            self->sent += size;
+            return 0;
+        }
+    }
+
+    size_t bytes_sent = 0;
+    while (bytes_sent < size) {
+        const ssize_t n = send (self->fd,
+            data + bytes_sent, size - bytes_sent,
+            MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == ENOBUFS) {
+            //  Too many notifications outstanding; copy the rest
+            rc = s_tcp_send (self->fd,
+                data + bytes_sent, size - bytes_sent);
+            if (rc == 0)
+                self->sent += size - bytes_sent;
+            break;
+        }
+        if (n == -1) {
+            rc = -1;
+            break;
+        }
+        self->zc_seqno++;
+        self->sent += n;
+        bytes_sent += n;
+    }
+
+    //  Even after an error, the kernel may hold pages of the body
+    if (self->zc_seqno != first) {
+        if (self->zc_tail == self->zc_max) {
+            self->zc_max = self->zc_max? 2 * self->zc_max: 16;
+            self->zc_queue = (struct zc_frame *) realloc (
+                self->zc_queue, self->zc_max * sizeof *self->zc_queue);
+            assert (self->zc_queue);    //  For now, memory exhaustion is fatal
+        }
+        struct zc_frame *frame = &self->zc_queue [self->zc_tail++];
+        frame->msg = zmtp_msg_ref (msg);
+        self->held += size;
+        frame->first = first;
+        frame->last = self->zc_seqno - 1;
+        frame->pending = self->zc_seqno - first;
+    }
+    if (rc == -1)
+        return -1;
+
+    //  Release whatever bodies the kernel is done with by now
+    return s_zerocopy_reap (self, 0);
+#else
+    if (s_tcp_send (self->fd, zmtp_msg_data (msg), zmtp_msg_size (msg)) == -1)
+        return -1;
+    self->sent += zmtp_msg_size (msg);
+    return 0;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read zero-copy completions off the socket error queue and release the
+//  bodies they cover. Waits up to timeout msecs for the first completion
+//  if bodies are outstanding. Returns 0 if OK, -1 on error.
+
+static int
+s_zerocopy_reap (zmtp_channel_t *self, int timeout)
+{
+#if defined (ZMTP_HAVE_ZEROCOPY)
+    while (self->zc_head < self->zc_tail) {
+        byte control [CMSG_SPACE (sizeof (struct sock_extended_err))];
+        struct msghdr msghdr = {
+            .msg_control = control,
+            .msg_controllen = sizeof control
+        };
+        const ssize_t rc =
+            recvmsg (self->fd, &msghdr, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (timeout == 0)
+                break;
+            //  Error queue readiness is signalled as POLLERR
+            struct pollfd pollfd = { .fd = self->fd };
+            if (poll (&pollfd, 1, timeout) <= 0)
+                break;
+            timeout = 0;
+            continue;
+        }
+        if (rc == -1)
+            return -1;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msghdr);
+             cmsg; cmsg = CMSG_NXTHDR (&msghdr, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+            &&  !(cmsg->cmsg_level == SOL_IPV6
+               && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            struct sock_extended_err err;
+            memcpy (&err, CMSG_DATA (cmsg), sizeof err);
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            s_zerocopy_complete (self, err.ee_info, err.ee_data);
+            //  When the kernel keeps copying anyway, as over loopback,
+            //  zero-copy only adds the cost of completions. One copy, say
+            //  while a route changes, does not make it a habit.
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                if (++self->zc_copied == ZMTP_ZEROCOPY_COPIED_MAX)
+                    self->zc_threshold = 0;
+            }
+            else
+                self->zc_copied = 0;
+        }
+    }
+#endif
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Account for completion of zero-copy send calls lo to hi, and release
+//  bodies with no calls pending. Completions may come out of order.
+
+static void
+s_zerocopy_complete (zmtp_channel_t *self, uint32_t lo, uint32_t hi)
+{
+    //  Call numbers wrap around, so work relative to lo
+    const int64_t end = (uint32_t) (hi - lo);
+    for (size_t index = self->zc_head; index < self->zc_tail; index++) {
+        struct zc_frame *frame = &self->zc_queue [index];
+        if (frame->pending == 0)
+            continue;
+        const int64_t first = (int32_t) (frame->first - lo);
+        const int64_t last = (int32_t) (frame->last - lo);
+        const int64_t overlap =
+            (last < end? last: end) - (first > 0? first: 0) + 1;
+        if (overlap > 0) {
+            assert ((uint32_t) overlap <= frame->pending);
+            frame->pending -= (uint32_t) overlap;
+            if (frame->pending == 0) {
+                self->held -= zmtp_msg_size (frame->msg);
+                zmtp_msg_destroy (&frame->msg);
+            }
+        }
+    }
+    while (self->zc_head < self->zc_tail
+       &&  self->zc_queue [self->zc_head].pending == 0)
+        self->zc_head++;
+    if (self->zc_head == self->zc_tail) {
+        self->zc_head = 0;
+        self->zc_tail = 0;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Release bodies still lent to the kernel, before closing the socket.
+//  Completions may never come, say because the peer is gone, so we take
+//  those that are in and do not wait for more. The kernel holds its own
+//  references to pages it has yet to send, so releasing is safe for
+//  memory; but data still unsent could go out changed once the memory is
+//  reused, so then we have the close reset the connection and drop it.
+
+static void
+s_zerocopy_release (zmtp_channel_t *self)
+{
+#if defined (ZMTP_HAVE_ZEROCOPY)
+    if (self->zc_head == self->zc_tail)
+        return;
+    s_zerocopy_reap (self, 0);
+    if (self->zc_head < self->zc_tail) {
+        int unsent = 0;
+        if (ioctl (self->fd, SIOCOUTQ, &unsent) == -1 || unsent > 0) {
+            const struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+            setsockopt (self->fd,
+                SOL_SOCKET, SO_LINGER, &linger, sizeof linger);
+        }
+    }
+    for (size_t index = self->zc_head; index < self->zc_tail; index++) {
+        struct zc_frame *frame = &self->zc_queue [index];
+        if (frame->pending > 0) {
+            self->held -= zmtp_msg_size (frame->msg);
+            zmtp_msg_destroy (&frame->msg);
+        }
+    }
+    self->zc_head = 0;
+    self->zc_tail = 0;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Encode ZMTP frame header for the message into buffer, which must be at
+//  least 9 bytes long. Returns the length of the encoded header.
+
+size_t
+zmtp_channel_encode_header (byte *buffer, zmtp_msg_t *msg)
+{
+    byte frame_flags = 0;
+    if ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE)
+        frame_flags |= ZMTP_MORE_FLAG;
+    if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
+        frame_flags |= ZMTP_COMMAND_FLAG;
+
+    const size_t msg_size = zmtp_msg_size (msg);
+    if (msg_size <= 255) {
+        buffer [0] = frame_flags;
+        buffer [1] = (byte) msg_size;
+        return 2;
+    }
+    else {
+        const uint64_t size = (uint64_t) msg_size;
+        buffer [0] = frame_flags | ZMTP_LARGE_FLAG;
+        buffer [1] = size >> 56;
+        buffer [2] = size >> 48;
+        buffer [3] = size >> 40;
+        buffer [4] = size >> 32;
+        buffer [5] = size >> 24;
+        buffer [6] = size >> 16;
+        buffer [7] = size >> 8;
+        buffer [8] = size;
+        return 9;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a ZMTP message off the channel
+
+zmtp_msg_t *
+zmtp_channel_recv (zmtp_channel_t *self)
+{
+    assert (self);
+
+    if (self->in_body > 0) {
+        errno = EBUSY;          //  Streamed body not received yet
+        return NULL;
+    }
+    if (self->in_msg == NULL) {
+        if (s_discard (self) == -1)
+            return NULL;
+
+        //  Fast path: the whole frame is already buffered
+        zmtp_msg_t *msg = s_decode_buffered (self);
+        if (msg)
+            return msg;
+
+        byte msg_flags;
+        size_t size;
+        if (s_recv_header (self, &msg_flags, &size) == -1)
+            return NULL;
+        //  Reject frames over our limits before allocating for them
+        if (!s_acceptable (self, size)) {
+            self->in_discard = size;
+            self->in_discard_more =
+                (msg_flags & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+            errno = EMSGSIZE;
+            return NULL;
+        }
+        self->in_msg = zmtp_msg_new_pooled (self->pool, msg_flags, size);
+        self->in_read = 0;
+        self->held += size;
+    }
+
+    //  Continue with the body; in non-blocking mode, we may have been
+    //  here before
+    byte *data = zmtp_msg_data (self->in_msg);
+    const size_t size = zmtp_msg_size (self->in_msg);
+
+    //  Take whatever part of the body is already buffered
+    size_t bytes_read = self->rd_end - self->rd_pos;
+    if (bytes_read > size - self->in_read)
+        bytes_read = size - self->in_read;
+    memcpy (data + self->in_read, self->buffer + self->rd_pos, bytes_read);
+    self->rd_pos += bytes_read;
+    self->in_read += bytes_read;
+
+    //  Read large remainders straight into the message, and small ones
+    //  through the buffer so that following frames come along for free.
+    const size_t remaining = size - self->in_read;
+    if (remaining >= ZMTP_CHANNEL_BUFFER_SIZE / 2) {
+        while (self->in_read < size) {
+            const ssize_t n = zmtp_engine_recv (self->engine, self->fd,
+                data + self->in_read, size - self->in_read,
+                self->nonblocking? MSG_DONTWAIT: 0);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return NULL;
+            if (n == 0)
+                errno = ECONNRESET;
+            if (n == -1 || n == 0) {
+                zmtp_msg_destroy (&self->in_msg);
+                self->held -= size;
+                return NULL;
+            }
+            self->in_read += n;
+        }
+    }
+    else
+    if (remaining > 0) {
+        if (s_fill (self, remaining) == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                zmtp_msg_destroy (&self->in_msg);
+                self->held -= size;
+            }
+            return NULL;
+        }
+        memcpy (data + self->in_read, self->buffer + self->rd_pos, remaining);
+        self->rd_pos += remaining;
+    }
+    zmtp_msg_t *msg = self->in_msg;
+    self->in_msg = NULL;
+    self->held -= size;
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive the header of the next frame, leaving its body to be pulled
+//  with zmtp_channel_recv_body, so that frames of any size go through
+//  bounded memory. Stores the message flags and body size. Returns 0 if
+//  OK, -1 on error; fails with EBUSY while a body is still pending.
+
+int
+zmtp_channel_recv_header (zmtp_channel_t *self, byte *flags, size_t *size)
+{
+    assert (self);
+    assert (flags);
+    assert (size);
+
+    if (self->in_msg || self->in_body > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (s_discard (self) == -1
+    ||  s_recv_header (self, flags, size) == -1)
+        return -1;
+    self->in_body = *size;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to max bytes of the body announced by the last header into
+//  buffer, or skip them if buffer is NULL. Blocks only if nothing of the
+//  body is available. Returns the number of bytes received, 0 once the
+//  whole body is received, or -1 on error.
+
+ssize_t
+zmtp_channel_recv_body (zmtp_channel_t *self, void *buffer, size_t max)
+{
+    assert (self);
+
+    size_t size = self->in_body < max? self->in_body: max;
+    if (size == 0)
+        return 0;
+
+    if (self->rd_end == self->rd_pos) {
+        //  Large reads go straight into the caller's buffer
+        while (buffer && size >= ZMTP_CHANNEL_BUFFER_SIZE / 2) {
+            const ssize_t n = zmtp_engine_recv (self->engine, self->fd,
+                buffer, size, self->nonblocking? MSG_DONTWAIT: 0);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == 0)
+                errno = ECONNRESET;
+            if (n == -1 || n == 0)
+                return -1;
+            self->in_body -= n;
+            return n;
+        }
+        if (s_fill (self, 1) == -1)
+            return -1;
+    }
+    if (size > self->rd_end - self->rd_pos)
+        size = self->rd_end - self->rd_pos;
+    if (buffer)
+        memcpy (buffer, self->buffer + self->rd_pos, size);
+    self->rd_pos += size;
+    self->in_body -= size;
+    return size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to max messages off the channel into the out array. Blocks
+//  only if no complete message is available; otherwise returns every
+//  message that is already buffered or readable without blocking.
+//  Returns the number of messages received, or -1 on error.
+
+ssize_t
+zmtp_channel_recv_batch (zmtp_channel_t *self, zmtp_msg_t **out, size_t max)
+{
+    assert (self);
+    assert (out);
+
+    if (max == 0)
+        return 0;
+
+    size_t count = 0;
+    out [count] = zmtp_channel_recv (self);
+    if (out [count] == NULL)
+        return -1;
+    count++;
+
+    while (count < max) {
+        out [count] = s_decode_buffered (self);
+        if (out [count])
+            count++;
+        else
+        if (s_fill_nowait (self) <= 0)
+            break;
+    }
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if a complete message is buffered, so that it can be
+//  received without blocking, or the engine holds received data. Either
+//  way, its handle does not signal such input.
+
+bool
+zmtp_channel_has_input (zmtp_channel_t *self)
+{
+    assert (self);
+    const bool in_frame = self->in_body > 0
+        || self->in_discard > 0 || self->in_discard_more;
+    if (in_frame && self->rd_end > self->rd_pos)
+        return true;
+    return s_has_frame (self) || zmtp_engine_pending (self->engine) > 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the engine that does the socket I/O of the channel: plain system
+//  calls (ZMTP_ENGINE_SYSCALL, the default) or io_uring (ZMTP_ENGINE_URING),
+//  which receives into kernel-registered buffers ahead of time. Once set,
+//  the io_uring engine stays; zmtp_channel_fd then returns its handle. Each
+//  channel gets a ring of its own, so the engine batches the submissions
+//  of that channel only; it saves no system calls across channels, and
+//  costs a descriptor per channel. The channel must be connected. Returns
+//  0 if OK, -1 on error.
+
+int
+zmtp_channel_set_engine (zmtp_channel_t *self, int engine)
+{
+    assert (self);
+    if (self->fd == -1)
+        return -1;
+
+    if (engine == self->engine_type)
+        return 0;
+    if (engine != ZMTP_ENGINE_URING) {
+        errno = EINVAL;
+        return -1;
+    }
+    zmtp_engine_t *uring = (zmtp_engine_t *) zmtp_uring_engine_new (self->fd);
+    if (!uring)
+        return -1;
+    zmtp_engine_destroy (&self->engine);
+    self->engine = uring;
+    self->engine_type = engine;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the handle to poll for input on the channel, or -1 if not
+//  connected. This is the socket, unless an engine other than plain system
+//  calls receives for it.
+
+int
+zmtp_channel_fd (zmtp_channel_t *self)
+{
+    assert (self);
+    if (self->fd == -1)
+        return -1;
+    return zmtp_engine_handle (self->engine, self->fd);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Decode the frame header at the read position of the buffer, which must
+//  hold the complete header. Returns the length of the header.
+
+static size_t
+s_decode_header (zmtp_channel_t *self, byte *msg_flags, size_t *size)
+{
+    return zmtp_channel_decode_header (
+        self->buffer + self->rd_pos, msg_flags, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Decode ZMTP frame header, which must be complete: 2 bytes, or 9 if the
+//  large flag is set. Stores message flags and body size, and returns the
+//  length of the header.
+
+size_t
+zmtp_channel_decode_header (const byte *header, byte *msg_flags, size_t *size)
+{
+    const byte frame_flags = header [0];
+
+    *msg_flags = 0;
+    if ((frame_flags & ZMTP_MORE_FLAG) == ZMTP_MORE_FLAG)
+        *msg_flags |= ZMTP_MSG_MORE;
+    if ((frame_flags & ZMTP_COMMAND_FLAG) == ZMTP_COMMAND_FLAG)
+        *msg_flags |= ZMTP_MSG_COMMAND;
+
+    //  Check large flag
+    if ((frame_flags & ZMTP_LARGE_FLAG) == 0) {
+        *size = (size_t) header [1];
+        return 2;
+    }
+    else {
+        *size = (uint64_t) header [1] << 56 |
+                (uint64_t) header [2] << 48 |
+                (uint64_t) header [3] << 40 |
+                (uint64_t) header [4] << 32 |
+                (uint64_t) header [5] << 24 |
+                (uint64_t) header [6] << 16 |
+                (uint64_t) header [7] << 8  |
+                (uint64_t) header [8];
+        return 9;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read a frame header through the read-ahead buffer
+
+static int
+s_recv_header (zmtp_channel_t *self, byte *msg_flags, size_t *size)
+{
+    if (s_fill (self, 2) == -1)
+        return -1;
+    //  Check large flag
+    if ((self->buffer [self->rd_pos] & ZMTP_LARGE_FLAG) == ZMTP_LARGE_FLAG)
+        if (s_fill (self, 9) == -1)
+            return -1;
+    self->rd_pos += s_decode_header (self, msg_flags, size);
+    return 0;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Negotiate a ZMTP channel
-//  This currently does only ZMTP v3, and will reject older protocols.
-//  TODO: test sending random/wrong data to this handler.
+//  Return true if a frame of the given size fits our limits
 
-static int
-s_negotiate (zmtp_channel_t *self)
+static bool
+s_acceptable (zmtp_channel_t *self, size_t size)
 {
-    assert (self);
-    assert (self->fd != -1);
+    if (self->maxmsgsize > 0 && size > self->maxmsgsize)
+        return false;
+    return size <= s_room (self);
+}
 
-    const int s = self->fd;
 
-    //  This is our greeting (64 octets)
-    const struct zmtp_greeting outgoing = {
-        .signature = { 0xff, 0, 0, 0, 0, 0, 0, 0, 1, 0x7f },
-        .version   = { 3, 0 },
-        .mechanism = { 'N', 'U', 'L', 'L', '\0' }
-    };
-    //  Send protocol signature
-    if (s_tcp_send (s, outgoing.signature, sizeof outgoing.signature) == -1)
-        goto io_error;
+//  --------------------------------------------------------------------------
+//  Return how many more bytes of messages the budget lets us hold
 
-    //  Read the first byte.
-    struct zmtp_greeting incoming;
-    if (s_tcp_recv (s, incoming.signature, 1) == -1)
-        goto io_error;
-    assert (incoming.signature [0] == 0xff);
+static size_t
+s_room (zmtp_channel_t *self)
+{
+    if (self->budget == 0)
+        return SIZE_MAX;
+    return self->held < self->budget? self->budget - self->held: 0;
+}
 
-    //  Read the rest of signature
-    if (s_tcp_recv (s, incoming.signature + 1, 9) == -1)
-        goto io_error;
-    assert ((incoming.signature [9] & 1) == 1);
 
-    //  Exchange major version numbers
-    if (s_tcp_send (s, outgoing.version, 1) == -1)
-        goto io_error;
-    if (s_tcp_recv (s, incoming.version, 1) == -1)
-        goto io_error;
+//  --------------------------------------------------------------------------
+//  Skip what is left of a rejected message. Returns 0 once skipped, -1 on
+//  error, including EAGAIN in non-blocking mode.
 
-    assert (incoming.version [0] == 3);
+static int
+s_discard (zmtp_channel_t *self)
+{
+    while (self->in_discard > 0 || self->in_discard_more) {
+        if (self->in_discard == 0) {
+            byte msg_flags;
+            if (s_recv_header (self, &msg_flags, &self->in_discard) == -1)
+                return -1;
+            self->in_discard_more =
+                (msg_flags & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+            continue;
+        }
+        if (self->rd_end == self->rd_pos && s_fill (self, 1) == -1)
+            return -1;
+        size_t size = self->rd_end - self->rd_pos;
+        if (size > self->in_discard)
+            size = self->in_discard;
+        self->rd_pos += size;
+        self->in_discard -= size;
+    }
+    return 0;
+}
 
-    //  Send the rest of greeting to the peer.
-    if (s_tcp_send (s, outgoing.version + 1, 1) == -1)
-        goto io_error;
-    if (s_tcp_send (s, outgoing.mechanism, sizeof outgoing.mechanism) == -1)
-        goto io_error;
-    if (s_tcp_send (s, outgoing.as_server, sizeof outgoing.as_server) == -1)
-        goto io_error;
-    if (s_tcp_send (s, outgoing.filler, sizeof outgoing.filler) == -1)
-        goto io_error;
 
-    //  Receive the rest of greeting from the peer.
-    if (s_tcp_recv (s, incoming.version + 1, 1) == -1)
-        goto io_error;
-    if (s_tcp_recv (s, incoming.mechanism, sizeof incoming.mechanism) == -1)
-        goto io_error;
-    if (s_tcp_recv (s, incoming.as_server, sizeof incoming.as_server) == -1)
-        goto io_error;
-    if (s_tcp_recv (s, incoming.filler, sizeof incoming.filler) == -1)
-        goto io_error;
+//  --------------------------------------------------------------------------
+//  Return true if the read-ahead buffer holds the rest of a frame
 
-    //  Send READY command
-    zmtp_msg_t *ready = zmtp_msg_from_const_data (0x04, "\5READY", 6);
-    assert (ready);
-    zmtp_channel_send (self, ready);
-    zmtp_msg_destroy (&ready);
+static bool
+s_has_frame (zmtp_channel_t *self)
+{
+    const size_t available = self->rd_end - self->rd_pos;
+    if (self->in_body > 0 || self->in_discard > 0 || self->in_discard_more)
+        return false;
+    if (self->in_msg)
+        return zmtp_msg_size (self->in_msg) - self->in_read <= available;
+    if (available < 2)
+        return false;
+    if ((self->buffer [self->rd_pos] & ZMTP_LARGE_FLAG) == ZMTP_LARGE_FLAG
+    &&  available < 9)
+        return false;
+
+    byte msg_flags;
+    size_t size;
+    const size_t header_size = s_decode_header (self, &msg_flags, &size);
+    return size <= available - header_size;
+}
 
-    //  Receive READY command
-    ready = zmtp_channel_recv (self);
-    if (!ready)
-        goto io_error;
-    assert ((zmtp_msg_flags (ready) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND);
-    zmtp_msg_destroy (&ready);
 
-    return 0;
+//  --------------------------------------------------------------------------
+//  Decode a message out of the read-ahead buffer without doing any I/O.
+//  Returns NULL if the buffer does not hold a complete frame.
 
-io_error:
-    return -1;
+static zmtp_msg_t *
+s_decode_buffered (zmtp_channel_t *self)
+{
+    if (self->in_msg || self->in_body > 0 || !s_has_frame (self))
+        return NULL;
+
+    byte msg_flags;
+    size_t size;
+    const size_t header_size = s_decode_header (self, &msg_flags, &size);
+    if (!s_acceptable (self, size))
+        return NULL;            //  Rejected by the slow path
+
+    zmtp_msg_t *msg = zmtp_msg_new_pooled (self->pool, msg_flags, size);
+    memcpy (zmtp_msg_data (msg),
+        self->buffer + self->rd_pos + header_size, size);
+    self->rd_pos += header_size + size;
+    return msg;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Send a ZMTP message to the channel
+//  Make sure at least min_bytes of unread data are in the read-ahead
+//  buffer, reading as much as the socket has to offer.
 
-int
-zmtp_channel_send (zmtp_channel_t *self, zmtp_msg_t *msg)
+static int
+s_fill (zmtp_channel_t *self, size_t min_bytes)
 {
-    assert (self);
-    assert (msg);
-
-    byte frame_flags = 0;
-    if ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE)
-        frame_flags |= ZMTP_MORE_FLAG;
-    if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
-        frame_flags |= ZMTP_COMMAND_FLAG;
-    if (zmtp_msg_size (msg) > 255)
-        frame_flags |= ZMTP_LARGE_FLAG;
-    if (s_tcp_send (self->fd, &frame_flags, sizeof frame_flags) == -1)
-        return -1;
-
-    if (zmtp_msg_size (msg) <= 255) {
-        const byte msg_size = zmtp_msg_size (msg);
-        if (s_tcp_send (self->fd, &msg_size, sizeof msg_size) == -1)
-            return -1;
+    assert (min_bytes <= ZMTP_CHANNEL_BUFFER_SIZE);
+    size_t available = self->rd_end - self->rd_pos;
+    if (available >= min_bytes)
+        return 0;
+
+    //  Move unread data to the front of the buffer
+    if (self->rd_pos > 0) {
+        memmove (self->buffer, self->buffer + self->rd_pos, available);
+        self->rd_pos = 0;
+        self->rd_end = available;
     }
-    else {
-        byte buffer [8];
-        const uint64_t msg_size = (uint64_t) zmtp_msg_size (msg);
-        buffer [0] = msg_size >> 56;
-        buffer [1] = msg_size >> 48;
-        buffer [2] = msg_size >> 40;
-        buffer [3] = msg_size >> 32;
-        buffer [4] = msg_size >> 24;
-        buffer [5] = msg_size >> 16;
-        buffer [6] = msg_size >> 8;
-        buffer [7] = msg_size;
-        if (s_tcp_send (self->fd, buffer, sizeof buffer) == -1)
+    while (available < min_bytes) {
+        const ssize_t n = zmtp_engine_recv (self->engine, self->fd,
+            self->buffer + self->rd_end,
+            ZMTP_CHANNEL_BUFFER_SIZE - self->rd_end,
+            self->nonblocking? MSG_DONTWAIT: 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0)
+            errno = ECONNRESET; //  Peer closed; not to be taken for EAGAIN
+        if (n == -1 || n == 0)
             return -1;
+        self->rd_end += n;
+        available += n;
     }
-    if (s_tcp_send (self->fd, zmtp_msg_data (msg), zmtp_msg_size (msg)) == -1)
-        return -1;
+    //  The kernel drops out of quick-ack mode by itself
+    if (self->sockopts [ZMTP_SOCKOPT_QUICKACK] == 1)
+        s_apply_sockopt (self, ZMTP_SOCKOPT_QUICKACK);
     return 0;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Receive a ZMTP message off the channel
+//  Read whatever the socket has to offer into the read-ahead buffer,
+//  without blocking. Returns the number of bytes read, 0 if nothing was
+//  readable or the buffer is full, and -1 on error or end of stream.
 
-zmtp_msg_t *
-zmtp_channel_recv (zmtp_channel_t *self)
+static ssize_t
+s_fill_nowait (zmtp_channel_t *self)
 {
-    assert (self);
-
-    byte frame_flags;
-    size_t size;
-
-    if (s_tcp_recv (self->fd, &frame_flags, 1) == -1)
-        return NULL;
-    //  Check large flag
-    if ((frame_flags & ZMTP_LARGE_FLAG) == 0) {
-        byte buffer [1];
-        if (s_tcp_recv (self->fd, buffer, 1) == -1)
-            return NULL;
-        size = (size_t) buffer [0];
+    //  Move unread data to the front of the buffer
+    if (self->rd_pos > 0) {
+        memmove (self->buffer,
+            self->buffer + self->rd_pos, self->rd_end - self->rd_pos);
+        self->rd_end -= self->rd_pos;
+        self->rd_pos = 0;
     }
-    else {
-        byte buffer [8];
-        if (s_tcp_recv (self->fd, buffer, sizeof buffer) == -1)
-            return NULL;
-        size = (uint64_t) buffer [0] << 56 |
-               (uint64_t) buffer [1] << 48 |
-               (uint64_t) buffer [2] << 40 |
-               (uint64_t) buffer [3] << 32 |
-               (uint64_t) buffer [4] << 24 |
-               (uint64_t) buffer [5] << 16 |
-               (uint64_t) buffer [6] << 8  |
-               (uint64_t) buffer [7];
-    }
-    byte *data = zmalloc (size);
-    assert (data);
-    if (s_tcp_recv (self->fd, data, size) == -1) {
-        free (data);
-        return NULL;
+    if (self->rd_end == ZMTP_CHANNEL_BUFFER_SIZE)
+        return 0;
+    while (true) {
+        const ssize_t n = zmtp_engine_recv (self->engine, self->fd,
+            self->buffer + self->rd_end,
+            ZMTP_CHANNEL_BUFFER_SIZE - self->rd_end, MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n == -1 || n == 0)
+            return -1;
+        self->rd_end += n;
+        return n;
     }
-    byte msg_flags = 0;
-    if ((frame_flags & ZMTP_MORE_FLAG) == ZMTP_MORE_FLAG)
-        msg_flags |= ZMTP_MSG_MORE;
-    if ((frame_flags & ZMTP_COMMAND_FLAG) == ZMTP_COMMAND_FLAG)
-        msg_flags |= ZMTP_MSG_COMMAND;
-    return zmtp_msg_from_data (msg_flags, &data, size);
 }
 
 
@@ -398,8 +1796,8 @@ s_tcp_send (int fd, const void *data, size_t len)
 {
     size_t bytes_sent = 0;
     while (bytes_sent < len) {
-        const ssize_t rc = send (
-            fd, (char *) data + bytes_sent, len - bytes_sent, 0);
+        const ssize_t rc = send (fd,
+            (char *) data + bytes_sent, len - bytes_sent, MSG_NOSIGNAL);
         if (rc == -1 && errno == EINTR)
             continue;
         if (rc == -1)
@@ -409,6 +1807,42 @@ s_tcp_send (int fd, const void *data, size_t len)
     return 0;
 }
 
+//  Send all data described by the I/O vector, resuming after partial
+//  writes. Modifies the vector as it goes. The flags are passed on to
+//  the engine.
+
+static int
+s_tcp_sendv (zmtp_channel_t *self,
+             struct iovec *iov, int iovcnt, int flags)
+{
+    while (iovcnt > 0) {
+        struct msghdr msghdr = {
+            .msg_iov = iov,
+            .msg_iovlen = iovcnt
+        };
+        const ssize_t rc =
+            zmtp_engine_sendmsg (self->engine,
+                self->fd, &msghdr, flags | MSG_NOSIGNAL);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return -1;
+        self->sent += rc;
+        //  Skip over whatever was sent
+        size_t bytes_sent = (size_t) rc;
+        while (iovcnt > 0 && bytes_sent >= iov->iov_len) {
+            bytes_sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (byte *) iov->iov_base + bytes_sent;
+            iov->iov_len -= bytes_sent;
+        }
+    }
+    return 0;
+}
+
 static int
 s_tcp_recv (int fd, void *buffer, size_t len)
 {
@@ -425,8 +1859,6 @@ s_tcp_recv (int fd, void *buffer, size_t len)
     return 0;
 }
 
-#include <poll.h>
-
 //  Simple TCP echo server. It listens on a TCP port and after
 //  accepting a new connection, echoes all received data.
 //  This is to test the encodining/decoding compatibility.
@@ -498,7 +1930,7 @@ s_echo_serv (void *arg)
 struct script_line {
     char cmd;           // 'i' for input, 'o' for output, 'x' terminator
     size_t data_len;    //  length of data
-    const char *data;   //  data to send or expect
+    const char *data;   //  data to send or expect; NULL to expect any
 };
 
 struct test_server_t {
@@ -544,7 +1976,7 @@ s_test_server (void *arg)
             char buf [data_len];
             const int rc = s_tcp_recv (fd, buf, data_len);
             assert (rc == 0);
-            assert (memcmp (buf, data, data_len) == 0);
+            assert (data == NULL || memcmp (buf, data, data_len) == 0);
         }
         else {
             const int rc = s_tcp_send (fd, data, data_len);
@@ -557,6 +1989,94 @@ s_test_server (void *arg)
     return NULL;
 }
 
+//  Peer for non-blocking mode test. It waits for the go signal before it
+//  starts reading, so that the other side finds the socket full.
+
+struct nonblocking_peer_t {
+    int go_fd;          //  Readable when it is time to read
+    int count;          //  Number of messages to expect
+};
+
+static void *
+s_nonblocking_peer (void *arg)
+{
+    struct nonblocking_peer_t *params = (struct nonblocking_peer_t *) arg;
+
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    int rc = zmtp_channel_listen (channel, "ipc://@zmtp-channel-nb-test");
+    assert (rc == 0);
+
+    char go;
+    rc = read (params->go_fd, &go, 1);
+    assert (rc == 1);
+    for (int i = 0; i < params->count; i++) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 100000);
+        assert (zmtp_msg_data (msg) [99999] == (byte) 99999);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_msg_t *msg = zmtp_msg_new (0, 200000);
+    for (int i = 0; i < 200000; i++)
+        zmtp_msg_data (msg) [i] = (byte) i;
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  Echo peer for engine test; runs until the other side goes away
+
+static void *
+s_engine_peer (void *arg)
+{
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    int rc = zmtp_channel_listen (channel, "ipc://@zmtp-channel-engine-test");
+    assert (rc == 0);
+
+    zmtp_msg_t *msg;
+    while ((msg = zmtp_channel_recv (channel))) {
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  Peer for zero-copy test; checks the large frames it receives and
+//  answers when done
+
+static void *
+s_zerocopy_peer (void *arg)
+{
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    int rc = zmtp_channel_listen (channel, "tcp://127.0.0.1:22003");
+    assert (rc == 0);
+
+    for (int i = 0; i < 3; i++) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg);
+        const size_t size = i == 1? 5: 1000000;
+        assert (zmtp_msg_size (msg) == size);
+        for (size_t j = 0; j < size; j++)
+            assert (zmtp_msg_data (msg) [j] == (byte) (i + j));
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "done", 4);
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -596,6 +2116,165 @@ zmtp_channel_test (bool verbose)
         zmtp_msg_destroy (&msg);
         zmtp_msg_destroy (&msg2);
     }
+
+    //  Large frame uses the 8-byte size encoding
+    zmtp_msg_t *large = zmtp_msg_new (0, 1000);
+    assert (large);
+    memset (zmtp_msg_data (large), 'L', 1000);
+    rc = zmtp_channel_send (channel, large);
+    assert (rc == 0);
+    zmtp_msg_t *large2 = zmtp_channel_recv (channel);
+    assert (large2 != NULL);
+    assert (zmtp_msg_size (large2) == 1000);
+    assert (memcmp (zmtp_msg_data (large),
+        zmtp_msg_data (large2), 1000) == 0);
+    zmtp_msg_destroy (&large);
+    zmtp_msg_destroy (&large2);
+
+    //  Several frames arriving together are decoded out of the read-ahead
+    //  buffer, and a frame larger than the buffer bypasses it
+    for (int i = 0; i < 5; i++) {
+        zmtp_msg_t *msg = zmtp_msg_from_const_data (
+            0, test_strings [i], strlen (test_strings [i]));
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    large = zmtp_msg_new (0, 20000);
+    for (int i = 0; i < 20000; i++)
+        zmtp_msg_data (large) [i] = (byte) i;
+    rc = zmtp_channel_send (channel, large);
+    assert (rc == 0);
+    for (int i = 0; i < 5; i++) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg != NULL);
+        assert (zmtp_msg_size (msg) == strlen (test_strings [i]));
+        assert (memcmp (zmtp_msg_data (msg),
+            test_strings [i], zmtp_msg_size (msg)) == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    large2 = zmtp_channel_recv (channel);
+    assert (large2 != NULL);
+    assert (zmtp_msg_size (large2) == 20000);
+    assert (memcmp (zmtp_msg_data (large),
+        zmtp_msg_data (large2), 20000) == 0);
+    zmtp_msg_destroy (&large);
+    zmtp_msg_destroy (&large2);
+
+    //  Batch send of more frames than fit in one system call
+    zmtp_msg_t *outgoing [600];
+    for (int i = 0; i < 600; i++)
+        outgoing [i] = zmtp_msg_from_const_data (
+            i < 599? ZMTP_MSG_MORE: 0, test_strings [i % 5],
+            strlen (test_strings [i % 5]));
+    rc = zmtp_channel_send_batch (channel, outgoing, 600);
+    assert (rc == 0);
+    for (int i = 0; i < 600; i++) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg != NULL);
+        assert (zmtp_msg_flags (msg) == zmtp_msg_flags (outgoing [i]));
+        assert (zmtp_msg_size (msg) == zmtp_msg_size (outgoing [i]));
+        assert (memcmp (zmtp_msg_data (msg), zmtp_msg_data (outgoing [i]),
+            zmtp_msg_size (msg)) == 0);
+        zmtp_msg_destroy (&msg);
+        zmtp_msg_destroy (&outgoing [i]);
+    }
+
+    //  Batch receive returns whatever has arrived, blocking only for
+    //  the first message
+    for (int i = 0; i < 5; i++) {
+        zmtp_msg_t *msg = zmtp_msg_from_const_data (
+            0, test_strings [i], strlen (test_strings [i]));
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    int received = 0;
+    while (received < 5) {
+        zmtp_msg_t *batch [8];
+        const ssize_t n = zmtp_channel_recv_batch (channel, batch, 8);
+        assert (n > 0 && received + n <= 5);
+        for (int i = 0; i < n; i++) {
+            const char *expected = test_strings [received + i];
+            assert (zmtp_msg_size (batch [i]) == strlen (expected));
+            assert (memcmp (zmtp_msg_data (batch [i]),
+                expected, zmtp_msg_size (batch [i])) == 0);
+            zmtp_msg_destroy (&batch [i]);
+        }
+        received += n;
+    }
+
+    //  Streamed frames are pulled in chunks of the caller's choosing
+    large = zmtp_msg_new (ZMTP_MSG_MORE, 100000);
+    for (int i = 0; i < 100000; i++)
+        zmtp_msg_data (large) [i] = (byte) (i % 251);
+    rc = zmtp_channel_send (channel, large);
+    assert (rc == 0);
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "after", 5);
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    byte flags;
+    size_t size;
+    rc = zmtp_channel_recv_header (channel, &flags, &size);
+    assert (rc == 0);
+    assert (flags == ZMTP_MSG_MORE && size == 100000);
+    assert (zmtp_channel_recv (channel) == NULL && errno == EBUSY);
+    byte chunk [7000];
+    size_t offset = 0;
+    while (offset < 60000) {
+        const ssize_t n = zmtp_channel_recv_body (channel, chunk, sizeof chunk);
+        assert (n > 0 && n <= (ssize_t) sizeof chunk);
+        assert (memcmp (chunk, zmtp_msg_data (large) + offset, n) == 0);
+        offset += n;
+    }
+    //  The rest we skip
+    while (zmtp_channel_recv_body (channel, NULL, SIZE_MAX) > 0)
+        ;
+    msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    assert (memcmp (zmtp_msg_data (msg), "after", 5) == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_msg_destroy (&large);
+
+    //  Frames over the size limit are skipped with the rest of their
+    //  message, without being stored
+    zmtp_channel_set_maxmsgsize (channel, 1000);
+    const size_t part_sizes [] = { 500, 2000, 10, 2 };
+    for (int i = 0; i < 4; i++) {
+        msg = zmtp_msg_new (i < 2? ZMTP_MSG_MORE: 0, part_sizes [i]);
+        memset (zmtp_msg_data (msg), 'P', part_sizes [i]);
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    msg = zmtp_channel_recv (channel);
+    assert (msg && zmtp_msg_size (msg) == 500);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_channel_recv (channel);
+    assert (msg == NULL && errno == EMSGSIZE);
+    msg = zmtp_channel_recv (channel);
+    assert (msg && zmtp_msg_size (msg) == 2);
+    zmtp_msg_destroy (&msg);
+
+    //  So are frames over the memory budget
+    zmtp_channel_set_maxmsgsize (channel, 0);
+    zmtp_channel_set_budget (channel, 40000);
+    for (int i = 0; i < 2; i++) {
+        msg = zmtp_msg_new (0, i == 0? 50000: 30000);
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    msg = zmtp_channel_recv (channel);
+    assert (msg == NULL && errno == EMSGSIZE);
+    msg = zmtp_channel_recv (channel);
+    assert (msg && zmtp_msg_size (msg) == 30000);
+    zmtp_msg_destroy (&msg);
+    zmtp_channel_set_budget (channel, 0);
+
     zmtp_channel_destroy (&channel);
     pthread_join (thread, NULL);
 
@@ -664,6 +2343,169 @@ zmtp_channel_test (bool verbose)
     zmtp_channel_destroy (&channel);
     pthread_join (thread, NULL);
 
+    //  Peer that does not speak ZMTP is rejected
+    struct script_line bad_script [] = {
+        { 'o', 10, "GET / HTTP" },
+        { 'i', 64 + 8, NULL },
+        { 'x' },
+    };
+    struct test_server_t bad_params = {
+        .port = 22002,
+        .script = bad_script,
+    };
+    pthread_create (&thread, NULL, s_test_server, &bad_params);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    do {
+        errno = 0;
+        rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22002);
+        assert (rc == -1);
+    } while (errno == ECONNREFUSED && usleep (10000) == 0);
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+
+    //  Test non-blocking mode; frames are written and read in pieces as
+    //  the socket allows
+    int go_pipe [2];
+    rc = pipe (go_pipe);
+    assert (rc == 0);
+    struct nonblocking_peer_t nonblocking_params = { .go_fd = go_pipe [0] };
+    pthread_create (&thread, NULL, s_nonblocking_peer, &nonblocking_params);
+
+    channel = zmtp_channel_new ();
+    assert (channel);
+    while (zmtp_channel_connect (channel, "ipc://@zmtp-channel-nb-test") == -1)
+        usleep (10000);
+    rc = zmtp_channel_set_nonblocking (channel, true);
+    assert (rc == 0);
+
+    msg = zmtp_channel_recv (channel);
+    assert (msg == NULL && errno == EAGAIN);
+
+    //  Send until the socket is full
+    msg = zmtp_msg_new (0, 100000);
+    for (int i = 0; i < 100000; i++)
+        zmtp_msg_data (msg) [i] = (byte) i;
+    int sent = 0;
+    while (zmtp_channel_send (channel, msg) == 0)
+        sent++;
+    assert (errno == EAGAIN);
+    assert (sent > 0);
+    assert (zmtp_channel_has_output (channel));
+    //  The channel holds on to the message until it is written
+    zmtp_msg_destroy (&msg);
+
+    nonblocking_params.count = sent;
+    rc = write (go_pipe [1], "G", 1);
+    assert (rc == 1);
+
+    while (msg == NULL) {
+        struct pollfd pollfd = {
+            .fd = zmtp_channel_fd (channel),
+            .events = zmtp_channel_has_output (channel)? POLLOUT: POLLIN
+        };
+        rc = poll (&pollfd, 1, -1);
+        assert (rc == 1);
+        if (zmtp_channel_has_output (channel)) {
+            rc = zmtp_channel_flush (channel);
+            assert (rc == 0 || errno == EAGAIN);
+        }
+        else {
+            msg = zmtp_channel_recv (channel);
+            assert (msg || errno == EAGAIN);
+        }
+    }
+    assert (zmtp_msg_size (msg) == 200000);
+    for (int i = 0; i < 200000; i++)
+        assert (zmtp_msg_data (msg) [i] == (byte) i);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+    close (go_pipe [0]);
+    close (go_pipe [1]);
+
+    //  Test io_uring engine, where the system offers it; the handle of
+    //  the channel signals input
+    pthread_create (&thread, NULL, s_engine_peer, NULL);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    while (zmtp_channel_connect (
+            channel, "ipc://@zmtp-channel-engine-test") == -1)
+        usleep (10000);
+    rc = zmtp_channel_set_engine (channel, ZMTP_ENGINE_URING);
+    if (verbose && rc == -1)
+        printf ("(no io_uring) ");
+
+    for (int i = 0; i < 5; i++) {
+        msg = zmtp_msg_from_const_data (
+            0, test_strings [i], strlen (test_strings [i]));
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    msg = zmtp_msg_new (0, 100000);
+    for (int i = 0; i < 100000; i++)
+        zmtp_msg_data (msg) [i] = (byte) i;
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    for (int i = 0; i < 6; i++) {
+        if (!zmtp_channel_has_input (channel)) {
+            struct pollfd pollfd = {
+                .fd = zmtp_channel_fd (channel), .events = POLLIN
+            };
+            rc = poll (&pollfd, 1, -1);
+            assert (rc == 1);
+        }
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        if (i < 5) {
+            assert (zmtp_msg_size (msg) == strlen (test_strings [i]));
+            assert (memcmp (zmtp_msg_data (msg),
+                test_strings [i], zmtp_msg_size (msg)) == 0);
+        }
+        else {
+            assert (zmtp_msg_size (msg) == 100000);
+            for (int j = 0; j < 100000; j++)
+                assert (zmtp_msg_data (msg) [j] == (byte) j);
+        }
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+
+    //  Test zero-copy sends; messages may be destroyed right after sending
+    pthread_create (&thread, NULL, s_zerocopy_peer, NULL);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    while (zmtp_channel_connect (channel, "tcp://127.0.0.1:22003") == -1)
+        usleep (10000);
+    if (zmtp_channel_set_zerocopy (channel, 16384) == -1)
+        assert (errno == ENOTSUP || errno == ENOPROTOOPT);
+
+    zmtp_msg_t *zerocopy [3];
+    for (int i = 0; i < 3; i++) {
+        const size_t size = i == 1? 5: 1000000;
+        zerocopy [i] = zmtp_msg_new (i < 2? ZMTP_MSG_MORE: 0, size);
+        for (size_t j = 0; j < size; j++)
+            zmtp_msg_data (zerocopy [i]) [j] = (byte) (i + j);
+    }
+    rc = zmtp_channel_send (channel, zerocopy [0]);
+    assert (rc == 0);
+    rc = zmtp_channel_send_batch (channel, zerocopy + 1, 2);
+    assert (rc == 0);
+    for (int i = 0; i < 3; i++)
+        zmtp_msg_destroy (&zerocopy [i]);
+
+    msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 4);
+    zmtp_msg_destroy (&msg);
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+
     //  @end
     printf ("OK\n");
 }
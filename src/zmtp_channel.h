@@ -24,6 +24,9 @@ enum {
     ZMTP_COMMAND_FLAG = 4,
 };
 
+//  Number of ZMTP_SOCKOPT_* options
+#define ZMTP_SOCKOPT_COUNT 6
+
 //  Opaque class structure
 typedef struct _zmtp_channel_t zmtp_channel_t;
 
@@ -36,6 +39,12 @@ zmtp_channel_t *
 void
     zmtp_channel_destroy (zmtp_channel_t **self_p);
 
+//  Set how long connect calls wait for the peer, in msecs; -1, the
+//  default, waits for ever. A connect that times out fails with errno set
+//  to ETIMEDOUT.
+void
+    zmtp_channel_set_connect_timeout (zmtp_channel_t *self, int timeout);
+
 //  Connect channel using local transport
 int
     zmtp_channel_ipc_connect (zmtp_channel_t *self, const char *path);
@@ -53,14 +62,176 @@ int
 int
     zmtp_channel_listen (zmtp_channel_t *test, const char *endpoint_str);
 
+//  Negotiate a ZMTP channel over a connected socket, e.g. one accepted by
+//  a listener. The channel takes ownership of the socket, and closes it
+//  if negotiation fails. Returns 0 if OK, -1 on error.
+int
+    zmtp_channel_attach (zmtp_channel_t *self, int fd);
+
+//  Start negotiating a ZMTP channel over a connected socket without
+//  waiting for the peer: switches the socket to non-blocking mode and
+//  sends our greeting. Call zmtp_channel_handshake each time the socket
+//  is readable to finish. The channel takes ownership of the socket, and
+//  closes it on failure. Returns 0 if OK, -1 on error.
+int
+    zmtp_channel_attach_nowait (zmtp_channel_t *self, int fd);
+
+//  Continue a handshake started with zmtp_channel_attach_nowait, taking
+//  what the peer has sent so far. Returns 0 once the channel is ready, and
+//  -1 with errno set to EAGAIN while the peer has more to send, or to any
+//  other value if the handshake failed. The channel is then left in
+//  non-blocking mode.
+int
+    zmtp_channel_handshake (zmtp_channel_t *self);
+
+//  Shut the connection down both ways, so that calls blocked on it in
+//  other threads fail at once. The channel is still to be destroyed.
+void
+    zmtp_channel_shutdown (zmtp_channel_t *self);
+
 //  Send a ZMTP message to the channel
 int
     zmtp_channel_send (zmtp_channel_t *self, zmtp_msg_t *msg);
 
+//  Send an array of ZMTP messages to the channel, encoding all frame
+//  headers up front and flushing with as few system calls as IOV_MAX
+//  allows.
+int
+    zmtp_channel_send_batch (zmtp_channel_t *self,
+                             zmtp_msg_t **msgs, size_t count);
+
+//  Send frame bodies of threshold bytes or more with MSG_ZEROCOPY, so the
+//  kernel reads them straight from the message instead of copying them
+//  into the socket buffer. The channel keeps a reference to each such
+//  message until the kernel is done with it; constant data must stay
+//  valid until then, or until the channel is destroyed. Destroying the
+//  channel does not wait for the kernel: if data of such bodies is still
+//  unsent, it resets the connection rather than let that data go out
+//  after the memory is reused. Pays off for bodies upwards of 10 KB or
+//  so. Applies to blocking sends only. Zero-copy turns itself off when
+//  the kernel keeps copying anyway, as over loopback. A threshold of 0
+//  turns zero-copy off. The channel must be a connected TCP channel.
+//  Returns 0 if OK, -1 on error.
+int
+    zmtp_channel_set_zerocopy (zmtp_channel_t *self, size_t threshold);
+
+//  Set the largest frame the channel accepts, in bytes; 0, the default,
+//  sets no limit. Larger frames are skipped without being stored, along
+//  with the rest of their message, and the receive call fails with
+//  EMSGSIZE; frames of the message received before are the caller's to
+//  drop. Streamed frames are not checked.
+void
+    zmtp_channel_set_maxmsgsize (zmtp_channel_t *self, size_t size);
+
+//  Set the most bytes of message data the channel may hold at a time;
+//  0, the default, sets no limit. This covers the frame being received,
+//  frames queued by non-blocking sends, and bodies lent to the kernel for
+//  zero-copy sends. Frames that do not fit are rejected as if over the
+//  maximum message size, non-blocking sends fail with ENOBUFS, and
+//  zero-copy sends fall back to copying.
+void
+    zmtp_channel_set_budget (zmtp_channel_t *self, size_t budget);
+
+//  Set a socket option (ZMTP_SOCKOPT_*) on the channel's socket, now if
+//  connected and on connecting otherwise. Options that do not apply to
+//  the transport, or that the system refuses, are ignored. Returns 0 if
+//  OK, -1 if the option or value is invalid.
+int
+    zmtp_channel_set_sockopt (zmtp_channel_t *self, int option, int value);
+
+//  Store the socket options of a profile (ZMTP_PROFILE_*) into an array
+//  of ZMTP_SOCKOPT_COUNT values; options the profile leaves alone are -1.
+//  Returns 0 if OK, -1 if the profile is unknown.
+int
+    zmtp_channel_profile_sockopts (int profile, int *sockopts);
+
+//  Switch channel to or from non-blocking mode. In non-blocking mode, send
+//  and receive calls fail with EAGAIN instead of waiting for the socket,
+//  and partly written or read frames are completed by later calls. Sent
+//  messages are referenced until written; constant data must stay valid
+//  until then. The channel must be connected. Returns 0 if OK, -1 on error.
+int
+    zmtp_channel_set_nonblocking (zmtp_channel_t *self, bool nonblocking);
+
+//  Write frames left over by non-blocking sends. Returns 0 when all output
+//  is written, -1 with errno set to EAGAIN when some is still pending, or
+//  -1 on any other error. In blocking mode, waits until all is written.
+int
+    zmtp_channel_flush (zmtp_channel_t *self);
+
+//  Return the number of bytes written to the socket so far, frame headers
+//  included. After a failed send, the difference tells how much of it went
+//  out.
+size_t
+    zmtp_channel_sent (zmtp_channel_t *self);
+
+//  Return true if frames left over by non-blocking sends are waiting to
+//  be written
+bool
+    zmtp_channel_has_output (zmtp_channel_t *self);
+
 //  Receive a ZMTP message off the channel
 zmtp_msg_t *
     zmtp_channel_recv (zmtp_channel_t *self);
 
+//  Receive the header of the next frame, leaving its body to be pulled
+//  with zmtp_channel_recv_body, so that frames of any size go through
+//  bounded memory. Stores the message flags and body size. Returns 0 if
+//  OK, -1 on error; fails with EBUSY while a body is still pending.
+int
+    zmtp_channel_recv_header (zmtp_channel_t *self,
+                              byte *flags, size_t *size);
+
+//  Receive up to max bytes of the body announced by the last header into
+//  buffer, or skip them if buffer is NULL. Blocks only if nothing of the
+//  body is available. Returns the number of bytes received, 0 once the
+//  whole body is received, or -1 on error.
+ssize_t
+    zmtp_channel_recv_body (zmtp_channel_t *self, void *buffer, size_t max);
+
+//  Receive up to max messages off the channel into the out array. Blocks
+//  only if no complete message is available; otherwise returns every
+//  message that is already buffered or readable without blocking.
+//  Returns the number of messages received, or -1 on error.
+ssize_t
+    zmtp_channel_recv_batch (zmtp_channel_t *self,
+                             zmtp_msg_t **out, size_t max);
+
+//  Return true if a complete message is buffered, so that it can be
+//  received without blocking, or the engine holds received data. Either
+//  way, its handle does not signal such input.
+bool
+    zmtp_channel_has_input (zmtp_channel_t *self);
+
+//  Set the engine that does the socket I/O of the channel: plain system
+//  calls (ZMTP_ENGINE_SYSCALL, the default) or io_uring (ZMTP_ENGINE_URING),
+//  which receives into kernel-registered buffers ahead of time. Once set,
+//  the io_uring engine stays; zmtp_channel_fd then returns its handle. Each
+//  channel gets a ring of its own, so the engine batches the submissions
+//  of that channel only; it saves no system calls across channels, and
+//  costs a descriptor per channel. The channel must be connected. Returns
+//  0 if OK, -1 on error.
+int
+    zmtp_channel_set_engine (zmtp_channel_t *self, int engine);
+
+//  Return the handle to poll for input on the channel, or -1 if not
+//  connected. This is the socket, unless an engine other than plain system
+//  calls receives for it.
+int
+    zmtp_channel_fd (zmtp_channel_t *self);
+
+//  Encode ZMTP frame header for the message into buffer, which must be at
+//  least 9 bytes long. Returns the length of the encoded header.
+size_t
+    zmtp_channel_encode_header (byte *buffer, zmtp_msg_t *msg);
+
+//  Decode ZMTP frame header, which must be complete: 2 bytes, or 9 if the
+//  large flag is set. Stores message flags and body size, and returns the
+//  length of the header.
+size_t
+    zmtp_channel_decode_header (const byte *header,
+                                byte *msg_flags, size_t *size);
+
 //  Self test of this class
 void
     zmtp_channel_test (bool verbose);
@@ -19,8 +19,16 @@
 
 //  Internal API
 #include "zmtp_channel.h"
+#include "zmtp_listener.h"
 #include "zmtp_endpoint.h"
 #include "zmtp_ipc_endpoint.h"
 #include "zmtp_tcp_endpoint.h"
+#include "zmtp_engine.h"
+#include "zmtp_sys_engine.h"
+#include "zmtp_uring_engine.h"
+#include "zmtp_mtrie.h"
+#include "zmtp_prefixes.h"
+#include "zmtp_hashmap.h"
+#include "zmtp_peers.h"
 
 #endif
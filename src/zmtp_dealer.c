@@ -10,14 +10,108 @@
     =========================================================================
 */
 
+//  A dealer talks to any number of peers, whether it connected to them or
+//  they connected to it. Each message goes to the next peer in turn, and
+//  incoming messages are taken from peers in turn, one message each.
+//  With reconnecting on, each endpoint we connect to is a link that we
+//  keep connected, backing off on its own.
+
 #include "zmtp_classes.h"
 
+//  Default limit for messages queued while disconnected
+
+#define ZMTP_DEALER_QUEUE_LIMIT 1000
+
+//  Endpoint we keep connected
+
+typedef struct {
+    char *endpoint;             //  Endpoint to reconnect to
+    zmtp_channel_t *channel;    //  Connection, or NULL while down
+    int reconnect_wait;         //  Current reconnect interval
+    int64_t reconnect_at;       //  Clock time of next reconnect attempt
+} dealer_link_t;
+
 //  Structure of our class
 
 struct _zmtp_dealer_t {
-    zmtp_channel_t *channel;    //  At most one channel per socket now
+    zmtp_peers_t *peers;        //  Connections, made or accepted
+    size_t next;                //  Index of next peer to send to
+    zmtp_msg_t **frames;        //  Frames of message not complete yet
+    size_t nframes;             //  Number of frames
+    size_t max_frames;          //  Allocated size of frames array
+    zmtp_channel_t *channel;    //  Peer the sender thread sends to
+    dealer_link_t *links;       //  Endpoints we reconnect to
+    size_t nlinks;              //  Number of links
+    size_t links_down;          //  Number of links without a connection
+    int connect_timeout;        //  Msecs to wait for connect, -1 for ever
+    int reconnect_ivl;          //  First reconnect interval, 0 if off
+    int reconnect_ivl_max;      //  Reconnect interval backs off to this
+    unsigned int seed;          //  For reconnect jitter
+    zmtp_msg_t **queue;         //  Messages sent while disconnected
+    size_t queue_size;          //  Number of messages in queue
+    size_t queue_max;           //  Allocated size of queue
+    size_t queue_limit;         //  Most messages we queue
+    size_t queue_bytes;         //  Bytes of message data in queue
+    size_t maxmsgsize;          //  Largest frame accepted; 0 if no limit
+    size_t budget;              //  Most bytes held in messages; 0 if none
+    size_t zerocopy;            //  Zero-copy threshold for new channels
+    int engine;                 //  I/O engine for new channels
+    int sockopts [ZMTP_SOCKOPT_COUNT];  //  Socket options, -1 if unset
+
+    //  With a send queue, a sender thread drains the queue into one peer
+    //  at a time. The mutex guards that peer and the queue; peers come
+    //  and go only in the calling thread.
+    bool sender_on;             //  Sender thread is running
+    pthread_t sender;           //  Sender thread
+    pthread_mutex_t mutex;      //  Guards state shared with sender
+    pthread_cond_t cond;        //  Signals changes to shared state
+    size_t hwm;                 //  Most messages queued; 0 if no limit
+    size_t hwm_bytes;           //  Most bytes queued; 0 if no limit
+    bool hwm_block;             //  At high-water mark, block, not EAGAIN
+    zmtp_channel_t *sending;    //  Peer the sender is using, if any
+    zmtp_channel_t *broken;     //  Peer the sender lost, if any
+    bool stopping;              //  Sender must finish up
 };
 
+static zmtp_channel_t *
+    s_channel_new (zmtp_dealer_t *self);
+static bool
+    s_can_send (zmtp_dealer_t *self);
+static zmtp_channel_t *
+    s_connect (zmtp_dealer_t *self, const char *endpoint_str, int timeout);
+static void
+    s_connected (zmtp_channel_t *channel, void *arg);
+static void
+    s_disconnected (zmtp_channel_t *channel, void *arg);
+static zmtp_channel_t *
+    s_only (zmtp_dealer_t *self);
+static int
+    s_reconnect (zmtp_dealer_t *self, bool wait);
+static void
+    s_relink (zmtp_dealer_t *self, dealer_link_t *link);
+static int
+    s_send (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count);
+static void
+    s_hold (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count);
+static int
+    s_enqueue (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count);
+static int
+    s_send_queued (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count);
+static void
+    s_push (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count);
+static void
+    s_reserve (zmtp_dealer_t *self, size_t size);
+static size_t
+    s_bytes (zmtp_msg_t **msgs, size_t count);
+static void *
+    s_sender (void *arg);
+static size_t
+    s_whole (zmtp_msg_t **msgs, size_t count, size_t bytes);
+static bool
+    s_lost (void);
+static int64_t
+    s_clock (void);
+
 
 //  --------------------------------------------------------------------------
 //  Constructor
@@ -28,7 +122,23 @@ zmtp_dealer_new ()
     zmtp_dealer_t *self = (zmtp_dealer_t *) zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
 
-    self->channel = NULL;
+    self->peers = zmtp_peers_new (false);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    zmtp_peers_set_connect_fn (self->peers, s_connected, self);
+    zmtp_peers_set_disconnect_fn (self->peers, s_disconnected, self);
+    self->connect_timeout = -1;
+    self->queue_limit = ZMTP_DEALER_QUEUE_LIMIT;
+    self->engine = ZMTP_ENGINE_SYSCALL;
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        self->sockopts [option] = -1;
+    self->seed = (unsigned int) time (NULL) ^ (unsigned int) (uintptr_t) self;
+    int rc = pthread_mutex_init (&self->mutex, NULL);
+    assert (rc == 0);
+    rc = pthread_cond_init (&self->cond, NULL);
+    assert (rc == 0);
     return self;
 }
 
@@ -43,13 +153,72 @@ zmtp_dealer_destroy (zmtp_dealer_t **self_p)
 
     if (*self_p) {
         zmtp_dealer_t *self = *self_p;
-        zmtp_channel_destroy (&self->channel);
+        //  The sender sends what it can before it goes
+        if (self->sender_on) {
+            pthread_mutex_lock (&self->mutex);
+            self->stopping = true;
+            pthread_cond_broadcast (&self->cond);
+            pthread_mutex_unlock (&self->mutex);
+            pthread_join (self->sender, NULL);
+        }
+        zmtp_peers_set_disconnect_fn (self->peers, NULL, NULL);
+        zmtp_peers_destroy (&self->peers);
+        for (size_t index = 0; index < self->nlinks; index++)
+            free (self->links [index].endpoint);
+        free (self->links);
+        for (size_t index = 0; index < self->nframes; index++)
+            zmtp_msg_destroy (&self->frames [index]);
+        free (self->frames);
+        for (size_t index = 0; index < self->queue_size; index++)
+            zmtp_msg_destroy (&self->queue [index]);
+        free (self->queue);
+        pthread_cond_destroy (&self->cond);
+        pthread_mutex_destroy (&self->mutex);
         free (self);
         *self_p = NULL;
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Set how long connect calls wait for the peer, in msecs; -1, the
+//  default, waits for ever, or while reconnecting, as long as the current
+//  reconnect interval
+
+void
+zmtp_dealer_set_connect_timeout (zmtp_dealer_t *self, int timeout)
+{
+    assert (self);
+    self->connect_timeout = timeout;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Reconnect after failing to connect or losing the connection, waiting
+//  ivl msecs at first and backing off to ivl_max, with random jitter. An
+//  ivl of 0, the default, turns reconnecting off.
+
+void
+zmtp_dealer_set_reconnect (zmtp_dealer_t *self, int ivl, int ivl_max)
+{
+    assert (self);
+    assert (ivl >= 0);
+    self->reconnect_ivl = ivl;
+    self->reconnect_ivl_max = ivl_max > ivl? ivl_max: ivl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set how many messages are queued while reconnecting
+
+void
+zmtp_dealer_set_queue_limit (zmtp_dealer_t *self, size_t limit)
+{
+    assert (self);
+    self->queue_limit = limit;
+}
+
+
 //  --------------------------------------------------------------------------
 //
 
@@ -57,20 +226,9 @@ int
 zmtp_dealer_ipc_connect (zmtp_dealer_t *self, const char *path)
 {
     assert (self);
-    if (self->channel)  //  At most one channel per socket now
-        return -1;
-
-    //  Create new channel if possible
-    self->channel = zmtp_channel_new ();
-    if (!self->channel)
-        return -1;   
-
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_ipc_connect (self->channel, path) == -1) {
-        zmtp_channel_destroy (&self->channel);
-        return -1;
-    }
-    return 0;
+    char endpoint_str [strlen ("ipc://") + strlen (path) + 1];
+    snprintf (endpoint_str, sizeof endpoint_str, "ipc://%s", path);
+    return zmtp_dealer_connect (self, endpoint_str);
 }
 
 
@@ -82,105 +240,1203 @@ zmtp_dealer_tcp_connect (zmtp_dealer_t *self,
                          const char *addr, unsigned short port)
 {
     assert (self);
-    if (self->channel)  //  At most one channel per socket now
-        return -1;
-    
-    //  Create new channel if possible
-    self->channel = zmtp_channel_new ();
-    if (!self->channel)
-        return -1;
-    
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_tcp_connect (self->channel, addr, port) == -1) {
-        zmtp_channel_destroy (&self->channel);
-        return -1;
-    }
-    return 0;
+    char endpoint_str [strlen ("tcp://:65535") + strlen (addr) + 1];
+    snprintf (endpoint_str, sizeof endpoint_str, "tcp://%s:%u", addr, port);
+    return zmtp_dealer_connect (self, endpoint_str);
 }
 
 
 //  --------------------------------------------------------------------------
-//
+//  Connect socket to endpoint, adding a peer. With reconnecting on, this
+//  succeeds even if the peer is not up yet, and the socket keeps trying.
 
 int
 zmtp_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str)
 {
     assert (self);
-    if (self->channel)
-        return -1;
+    if (self->reconnect_ivl == 0)
+        return s_connect (
+            self, endpoint_str, self->connect_timeout)? 0: -1;
 
-    //  Create new channel if possible
-    self->channel = zmtp_channel_new ();
-    if (!self->channel)
+    self->links = (dealer_link_t *) realloc (
+        self->links, (self->nlinks + 1) * sizeof *self->links);
+    assert (self->links);       //  For now, memory exhaustion is fatal
+    dealer_link_t *link = &self->links [self->nlinks++];
+    link->endpoint = strdup (endpoint_str);
+    assert (link->endpoint);
+    link->channel = NULL;
+    link->reconnect_wait = self->reconnect_ivl;
+    link->reconnect_at = s_clock ();
+    self->links_down++;
+    s_reconnect (self, false);
+    return 0;
+}
+
+//  --------------------------------------------------------------------------
+//  Accept peers on endpoint; they are taken in as the socket sends and
+//  receives. Returns 0 if OK, -1 on error.
+
+int
+zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+//  --------------------------------------------------------------------------
+//  Send a message frame on a socket. Frames with ZMTP_MSG_MORE are held
+//  until the last frame of their message, which then goes whole to the
+//  next peer in turn. While reconnecting, the message is queued and sent
+//  on the new connection.
+
+int
+zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg)
+{
+    return zmtp_dealer_send_batch (self, &msg, 1);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send an array of messages on a socket, coalescing them into as few
+//  system calls as possible. The batch goes to the next peer in turn;
+//  a peer that fails is closed, and the next one gets the batch. Frames
+//  of an unfinished message at the end of the batch are held until the
+//  rest of it comes.
+
+int
+zmtp_dealer_send_batch (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    assert (self);
+    assert (msgs || count == 0);
+    if (count == 0)
+        return 0;
+
+    //  Switching peers in the middle of a message would break it up
+    const bool complete =
+        (zmtp_msg_flags (msgs [count - 1]) & ZMTP_MSG_MORE) == 0;
+    if (self->nframes == 0 && complete)
+        return s_send (self, msgs, count);
+
+    s_hold (self, msgs, count);
+    if (!complete)
+        return 0;
+    const int rc = s_send (self, self->frames, self->nframes);
+    for (size_t index = 0; index < self->nframes; index++)
+        zmtp_msg_destroy (&self->frames [index]);
+    self->nframes = 0;
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send message bodies of threshold bytes or more without copying them
+//  into the kernel. Returns 0 if OK, -1 if not supported.
+
+int
+zmtp_dealer_set_zerocopy (zmtp_dealer_t *self, size_t threshold)
+{
+    assert (self);
+    if (self->sender_on
+    || (zmtp_peers_size (self->peers) == 0
+    &&  !zmtp_peers_listening (self->peers)))
         return -1;
 
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_connect (self->channel, endpoint_str) == -1) {
-        zmtp_channel_destroy (&self->channel);
+    for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+        if (zmtp_channel_set_zerocopy (
+                zmtp_peers_get (self->peers, index), threshold) == -1)
+            return -1;
+    self->zerocopy = threshold;     //  Applies to new peers too
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue sent messages for a background thread to send, so that send
+//  calls return at once. The queue holds up to hwm messages and
+//  hwm_bytes bytes of message data; 0 sets no limit. Past that, sends
+//  block with ZMTP_HWM_BLOCK or fail with EAGAIN with ZMTP_HWM_EAGAIN.
+//  Returns 0 if OK, -1 if not possible.
+
+int
+zmtp_dealer_set_send_queue (zmtp_dealer_t *self,
+                            size_t hwm, size_t hwm_bytes, int policy)
+{
+    assert (self);
+    if (policy != ZMTP_HWM_BLOCK && policy != ZMTP_HWM_EAGAIN) {
+        errno = EINVAL;
+        return -1;
+    }
+    //  Zero-copy and io_uring I/O are not safe for two threads
+    if (self->zerocopy || self->engine != ZMTP_ENGINE_SYSCALL) {
+        errno = ENOTSUP;
         return -1;
     }
+    pthread_mutex_lock (&self->mutex);
+    self->hwm = hwm;
+    self->hwm_bytes = hwm_bytes;
+    self->hwm_block = policy == ZMTP_HWM_BLOCK;
+    pthread_cond_broadcast (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+
+    if (!self->sender_on) {
+        if (pthread_create (&self->sender, NULL, s_sender, self) != 0)
+            return -1;
+        self->sender_on = true;
+    }
     return 0;
 }
 
+
+
 //  --------------------------------------------------------------------------
-//
+//  Set the largest frame the socket accepts, in bytes; 0, the default,
+//  sets no limit
+
+void
+zmtp_dealer_set_maxmsgsize (zmtp_dealer_t *self, size_t size)
+{
+    assert (self);
+    self->maxmsgsize = size;
+    for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+        zmtp_channel_set_maxmsgsize (zmtp_peers_get (self->peers, index), size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the most bytes of message data the socket may hold at a time; 0,
+//  the default, sets no limit
+
+void
+zmtp_dealer_set_budget (zmtp_dealer_t *self, size_t budget)
+{
+    assert (self);
+    self->budget = budget;
+    for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+        zmtp_channel_set_budget (zmtp_peers_get (self->peers, index), budget);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set a socket option; see ZMTP_SOCKOPT_*. Options stay set across
+//  reconnects. Returns 0 if OK, -1 if the option or value is invalid.
 
 int
-zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str)
+zmtp_dealer_set_sockopt (zmtp_dealer_t *self, int option, int value)
 {
     assert (self);
-    if (self->channel)
+    if (option < 0 || option >= ZMTP_SOCKOPT_COUNT || value < 0) {
+        errno = EINVAL;
         return -1;
+    }
+    self->sockopts [option] = value;
+    for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+        zmtp_channel_set_sockopt (
+            zmtp_peers_get (self->peers, index), option, value);
+    return 0;
+}
 
-    //  Create new channel if possible
-    self->channel = zmtp_channel_new ();
-    if (!self->channel)
-        return -1;
 
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_listen (self->channel, endpoint_str) == -1) {
-        zmtp_channel_destroy (&self->channel);
+//  --------------------------------------------------------------------------
+//  Set all socket options from a profile; see ZMTP_PROFILE_*. Returns 0
+//  if OK, -1 if the profile is unknown.
+
+int
+zmtp_dealer_set_profile (zmtp_dealer_t *self, int profile)
+{
+    assert (self);
+    int sockopts [ZMTP_SOCKOPT_COUNT];
+    if (zmtp_channel_profile_sockopts (profile, sockopts) == -1)
         return -1;
-    }
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        if (sockopts [option] != -1)
+            zmtp_dealer_set_sockopt (self, option, sockopts [option]);
     return 0;
 }
 
+
 //  --------------------------------------------------------------------------
-//  Send a message on a socket
+//  Do socket I/O with the given engine. Returns 0 if OK, -1 if not
+//  supported.
 
 int
-zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg)
+zmtp_dealer_set_engine (zmtp_dealer_t *self, int engine)
 {
     assert (self);
-    if (!self->channel)
+    if (self->sender_on
+    || (zmtp_peers_size (self->peers) == 0
+    &&  !zmtp_peers_listening (self->peers)))
         return -1;
-    
-    return zmtp_channel_send (self->channel, msg);
+
+    for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+        if (zmtp_peers_set_engine (self->peers,
+                zmtp_peers_get (self->peers, index), engine) == -1)
+            return -1;
+    self->engine = engine;              //  Applies to new peers too
+    return 0;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Receive a message from a socket
+//  Receive a message from a socket, taking peers in turn
 
 zmtp_msg_t *
 zmtp_dealer_recv (zmtp_dealer_t *self)
 {
     assert (self);
-    if (!self->channel)
+    while (s_reconnect (self, true) == 0) {
+        zmtp_msg_t *msg = zmtp_peers_recv (self->peers, NULL);
+        if (msg || self->nlinks == 0 || !s_lost ())
+            return msg;
+    }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to max messages from a socket into the out array. Blocks
+//  only if no message is available. Returns the number of messages
+//  received, or -1 on error.
+
+ssize_t
+zmtp_dealer_recv_batch (zmtp_dealer_t *self, zmtp_msg_t **out, size_t max)
+{
+    assert (self);
+    while (s_reconnect (self, true) == 0) {
+        const ssize_t rc = zmtp_peers_recv_batch (self->peers, out, max);
+        if (rc != -1 || self->nlinks == 0 || !s_lost ())
+            return rc;
+    }
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive the header of the next frame, leaving its body to be pulled
+//  with zmtp_dealer_recv_body. Returns 0 if OK, -1 on error.
+
+int
+zmtp_dealer_recv_header (zmtp_dealer_t *self, byte *flags, size_t *size)
+{
+    assert (self);
+    while (s_reconnect (self, true) == 0) {
+        zmtp_channel_t *channel = s_only (self);
+        if (!channel) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        if (zmtp_channel_recv_header (channel, flags, size) == 0)
+            return 0;
+        if (!s_lost ())
+            return -1;
+        const int error = errno;
+        zmtp_peers_remove (self->peers, channel);
+        if (self->nlinks == 0) {
+            errno = error;
+            return -1;
+        }
+    }
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to max bytes of the current frame body into buffer, or skip
+//  them if buffer is NULL. Returns the number of bytes received, 0 once
+//  the whole body is received, or -1 on error.
+
+ssize_t
+zmtp_dealer_recv_body (zmtp_dealer_t *self, void *buffer, size_t max)
+{
+    assert (self);
+    zmtp_channel_t *channel = s_only (self);
+    if (!channel)
+        return -1;
+
+    return zmtp_channel_recv_body (channel, buffer, max);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return file descriptor that becomes readable when the socket may have
+//  input, or -1 if the socket has no peer or several. Check
+//  zmtp_dealer_has_input before waiting on it, as messages may already be
+//  buffered.
+
+int
+zmtp_dealer_fd (zmtp_dealer_t *self)
+{
+    assert (self);
+    const int fd = zmtp_peers_fd (self->peers);
+    if (fd != -1)
+        return fd;
+    zmtp_channel_t *channel = s_only (self);
+    return channel? zmtp_channel_fd (channel): -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if a message can be received without blocking, or data
+//  is waiting that the descriptor does not signal
+
+bool
+zmtp_dealer_has_input (zmtp_dealer_t *self)
+{
+    assert (self);
+    return zmtp_peers_has_input (self->peers);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take in peers that are connecting, without waiting, and return the
+//  events the socket is ready for
+
+int
+zmtp_dealer_events (zmtp_dealer_t *self)
+{
+    assert (self);
+    int events = 0;
+    if (zmtp_peers_poll_input (self->peers))
+        events |= ZMTP_POLLIN;
+    if (s_can_send (self))
+        events |= ZMTP_POLLOUT;
+    return events;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if a send will not wait for a peer to connect or for room
+//  in the send queue; one that fails at once does not wait either
+
+static bool
+s_can_send (zmtp_dealer_t *self)
+{
+    if (self->sender_on) {
+        pthread_mutex_lock (&self->mutex);
+        const bool room = (self->hwm == 0 || self->queue_size < self->hwm)
+            && (self->hwm_bytes == 0 || self->queue_bytes < self->hwm_bytes);
+        pthread_mutex_unlock (&self->mutex);
+        return room || !self->hwm_block;
+    }
+    //  Without peers, links queue what we send, and if we listen we
+    //  wait for a peer
+    return zmtp_peers_size (self->peers) > 0
+        || self->nlinks > 0
+        || !zmtp_peers_listening (self->peers);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Create channel with the socket's settings
+
+static zmtp_channel_t *
+s_channel_new (zmtp_dealer_t *self)
+{
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    if (!channel)
+        return NULL;
+    zmtp_channel_set_connect_timeout (channel, self->connect_timeout);
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        if (self->sockopts [option] != -1)
+            zmtp_channel_set_sockopt (channel, option, self->sockopts [option]);
+    return channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect new channel to endpoint and add it as a peer, waiting up to
+//  timeout msecs (-1 for ever) for the peer. Returns the channel, or NULL
+//  on error.
+
+static zmtp_channel_t *
+s_connect (zmtp_dealer_t *self, const char *endpoint_str, int timeout)
+{
+    zmtp_channel_t *channel = s_channel_new (self);
+    if (!channel)
         return NULL;
-    
-    return zmtp_channel_recv (self->channel);
+    zmtp_channel_set_connect_timeout (channel, timeout);
+
+    //  Try to connect channel to specified endpoint
+    if (zmtp_channel_connect (channel, endpoint_str) == -1
+    ||  zmtp_peers_add (self->peers, channel) == -1) {
+        zmtp_channel_destroy (&channel);
+        return NULL;
+    }
+    return channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Bring new peer, connected or accepted, up to the socket's settings, and
+//  send it whatever was queued while we had none. If that fails, the
+//  queue stays for the next peer, and the send after finds this one gone.
+
+static void
+s_connected (zmtp_channel_t *channel, void *arg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    zmtp_channel_set_maxmsgsize (channel, self->maxmsgsize);
+    zmtp_channel_set_budget (channel, self->budget);
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        if (self->sockopts [option] != -1)
+            zmtp_channel_set_sockopt (channel, option, self->sockopts [option]);
+    if (self->zerocopy)
+        zmtp_channel_set_zerocopy (channel, self->zerocopy);
+    if (self->engine != ZMTP_ENGINE_SYSCALL)
+        zmtp_peers_set_engine (self->peers, channel, self->engine);
+
+    //  With a send queue, the sender takes care of the queue
+    if (!self->sender_on && self->queue_size > 0
+    &&  zmtp_channel_send_batch (
+            channel, self->queue, self->queue_size) == 0) {
+        for (size_t index = 0; index < self->queue_size; index++)
+            zmtp_msg_destroy (&self->queue [index]);
+        self->queue_size = 0;
+        self->queue_bytes = 0;
+    }
+    pthread_mutex_lock (&self->mutex);
+    if (!self->channel) {
+        self->channel = channel;
+        pthread_cond_broadcast (&self->cond);
+    }
+    pthread_mutex_unlock (&self->mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget peer that is about to be closed, and move the sender on to
+//  another peer. A link we lost is reconnected right away.
+
+static void
+s_disconnected (zmtp_channel_t *channel, void *arg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    pthread_mutex_lock (&self->mutex);
+    if (self->sending == channel) {
+        //  The sender may be stuck on a peer that does not read; with the
+        //  connection shut down, its send fails at once and it lets go
+        zmtp_channel_shutdown (channel);
+        while (self->sending == channel)
+            pthread_cond_wait (&self->cond, &self->mutex);
+    }
+    if (self->broken == channel)
+        self->broken = NULL;
+    if (self->channel == channel) {
+        self->channel = zmtp_peers_size (self->peers) > 0?
+            zmtp_peers_get (self->peers, 0): NULL;
+        pthread_cond_broadcast (&self->cond);
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    for (size_t index = 0; index < self->nlinks; index++) {
+        dealer_link_t *link = &self->links [index];
+        if (link->channel == channel) {
+            link->channel = NULL;
+            link->reconnect_wait = self->reconnect_ivl;
+            link->reconnect_at = s_clock ();
+            self->links_down++;
+            break;
+        }
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the socket's peer if it has exactly one, else NULL
+
+static zmtp_channel_t *
+s_only (zmtp_dealer_t *self)
+{
+    return zmtp_peers_size (self->peers) == 1?
+        zmtp_peers_get (self->peers, 0): NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Reconnect links that are down, where it is time to. Makes sure the
+//  socket has a peer; if wait is true, waits and retries until it has,
+//  taking in peers that connect to us meanwhile. Returns 0 if it has a
+//  peer, else -1.
+
+static int
+s_reconnect (zmtp_dealer_t *self, bool wait)
+{
+    while (true) {
+        int64_t retry_at = INT64_MAX;
+        for (size_t index = 0; index < self->nlinks
+                            && self->links_down > 0; index++) {
+            dealer_link_t *link = &self->links [index];
+            if (link->channel)
+                continue;
+            if (link->reconnect_at <= s_clock ())
+                s_relink (self, link);
+            if (!link->channel && link->reconnect_at < retry_at)
+                retry_at = link->reconnect_at;
+        }
+        if (zmtp_peers_size (self->peers) > 0 || !wait)
+            break;
+        int delay = -1;
+        if (retry_at < INT64_MAX) {
+            const int64_t left = retry_at - s_clock ();
+            delay = left > 0? (int) left: 0;
+        }
+        if (zmtp_peers_listening (self->peers)) {
+            if (zmtp_peers_await (self->peers, delay) == -1
+            &&  errno != EAGAIN)
+                break;
+        }
+        else
+        if (delay == -1)
+            break;              //  Nobody can come
+        else
+        if (delay > 0)
+            usleep (delay * 1000);
+    }
+    return zmtp_peers_size (self->peers) > 0? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Try to connect link that is down. Attempts run inside the caller's
+//  send or receive, so unless a connect timeout is set, one waits no
+//  longer than the current reconnect interval, rather than for as long
+//  as the system retries to reach a dead host.
+
+static void
+s_relink (zmtp_dealer_t *self, dealer_link_t *link)
+{
+    const int timeout = self->connect_timeout == -1?
+        link->reconnect_wait: self->connect_timeout;
+    link->channel = s_connect (self, link->endpoint, timeout);
+    if (link->channel) {
+        link->reconnect_wait = self->reconnect_ivl;
+        self->links_down--;
+        return;
+    }
+    //  Wait between half and all of the interval, so that peers that
+    //  lost the same server do not come back in lockstep; then double
+    //  the interval
+    const int jitter = rand_r (&self->seed) % (link->reconnect_wait / 2 + 1);
+    link->reconnect_at =
+        s_clock () + link->reconnect_wait - link->reconnect_wait / 2 + jitter;
+    link->reconnect_wait = link->reconnect_wait < self->reconnect_ivl_max / 2
+        ? link->reconnect_wait * 2: self->reconnect_ivl_max;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send whole messages to the next peer in turn, or queue them for the
+//  sender thread or the next connection
+
+static int
+s_send (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    if (self->sender_on)
+        return s_send_queued (self, msgs, count);
+
+    //  Messages wait in the queue for links, and for the first peer to
+    //  connect to us otherwise
+    s_reconnect (self, self->nlinks == 0);
+    int error = ENOTCONN;
+    while (zmtp_peers_size (self->peers) > 0) {
+        if (self->next >= zmtp_peers_size (self->peers))
+            self->next = 0;
+        zmtp_channel_t *channel = zmtp_peers_get (self->peers, self->next);
+        if (zmtp_channel_send_batch (channel, msgs, count) == 0) {
+            self->next++;
+            return 0;
+        }
+        //  The last peer takes its place, and its turn
+        error = errno;
+        zmtp_peers_remove (self->peers, channel);
+    }
+    //  Send the messages on the next connection
+    if (self->nlinks > 0)
+        return s_enqueue (self, msgs, count);
+
+    errno = error;
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Hold references to frames of a message until its last frame comes
+
+static void
+s_hold (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    if (self->nframes + count > self->max_frames) {
+        while (self->nframes + count > self->max_frames)
+            self->max_frames = self->max_frames? 2 * self->max_frames: 4;
+        self->frames = (zmtp_msg_t **) realloc (
+            self->frames, self->max_frames * sizeof *self->frames);
+        assert (self->frames);      //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < count; index++)
+        self->frames [self->nframes++] = zmtp_msg_ref (msgs [index]);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue messages until we are connected; fails with EAGAIN, queueing
+//  none of them, if they do not fit under the limit
+
+static int
+s_enqueue (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    if (self->queue_size + count > self->queue_limit) {
+        errno = EAGAIN;
+        return -1;
+    }
+    const size_t bytes = s_bytes (msgs, count);
+    if (self->budget > 0 && self->queue_bytes + bytes > self->budget) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    s_push (self, msgs, count);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue messages for the sender thread, waiting or failing with EAGAIN
+//  at the high-water mark. A batch always fits into an empty queue. The
+//  sender takes what is queued to one peer, and the next call points it
+//  at the next peer in turn; batches hold whole messages, so a message
+//  never straddles two peers.
+
+static int
+s_send_queued (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    const size_t bytes = s_bytes (msgs, count);
+    pthread_mutex_lock (&self->mutex);
+    while (true) {
+        if (self->broken) {
+            //  Closing the peer moves the sender on
+            zmtp_channel_t *channel = self->broken;
+            pthread_mutex_unlock (&self->mutex);
+            zmtp_peers_remove (self->peers, channel);
+            pthread_mutex_lock (&self->mutex);
+            if (!self->channel && self->nlinks == 0
+            &&  !zmtp_peers_listening (self->peers)) {
+                pthread_mutex_unlock (&self->mutex);
+                errno = EPIPE;
+                return -1;
+            }
+            continue;
+        }
+        if (!self->channel && self->nlinks == 0) {
+            //  Wait for the first peer to connect to us, if any can
+            pthread_mutex_unlock (&self->mutex);
+            const int rc = s_reconnect (self, true);
+            pthread_mutex_lock (&self->mutex);
+            if (rc == 0)
+                continue;
+            pthread_mutex_unlock (&self->mutex);
+            errno = ENOTCONN;
+            return -1;
+        }
+        if (self->queue_size == 0
+        || ((self->hwm == 0 || self->queue_size + count <= self->hwm)
+        &&  (self->hwm_bytes == 0
+          || self->queue_bytes + bytes <= self->hwm_bytes)))
+            break;
+        if (!self->hwm_block) {
+            pthread_mutex_unlock (&self->mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+        if (!self->channel) {
+            //  Nothing drains the queue until we reconnect
+            pthread_mutex_unlock (&self->mutex);
+            s_reconnect (self, true);
+            pthread_mutex_lock (&self->mutex);
+            continue;
+        }
+        pthread_cond_wait (&self->cond, &self->mutex);
+    }
+    s_push (self, msgs, count);
+    if (zmtp_peers_size (self->peers) > 1) {
+        self->next = (self->next + 1) % zmtp_peers_size (self->peers);
+        self->channel = zmtp_peers_get (self->peers, self->next);
+    }
+    pthread_cond_broadcast (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
+
+    if (!self->channel)
+        s_reconnect (self, false);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append references to messages to the queue
+
+static void
+s_push (zmtp_dealer_t *self, zmtp_msg_t **msgs, size_t count)
+{
+    s_reserve (self, self->queue_size + count);
+    for (size_t index = 0; index < count; index++)
+        self->queue [self->queue_size++] = zmtp_msg_ref (msgs [index]);
+    self->queue_bytes += s_bytes (msgs, count);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Make room for size messages in queue
+
+static void
+s_reserve (zmtp_dealer_t *self, size_t size)
+{
+    if (size > self->queue_max) {
+        size_t queue_max = self->queue_max? self->queue_max: 16;
+        while (queue_max < size)
+            queue_max *= 2;
+        self->queue = (zmtp_msg_t **) realloc (
+            self->queue, queue_max * sizeof *self->queue);
+        assert (self->queue);   //  For now, memory exhaustion is fatal
+        self->queue_max = queue_max;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return total size of message data
+
+static size_t
+s_bytes (zmtp_msg_t **msgs, size_t count)
+{
+    size_t bytes = 0;
+    for (size_t index = 0; index < count; index++)
+        bytes += zmtp_msg_size (msgs [index]);
+    return bytes;
+}
+
+
+
+//  --------------------------------------------------------------------------
+//  Sender thread; takes the whole queue at a time and sends it as one
+//  batch. If the peer fails, messages that went out whole count as sent;
+//  the rest, including one the connection broke in the middle of, go
+//  back to the front of the queue for the next peer.
+
+static void *
+s_sender (void *arg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    zmtp_msg_t **batch = NULL;
+    size_t batch_max = 0;
+
+    pthread_mutex_lock (&self->mutex);
+    while (true) {
+        if (self->queue_size == 0 || !self->channel || self->broken) {
+            if (self->stopping)
+                break;
+            pthread_cond_wait (&self->cond, &self->mutex);
+            continue;
+        }
+        //  Swap queue for our spare array
+        zmtp_msg_t **msgs = self->queue;
+        const size_t msgs_max = self->queue_max;
+        const size_t count = self->queue_size;
+        self->queue = batch;
+        self->queue_max = batch_max;
+        self->queue_size = 0;
+        self->queue_bytes = 0;
+        batch = msgs;
+        batch_max = msgs_max;
+        zmtp_channel_t *channel = self->channel;
+        self->sending = channel;
+        pthread_cond_broadcast (&self->cond);
+        pthread_mutex_unlock (&self->mutex);
+
+        const size_t sent = zmtp_channel_sent (channel);
+        const int rc = zmtp_channel_send_batch (channel, batch, count);
+        const size_t done = rc == 0? count:
+            s_whole (batch, count, zmtp_channel_sent (channel) - sent);
+
+        pthread_mutex_lock (&self->mutex);
+        self->sending = NULL;
+        for (size_t index = 0; index < done; index++)
+            zmtp_msg_destroy (&batch [index]);
+        if (rc == -1) {
+            self->broken = channel;
+            const size_t left = count - done;
+            s_reserve (self, self->queue_size + left);
+            memmove (self->queue + left, self->queue,
+                self->queue_size * sizeof *self->queue);
+            memcpy (self->queue, batch + done, left * sizeof *batch);
+            self->queue_size += left;
+            self->queue_bytes += s_bytes (self->queue, left);
+        }
+        pthread_cond_broadcast (&self->cond);
+    }
+    pthread_mutex_unlock (&self->mutex);
+    free (batch);
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return how many messages at the start of the array went out whole in
+//  the given number of bytes, as encoded on the wire
+
+static size_t
+s_whole (zmtp_msg_t **msgs, size_t count, size_t bytes)
+{
+    size_t whole = 0;
+    for (size_t index = 0; index < count; index++) {
+        byte header [9];
+        const size_t size = zmtp_channel_encode_header (header, msgs [index])
+                          + zmtp_msg_size (msgs [index]);
+        if (size > bytes)
+            break;
+        bytes -= size;
+        if ((zmtp_msg_flags (msgs [index]) & ZMTP_MSG_MORE) == 0)
+            whole = index + 1;
+    }
+    return whole;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if errno after a failed receive means the connection is
+//  gone, rather than that the call was refused
+
+static bool
+s_lost (void)
+{
+    return errno != EBUSY && errno != EMSGSIZE;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return monotonic time in msecs
+
+static int64_t
+s_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 
 //  --------------------------------------------------------------------------
 //  Selftest
 
+static void *
+s_reconnect_peer (void *arg)
+{
+    const int count = *(int *) arg;
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    int rc = zmtp_dealer_listen (dealer, "tcp://127.0.0.1:22005");
+    assert (rc == 0);
+
+    for (int i = 0; i < count; i++) {
+        zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 1 && zmtp_msg_data (msg) [0] == i);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "reply", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_dealer_destroy (&dealer);
+    return NULL;
+}
+
+//  Peer that takes no input and then stops talking to us
+
+static void *
+s_stuck_peer (void *arg)
+{
+    pthread_barrier_t *barrier = (pthread_barrier_t *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    int rc = zmtp_channel_listen (channel, "ipc://@zmtp-dealer-test-c");
+    assert (rc == 0);
+    //  Give the sender time to fill our buffers
+    usleep (100000);
+    rc = shutdown (zmtp_channel_fd (channel), SHUT_WR);
+    assert (rc == 0);
+    pthread_barrier_wait (barrier);
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  Back end for multi-peer test; answers each request with its tag,
+//  checking that requests of several frames come whole
+
+struct test_backend {
+    const char *endpoint;       //  Where to meet the front end
+    bool listen;                //  Wait for the front end, else connect
+    byte tag;                   //  Body of each reply
+    int requests;               //  Requests to answer
+};
+
+static void *
+s_test_backend (void *arg)
+{
+    struct test_backend *backend = (struct test_backend *) arg;
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    if (backend->listen) {
+        int rc = zmtp_dealer_listen (dealer, backend->endpoint);
+        assert (rc == 0);
+    }
+    zmtp_msg_t *reply = zmtp_msg_from_const_data (0, &backend->tag, 1);
+    if (!backend->listen) {
+        while (zmtp_dealer_connect (dealer, backend->endpoint) == -1)
+            usleep (10000);
+        //  Tell the front end we are there
+        int rc = zmtp_dealer_send (dealer, reply);
+        assert (rc == 0);
+    }
+    int requests = 0;
+    byte part = 0;
+    while (requests < backend->requests) {
+        zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+        assert (msg);
+        const bool more = zmtp_msg_flags (msg) & ZMTP_MSG_MORE;
+        if (more || part > 0)
+            assert (zmtp_msg_size (msg) == 1
+                &&  zmtp_msg_data (msg) [0] == part);
+        zmtp_msg_destroy (&msg);
+        part = more? part + 1: 0;
+        if (!more) {
+            int rc = zmtp_dealer_send (dealer, reply);
+            assert (rc == 0);
+            requests++;
+        }
+    }
+    zmtp_msg_destroy (&reply);
+    zmtp_dealer_destroy (&dealer);
+    return NULL;
+}
+
+//  Send request of three frames, one frame at a time
+
+static void
+s_test_multipart (zmtp_dealer_t *dealer)
+{
+    for (byte part = 0; part < 3; part++) {
+        zmtp_msg_t *msg = zmtp_msg_new (part < 2? ZMTP_MSG_MORE: 0, 1);
+        zmtp_msg_data (msg) [0] = part;
+        int rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+}
+
 void
 zmtp_dealer_test (bool verbose)
 {
     printf (" * zmtp_dealer: ");
     //  @selftest
+    //  Without reconnecting, connecting to an absent peer fails
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_connect_timeout (dealer, 1000);
+    int rc = zmtp_dealer_connect (dealer, "tcp://127.0.0.1:22005");
+    assert (rc == -1);
+    zmtp_dealer_destroy (&dealer);
+
+#if defined (__UTYPE_LINUX)
+    //  A reconnect attempt waits no longer than the reconnect interval for
+    //  a peer that does not answer: here, a listener with a full backlog,
+    //  which drops our SYNs
+    int listener = socket (AF_INET, SOCK_STREAM, 0);
+    assert (listener != -1);
+    inaddr_t addr = { .sin_family = AF_INET, .sin_port = htons (22012) };
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    const int on = 1;
+    setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    rc = bind (listener, (struct sockaddr *) &addr, sizeof addr);
+    assert (rc == 0);
+    rc = listen (listener, 0);
+    assert (rc == 0);
+    int filler = socket (AF_INET, SOCK_STREAM, 0);
+    assert (filler != -1);
+    rc = connect (filler, (struct sockaddr *) &addr, sizeof addr);
+    assert (rc == 0);
+    dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_reconnect (dealer, 100, 100);
+    const int64_t start = s_clock ();
+    rc = zmtp_dealer_connect (dealer, "tcp://127.0.0.1:22012");
+    assert (rc == 0);
+    assert (s_clock () - start < 1000);
+    zmtp_dealer_destroy (&dealer);
+    close (filler);
+    close (listener);
+#endif
+
+    //  With reconnecting, messages are queued until the peer comes up
+    dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_reconnect (dealer, 10, 100);
+    rc = zmtp_dealer_set_profile (dealer, ZMTP_PROFILE_BULK);
+    assert (rc == 0);
+    rc = zmtp_dealer_set_sockopt (dealer, ZMTP_SOCKOPT_COUNT, 1);
+    assert (rc == -1);
+    zmtp_dealer_set_queue_limit (dealer, 3);
+    rc = zmtp_dealer_connect (dealer, "tcp://127.0.0.1:22005");
+    assert (rc == 0);
+    for (int i = 0; i < 4; i++) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, 1);
+        zmtp_msg_data (msg) [0] = (byte) i;
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (i < 3? rc == 0: rc == -1 && errno == EAGAIN);
+        zmtp_msg_destroy (&msg);
+    }
+    pthread_t thread;
+    int count = 3;
+    pthread_create (&thread, NULL, s_reconnect_peer, &count);
+    zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+
+    //  Losing the peer, we reconnect to its successor
+    int none = 0;
+    pthread_create (&thread, NULL, s_reconnect_peer, &none);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+
+    zmtp_dealer_destroy (&dealer);
+
+    //  With a send queue, sends return at once until the high-water mark
+    dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_reconnect (dealer, 10, 100);
+    rc = zmtp_dealer_set_send_queue (dealer, 4, 0, ZMTP_HWM_EAGAIN);
+    assert (rc == 0);
+    rc = zmtp_dealer_connect (dealer, "tcp://127.0.0.1:22005");
+    assert (rc == 0);
+    for (int i = 0; i < 5; i++) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, 1);
+        zmtp_msg_data (msg) [0] = (byte) i;
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (i < 4? rc == 0: rc == -1 && errno == EAGAIN);
+        zmtp_msg_destroy (&msg);
+    }
+    //  Blocking at the high-water mark, we wait for the peer
+    count = 100;
+    pthread_create (&thread, NULL, s_reconnect_peer, &count);
+    rc = zmtp_dealer_set_send_queue (dealer, 4, 100, ZMTP_HWM_BLOCK);
+    assert (rc == 0);
+    for (int i = 4; i < 100; i++) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, 1);
+        zmtp_msg_data (msg) [0] = (byte) i;
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+    zmtp_dealer_destroy (&dealer);
+
+    //  Losing a peer the sender is stuck on does not hold us up
+    pthread_barrier_t barrier;
+    pthread_barrier_init (&barrier, NULL, 2);
+    pthread_create (&thread, NULL, s_stuck_peer, &barrier);
+    dealer = zmtp_dealer_new ();
+    assert (dealer);
+    while (zmtp_dealer_connect (dealer, "ipc://@zmtp-dealer-test-c") == -1)
+        usleep (10000);
+    rc = zmtp_dealer_set_send_queue (dealer, 0, 0, ZMTP_HWM_BLOCK);
+    assert (rc == 0);
+    msg = zmtp_msg_new (0, 65536);
+    for (int i = 0; i < 64; i++) {
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+    }
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg == NULL);
+    pthread_barrier_wait (&barrier);
+    pthread_join (thread, NULL);
+    pthread_barrier_destroy (&barrier);
+    zmtp_dealer_destroy (&dealer);
+
+    //  Peers we connect to and peers that connect to us take turns
+    dealer = zmtp_dealer_new ();
+    assert (dealer);
+    const int fd = zmtp_dealer_fd (dealer);
+    struct test_backend backends [3] = {
+        { "ipc://@zmtp-dealer-test-a", false, 'A', 20 },
+        { "ipc://@zmtp-dealer-test-b", true, 'B', 20 },
+        { "ipc://@zmtp-dealer-test-a", false, 'C', 20 }
+    };
+    pthread_t threads [3];
+    for (int index = 0; index < 3; index++)
+        pthread_create (&threads [index], NULL,
+                        s_test_backend, &backends [index]);
+    //  Any number of peers can connect to one endpoint
+    rc = zmtp_dealer_listen (dealer, "ipc://@zmtp-dealer-test-a");
+    assert (rc == 0);
+    for (int i = 0; i < 2; i++) {
+        msg = zmtp_dealer_recv (dealer);
+        assert (msg);
+        zmtp_msg_destroy (&msg);
+    }
+    while (zmtp_dealer_connect (dealer, "ipc://@zmtp-dealer-test-b") == -1)
+        usleep (10000);
+#if defined (__UTYPE_LINUX)
+    //  The descriptor stays the same while peers come and go
+    assert (zmtp_dealer_fd (dealer) == fd);
+#endif
+
+    msg = zmtp_msg_from_const_data (0, "request", 7);
+    for (int i = 0; i < 30; i++) {
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+    }
+    zmtp_msg_destroy (&msg);
+    //  Messages of several frames go whole to one peer, in turn
+    for (int i = 0; i < 30; i++)
+        s_test_multipart (dealer);
+    int replies [3] = { 0, 0, 0 };
+    for (int i = 0; i < 60; i++) {
+        msg = zmtp_dealer_recv (dealer);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 1);
+        replies [zmtp_msg_data (msg) [0] - 'A']++;
+        zmtp_msg_destroy (&msg);
+    }
+    //  Each back end got every third request
+    assert (replies [0] == 20 && replies [1] == 20 && replies [2] == 20);
+    zmtp_dealer_destroy (&dealer);
+    for (int index = 0; index < 3; index++)
+        pthread_join (threads [index], NULL);
+
+    //  After a failed send, only messages that went out whole count as
+    //  sent: here, a two-frame message of 2 + 3 and 2 + 1 bytes, and a
+    //  single frame of 2 + 200 bytes
+    byte body [200] = { 0 };
+    zmtp_msg_t *msgs [3] = {
+        zmtp_msg_from_const_data (ZMTP_MSG_MORE, body, 3),
+        zmtp_msg_from_const_data (0, body, 1),
+        zmtp_msg_from_const_data (0, body, 200)
+    };
+    assert (s_whole (msgs, 3, 0) == 0);
+    assert (s_whole (msgs, 3, 5) == 0);
+    assert (s_whole (msgs, 3, 8) == 2);
+    assert (s_whole (msgs, 3, 209) == 2);
+    assert (s_whole (msgs, 3, 210) == 3);
+    for (int index = 0; index < 3; index++)
+        zmtp_msg_destroy (&msgs [index]);
     //  @end
     printf ("OK\n");
 }
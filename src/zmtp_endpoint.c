@@ -11,6 +11,36 @@
 */
 
 #include "zmtp_classes.h"
+#include <poll.h>
+
+
+//  --------------------------------------------------------------------------
+//  Create endpoint from string
+
+zmtp_endpoint_t *
+zmtp_endpoint_new (const char *endpoint_str)
+{
+    if (strncmp (endpoint_str, "ipc://", 6) == 0)
+        return (zmtp_endpoint_t *)
+            zmtp_ipc_endpoint_new (endpoint_str + 6);
+    else
+    if (strncmp (endpoint_str, "tcp://", 6) == 0) {
+        char *colon = strrchr (endpoint_str + 6, ':');
+        if (colon == NULL)
+            return NULL;
+        else {
+            const size_t addr_len = colon - endpoint_str - 6;
+            char addr [addr_len + 1];
+            memcpy (addr, endpoint_str + 6, addr_len);
+            addr [addr_len] = '\0';
+            const unsigned short port = atoi (colon + 1);
+            return (zmtp_endpoint_t *)
+                zmtp_tcp_endpoint_new (addr, port);
+        }
+    }
+    else
+        return NULL;
+}
 
 
 //  --------------------------------------------------------------------------
@@ -29,15 +59,15 @@ zmtp_endpoint_destroy (zmtp_endpoint_t **self_p)
 
 
 //  --------------------------------------------------------------------------
-//  Connect to the endpoint
+//  Connect to the endpoint, giving up after timeout msecs
 
 int
-zmtp_endpoint_connect (zmtp_endpoint_t *self)
+zmtp_endpoint_connect (zmtp_endpoint_t *self, int timeout)
 {
     assert (self);
     assert (self->connect);
 
-    return self->connect (self);
+    return self->connect (self, timeout);
 }
 
 
@@ -52,3 +82,57 @@ zmtp_endpoint_listen (zmtp_endpoint_t *self)
 
     return self->listen (self);
 }
+
+
+//  --------------------------------------------------------------------------
+//  Bind listening socket to endpoint
+
+int
+zmtp_endpoint_bind (zmtp_endpoint_t *self, bool reuseport)
+{
+    assert (self);
+    assert (self->bind);
+
+    return self->bind (self, reuseport);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect socket to address, waiting up to timeout msecs or for ever if
+//  -1. The connect runs non-blocking so that a dead address cannot stall
+//  us for the kernel's SYN timeout. Returns 0 if OK, -1 on error.
+
+int
+zmtp_endpoint_connect_socket (int s, const struct sockaddr *addr,
+                              socklen_t addrlen, int timeout)
+{
+    if (timeout < 0)
+        return connect (s, addr, addrlen);
+
+    const int flags = fcntl (s, F_GETFL, 0);
+    if (flags == -1 || fcntl (s, F_SETFL, flags | O_NONBLOCK) == -1)
+        return -1;
+
+    int rc = connect (s, addr, addrlen);
+    if (rc == -1 && errno == EINPROGRESS) {
+        struct pollfd pollfd = { .fd = s, .events = POLLOUT };
+        rc = poll (&pollfd, 1, timeout);
+        if (rc == 0) {
+            errno = ETIMEDOUT;
+            rc = -1;
+        }
+        else
+        if (rc == 1) {
+            int error = 0;
+            socklen_t len = sizeof error;
+            rc = getsockopt (s, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (rc == 0 && error != 0) {
+                errno = error;
+                rc = -1;
+            }
+        }
+    }
+    if (fcntl (s, F_SETFL, flags) == -1)
+        rc = -1;
+    return rc;
+}
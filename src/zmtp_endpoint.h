@@ -19,19 +19,39 @@ extern "C" {
 
 struct zmtp_endpoint {
     void (*destroy) (struct zmtp_endpoint **self_p);
-    int (*connect) (struct zmtp_endpoint *self);
+    int (*connect) (struct zmtp_endpoint *self, int timeout);
     int (*listen) (struct zmtp_endpoint *self);
+    int (*bind) (struct zmtp_endpoint *self, bool reuseport);
 };
 
 typedef struct zmtp_endpoint zmtp_endpoint_t;
 
+//  Create endpoint from string, e.g. "tcp://127.0.0.1:5555" or
+//  "ipc://@name". Returns NULL if the string is not valid.
+zmtp_endpoint_t *
+    zmtp_endpoint_new (const char *endpoint_str);
+
 void
     zmtp_endpoint_destroy (zmtp_endpoint_t **self_p);
 
+//  Return socket connected to endpoint, or -1 on error. Gives up after
+//  timeout msecs, with errno set to ETIMEDOUT; -1 waits for ever.
 int
-    zmtp_endpoint_connect (zmtp_endpoint_t *self);
+    zmtp_endpoint_connect (zmtp_endpoint_t *self, int timeout);
 
 int
     zmtp_endpoint_listen (zmtp_endpoint_t *self);
 
+//  Return socket bound to endpoint and listening with a full backlog, or
+//  -1 on error. With reuseport, several sockets may bind to one TCP
+//  endpoint and the kernel spreads connections over them.
+int
+    zmtp_endpoint_bind (zmtp_endpoint_t *self, bool reuseport);
+
+//  Connect socket to address for subclasses, waiting up to timeout msecs
+//  or for ever if -1. Returns 0 if OK, -1 on error.
+int
+    zmtp_endpoint_connect_socket (int s, const struct sockaddr *addr,
+                                  socklen_t addrlen, int timeout);
+
 #endif
@@ -0,0 +1,86 @@
+/*  =========================================================================
+    zmtp_engine - I/O engine base class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_engine_destroy (zmtp_engine_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_engine_t *self = *self_p;
+        assert (self->destroy);
+        self->destroy (self_p);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send data described by message header on socket; returns the number
+//  of bytes sent, or -1 on error
+
+ssize_t
+zmtp_engine_sendmsg (zmtp_engine_t *self,
+                     int fd, const struct msghdr *msghdr, int flags)
+{
+    assert (self);
+    assert (self->sendmsg);
+
+    return self->sendmsg (self, fd, msghdr, flags);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to len bytes from socket into buffer; returns the number of
+//  bytes received, 0 at end of stream, or -1 on error
+
+ssize_t
+zmtp_engine_recv (zmtp_engine_t *self,
+                  int fd, void *buffer, size_t len, int flags)
+{
+    assert (self);
+    assert (self->recv);
+
+    return self->recv (self, fd, buffer, len, flags);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of bytes the engine has received from the socket and
+//  not handed out yet
+
+size_t
+zmtp_engine_pending (zmtp_engine_t *self)
+{
+    assert (self);
+    assert (self->pending);
+
+    return self->pending (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return handle that becomes readable when the engine may have input
+//  for the socket
+
+int
+zmtp_engine_handle (zmtp_engine_t *self, int fd)
+{
+    assert (self);
+    assert (self->handle);
+
+    return self->handle (self, fd);
+}
@@ -0,0 +1,53 @@
+/*  =========================================================================
+    zmtp_engine - I/O engine base class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_ENGINE_H_INCLUDED__
+#define __ZMTP_ENGINE_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  An engine moves the bytes of a channel in and out of its socket. The
+//  send and recv operations follow sendmsg and recv, and honour the
+//  MSG_DONTWAIT flag; the channel does all the framing.
+
+struct zmtp_engine {
+    void (*destroy) (struct zmtp_engine **self_p);
+    ssize_t (*sendmsg) (struct zmtp_engine *self,
+                        int fd, const struct msghdr *msghdr, int flags);
+    ssize_t (*recv) (struct zmtp_engine *self,
+                     int fd, void *buffer, size_t len, int flags);
+    size_t (*pending) (struct zmtp_engine *self);
+    int (*handle) (struct zmtp_engine *self, int fd);
+};
+
+typedef struct zmtp_engine zmtp_engine_t;
+
+void
+    zmtp_engine_destroy (zmtp_engine_t **self_p);
+
+ssize_t
+    zmtp_engine_sendmsg (zmtp_engine_t *self,
+                         int fd, const struct msghdr *msghdr, int flags);
+
+ssize_t
+    zmtp_engine_recv (zmtp_engine_t *self,
+                      int fd, void *buffer, size_t len, int flags);
+
+size_t
+    zmtp_engine_pending (zmtp_engine_t *self);
+
+int
+    zmtp_engine_handle (zmtp_engine_t *self, int fd);
+
+#endif
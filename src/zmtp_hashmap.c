@@ -0,0 +1,308 @@
+/*  =========================================================================
+    zmtp_hashmap - hash table keyed on byte strings
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Open addressing with linear probing in a table that is at most half
+//  full, so lookups touch one or two neighbouring slots on average. Short
+//  keys, such as routing identities, are kept in the slot itself, so that
+//  a lookup reads no other memory. Deletion shifts later entries of the
+//  probe run back instead of leaving tombstones, so the table does not
+//  slow down under churn.
+
+#include "zmtp_classes.h"
+
+//  Keys up to this size are kept in the slot
+#define ZMTP_HASHMAP_INLINE 16
+
+//  Slot in the table; empty if value is NULL
+
+struct hashmap_slot {
+    uint64_t hash;              //  Hash of key
+    void *value;                //  Value, or NULL if empty
+    size_t size;                //  Key size
+    union {
+        byte bytes [ZMTP_HASHMAP_INLINE];
+        byte *data;             //  Longer keys
+    } key;
+};
+
+//  Structure of our class
+
+struct _zmtp_hashmap_t {
+    struct hashmap_slot *slots; //  Table, a power of two in size
+    size_t mask;                //  Table size minus one
+    size_t count;               //  Number of keys
+};
+
+static uint64_t
+    s_hash (const void *key, size_t size);
+static const byte *
+    s_key (struct hashmap_slot *slot);
+static size_t
+    s_find (zmtp_hashmap_t *self, const void *key, size_t size, uint64_t hash);
+static void
+    s_grow (zmtp_hashmap_t *self);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_hashmap_t *
+zmtp_hashmap_new (void)
+{
+    zmtp_hashmap_t *self = (zmtp_hashmap_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->mask = 15;
+    self->slots = (struct hashmap_slot *) zmalloc (
+        (self->mask + 1) * sizeof *self->slots);
+    assert (self->slots);       //  For now, memory exhaustion is fatal
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; does not touch the values
+
+void
+zmtp_hashmap_destroy (zmtp_hashmap_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_hashmap_t *self = *self_p;
+        for (size_t index = 0; index <= self->mask; index++)
+            if (self->slots [index].value
+            &&  self->slots [index].size > ZMTP_HASHMAP_INLINE)
+                free (self->slots [index].key.data);
+        free (self->slots);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Map key to value; the key is copied. Returns 0 if OK, -1 with errno
+//  set to EEXIST if the key is already there.
+
+int
+zmtp_hashmap_insert (zmtp_hashmap_t *self,
+                     const void *key, size_t size, void *value)
+{
+    assert (self);
+    assert (key || size == 0);
+    assert (value);
+
+    if (2 * (self->count + 1) > self->mask + 1)
+        s_grow (self);
+    const uint64_t hash = s_hash (key, size);
+    const size_t index = s_find (self, key, size, hash);
+    struct hashmap_slot *slot = &self->slots [index];
+    if (slot->value) {
+        errno = EEXIST;
+        return -1;
+    }
+    slot->hash = hash;
+    slot->value = value;
+    slot->size = size;
+    if (size > ZMTP_HASHMAP_INLINE) {
+        slot->key.data = (byte *) malloc (size);
+        assert (slot->key.data);    //  For now, memory exhaustion is fatal
+        memcpy (slot->key.data, key, size);
+    }
+    else
+    if (size > 0)
+        memcpy (slot->key.bytes, key, size);
+    self->count++;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return value for key, or NULL if there is none
+
+void *
+zmtp_hashmap_lookup (zmtp_hashmap_t *self, const void *key, size_t size)
+{
+    assert (self);
+    assert (key || size == 0);
+    return self->slots [s_find (self, key, size, s_hash (key, size))].value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove key. Returns 0 if OK, -1 if the key is not there.
+
+int
+zmtp_hashmap_delete (zmtp_hashmap_t *self, const void *key, size_t size)
+{
+    assert (self);
+    assert (key || size == 0);
+
+    size_t hole = s_find (self, key, size, s_hash (key, size));
+    if (!self->slots [hole].value)
+        return -1;
+    if (self->slots [hole].size > ZMTP_HASHMAP_INLINE)
+        free (self->slots [hole].key.data);
+
+    //  Move back each later entry of the run that may sit in the hole,
+    //  i.e. whose home slot is no further on than the hole
+    size_t index = hole;
+    while (true) {
+        index = (index + 1) & self->mask;
+        struct hashmap_slot *slot = &self->slots [index];
+        if (!slot->value)
+            break;
+        const size_t home = slot->hash & self->mask;
+        if (((index - home) & self->mask) >= ((index - hole) & self->mask)) {
+            self->slots [hole] = *slot;
+            hole = index;
+        }
+    }
+    self->slots [hole].value = NULL;
+    self->count--;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of keys
+
+size_t
+zmtp_hashmap_size (zmtp_hashmap_t *self)
+{
+    assert (self);
+    return self->count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return 64-bit FNV-1a hash of key, with the high bits folded in so that
+//  masking keeps them
+
+static uint64_t
+s_hash (const void *key, size_t size)
+{
+    const byte *bytes = (const byte *) key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t index = 0; index < size; index++) {
+        hash ^= bytes [index];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return key bytes of slot
+
+static const byte *
+s_key (struct hashmap_slot *slot)
+{
+    return slot->size > ZMTP_HASHMAP_INLINE? slot->key.data: slot->key.bytes;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return index of the slot holding key, or of the empty slot where it
+//  would go
+
+static size_t
+s_find (zmtp_hashmap_t *self, const void *key, size_t size, uint64_t hash)
+{
+    size_t index = hash & self->mask;
+    while (true) {
+        struct hashmap_slot *slot = &self->slots [index];
+        if (!slot->value)
+            return index;
+        if (slot->hash == hash && slot->size == size
+        &&  memcmp (s_key (slot), key, size) == 0)
+            return index;
+        index = (index + 1) & self->mask;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Double the table, moving entries to their new places
+
+static void
+s_grow (zmtp_hashmap_t *self)
+{
+    struct hashmap_slot *slots = self->slots;
+    const size_t size = self->mask + 1;
+    self->mask = 2 * size - 1;
+    self->slots = (struct hashmap_slot *) zmalloc (
+        (self->mask + 1) * sizeof *self->slots);
+    assert (self->slots);       //  For now, memory exhaustion is fatal
+    for (size_t index = 0; index < size; index++)
+        if (slots [index].value) {
+            size_t target = slots [index].hash & self->mask;
+            while (self->slots [target].value)
+                target = (target + 1) & self->mask;
+            self->slots [target] = slots [index];
+        }
+    free (slots);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_hashmap_test (bool verbose)
+{
+    printf (" * zmtp_hashmap: ");
+    //  @selftest
+    zmtp_hashmap_t *hashmap = zmtp_hashmap_new ();
+    assert (hashmap);
+    int value1, value2;
+    int rc = zmtp_hashmap_insert (hashmap, "short", 5, &value1);
+    assert (rc == 0);
+    rc = zmtp_hashmap_insert (hashmap, "short", 5, &value2);
+    assert (rc == -1 && errno == EEXIST);
+    rc = zmtp_hashmap_insert (hashmap,
+        "a key longer than sixteen bytes", 31, &value2);
+    assert (rc == 0);
+    assert (zmtp_hashmap_lookup (hashmap, "short", 5) == &value1);
+    assert (zmtp_hashmap_lookup (hashmap, "shor", 4) == NULL);
+    assert (zmtp_hashmap_lookup (hashmap,
+        "a key longer than sixteen bytes", 31) == &value2);
+    rc = zmtp_hashmap_delete (hashmap, "short", 5);
+    assert (rc == 0);
+    rc = zmtp_hashmap_delete (hashmap, "short", 5);
+    assert (rc == -1);
+    assert (zmtp_hashmap_size (hashmap) == 1);
+
+    //  Many keys, deleted in a different order, stay reachable
+    const int count = 50000;
+    for (int index = 0; index < count; index++) {
+        rc = zmtp_hashmap_insert (
+            hashmap, &index, sizeof index, (void *) (intptr_t) (index + 1));
+        assert (rc == 0);
+    }
+    for (int index = 0; index < count; index += 2) {
+        rc = zmtp_hashmap_delete (hashmap, &index, sizeof index);
+        assert (rc == 0);
+    }
+    for (int index = 0; index < count; index++) {
+        void *value = zmtp_hashmap_lookup (hashmap, &index, sizeof index);
+        if (index % 2)
+            assert (value == (void *) (intptr_t) (index + 1));
+        else
+            assert (value == NULL);
+    }
+    assert (zmtp_hashmap_size (hashmap) == 1 + count / 2);
+    zmtp_hashmap_destroy (&hashmap);
+    assert (hashmap == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
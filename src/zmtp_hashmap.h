@@ -0,0 +1,59 @@
+/*  =========================================================================
+    zmtp_hashmap - hash table keyed on byte strings
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_HASHMAP_H_INCLUDED__
+#define __ZMTP_HASHMAP_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_hashmap_t zmtp_hashmap_t;
+
+//  @interface
+//  Constructor
+zmtp_hashmap_t *
+    zmtp_hashmap_new (void);
+
+//  Destructor; does not touch the values
+void
+    zmtp_hashmap_destroy (zmtp_hashmap_t **self_p);
+
+//  Map key to value; the key is copied. Returns 0 if OK, -1 with errno
+//  set to EEXIST if the key is already there.
+int
+    zmtp_hashmap_insert (zmtp_hashmap_t *self,
+                         const void *key, size_t size, void *value);
+
+//  Return value for key, or NULL if there is none. Does not allocate.
+void *
+    zmtp_hashmap_lookup (zmtp_hashmap_t *self, const void *key, size_t size);
+
+//  Remove key. Returns 0 if OK, -1 if the key is not there.
+int
+    zmtp_hashmap_delete (zmtp_hashmap_t *self, const void *key, size_t size);
+
+//  Return number of keys
+size_t
+    zmtp_hashmap_size (zmtp_hashmap_t *self);
+
+//  Self test of this class
+void
+    zmtp_hashmap_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
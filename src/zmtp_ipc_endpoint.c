@@ -27,8 +27,10 @@ zmtp_ipc_endpoint_new (const char *path)
 
     //  Initialize base class
     self->base = (zmtp_endpoint_t) {
-        .connect = (int (*) (zmtp_endpoint_t *)) zmtp_ipc_endpoint_connect,
+        .connect =
+            (int (*) (zmtp_endpoint_t *, int)) zmtp_ipc_endpoint_connect,
         .listen = (int (*) (zmtp_endpoint_t *)) zmtp_ipc_endpoint_listen,
+        .bind = (int (*) (zmtp_endpoint_t *, bool)) zmtp_ipc_endpoint_bind,
         .destroy = (void (*) (zmtp_endpoint_t **)) zmtp_ipc_endpoint_destroy,
     };
 
@@ -62,7 +64,7 @@ zmtp_ipc_endpoint_destroy (zmtp_ipc_endpoint_t **self_p)
 
 
 int
-zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self)
+zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self, int timeout)
 {
     assert (self);
 
@@ -78,7 +80,8 @@ zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self)
             : sizeof self->sockaddr;
 
     //  Connect the socket
-    const int rc = connect (s, (const struct sockaddr *) &self->sockaddr, addrlen);
+    const int rc = zmtp_endpoint_connect_socket (
+        s, (const struct sockaddr *) &self->sockaddr, addrlen, timeout);
     if (rc == -1) {
         close (s);
         return -1;
@@ -92,6 +95,27 @@ zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self)
 {
     assert (self);
 
+    const int s = zmtp_ipc_endpoint_bind (self, false);
+    if (s == -1)
+        return -1;
+
+    const int rc = accept (s, NULL, NULL);
+    close (s);
+    return rc;
+}
+
+
+int
+zmtp_ipc_endpoint_bind (zmtp_ipc_endpoint_t *self, bool reuseport)
+{
+    assert (self);
+
+    //  Local sockets cannot share an address
+    if (reuseport) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
     const int s = socket (AF_UNIX, SOCK_STREAM, 0);
     if (s == -1)
         return -1;
@@ -103,11 +127,11 @@ zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self)
             : sizeof self->sockaddr;
 
     int rc = bind (s, (const struct sockaddr *) &self->sockaddr, addrlen);
-    if (rc == 0) {
-        rc = listen (s, 1);
-        if (rc == 0)
-            rc = accept (s, NULL, NULL);
+    if (rc == 0)
+        rc = listen (s, SOMAXCONN);
+    if (rc == -1) {
+        close (s);
+        return -1;
     }
-    close (s);
-    return rc;
+    return s;
 }
@@ -28,9 +28,12 @@ void
     zmtp_ipc_endpoint_destroy (zmtp_ipc_endpoint_t **self_p);
 
 int
-    zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self);
+    zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self, int timeout);
 
 int
     zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self);
 
+int
+    zmtp_ipc_endpoint_bind (zmtp_ipc_endpoint_t *self, bool reuseport);
+
 #endif
@@ -0,0 +1,394 @@
+/*  =========================================================================
+    zmtp_listener - listener class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+#include <poll.h>
+
+//  Structure of our class
+
+struct _zmtp_listener_t {
+    int fd;                     //  Listening socket, non-blocking
+    int sockopts [ZMTP_SOCKOPT_COUNT];  //  For accepted sockets, -1 if unset
+};
+
+static ssize_t
+    s_accept_batch (zmtp_listener_t *self,
+                    zmtp_channel_t **channels, size_t max, bool nowait);
+static int
+    s_accept (zmtp_listener_t *self);
+static void
+    s_set_timeouts (int fd, int timeout);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; binds to the endpoint and keeps listening until destroyed.
+//  Returns NULL on error.
+
+zmtp_listener_t *
+zmtp_listener_new (const char *endpoint_str, int flags)
+{
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_new (endpoint_str);
+    if (endpoint == NULL)
+        return NULL;
+    const int fd = zmtp_endpoint_bind (
+        endpoint, (flags & ZMTP_LISTENER_REUSEPORT) == ZMTP_LISTENER_REUSEPORT);
+    zmtp_endpoint_destroy (&endpoint);
+    if (fd == -1)
+        return NULL;
+
+    //  Accepting in batches must stop when the backlog is empty
+    const int fd_flags = fcntl (fd, F_GETFL, 0);
+    if (fd_flags == -1 || fcntl (fd, F_SETFL, fd_flags | O_NONBLOCK) == -1) {
+        close (fd);
+        return NULL;
+    }
+
+    zmtp_listener_t *self = (zmtp_listener_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->fd = fd;
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        self->sockopts [option] = -1;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; closes the listening socket
+
+void
+zmtp_listener_destroy (zmtp_listener_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_listener_t *self = *self_p;
+        close (self->fd);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait for a connection and return it as a negotiated channel, or NULL
+//  on error
+
+zmtp_channel_t *
+zmtp_listener_accept (zmtp_listener_t *self)
+{
+    assert (self);
+
+    zmtp_channel_t *channel = NULL;
+    while (channel == NULL) {
+        struct pollfd pollfd = { .fd = self->fd, .events = POLLIN };
+        const int rc = poll (&pollfd, 1, -1);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+            return NULL;
+        if (zmtp_listener_accept_batch (self, &channel, 1) == -1)
+            return NULL;
+    }
+    return channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept up to max connections that are waiting, without waiting for
+//  more, and store them as negotiated channels. Connections that fail to
+//  negotiate, or take longer than ZMTP_LISTENER_HANDSHAKE_IVL, are
+//  dropped. Returns the number of channels, or -1 on error.
+
+ssize_t
+zmtp_listener_accept_batch (zmtp_listener_t *self,
+                            zmtp_channel_t **channels, size_t max)
+{
+    assert (self);
+    assert (channels || max == 0);
+    return s_accept_batch (self, channels, max, false);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept up to max connections that are waiting, without waiting for
+//  more or for their peers, and store them as channels whose handshake
+//  has started. Returns the number of channels, or -1 on error.
+
+ssize_t
+zmtp_listener_accept_nowait (zmtp_listener_t *self,
+                             zmtp_channel_t **channels, size_t max)
+{
+    assert (self);
+    assert (channels || max == 0);
+    return s_accept_batch (self, channels, max, true);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set a socket option (ZMTP_SOCKOPT_*) for connections accepted from now
+//  on. Returns 0 if OK, -1 if the option or value is invalid.
+
+int
+zmtp_listener_set_sockopt (zmtp_listener_t *self, int option, int value)
+{
+    assert (self);
+    if (option < 0 || option >= ZMTP_SOCKOPT_COUNT || value < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    self->sockopts [option] = value;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set socket options for connections accepted from now on from a
+//  profile (ZMTP_PROFILE_*). Returns 0 if OK, -1 if the profile is unknown.
+
+int
+zmtp_listener_set_profile (zmtp_listener_t *self, int profile)
+{
+    assert (self);
+    int sockopts [ZMTP_SOCKOPT_COUNT];
+    if (zmtp_channel_profile_sockopts (profile, sockopts) == -1)
+        return -1;
+    for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+        if (sockopts [option] != -1)
+            self->sockopts [option] = sockopts [option];
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return listening socket; readable when connections are waiting
+
+int
+zmtp_listener_fd (zmtp_listener_t *self)
+{
+    assert (self);
+    return self->fd;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept up to max waiting connections, negotiating each in turn, or
+//  only starting to if nowait is true
+
+static ssize_t
+s_accept_batch (zmtp_listener_t *self,
+                zmtp_channel_t **channels, size_t max, bool nowait)
+{
+    size_t count = 0;
+    while (count < max) {
+        const int fd = s_accept (self);
+        if (fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (fd == -1 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        if (fd == -1)
+            return count > 0? (ssize_t) count: -1;
+
+        zmtp_channel_t *channel = zmtp_channel_new ();
+        assert (channel);
+        for (int option = 0; option < ZMTP_SOCKOPT_COUNT; option++)
+            if (self->sockopts [option] != -1)
+                zmtp_channel_set_sockopt (
+                    channel, option, self->sockopts [option]);
+        int rc;
+        if (nowait)
+            rc = zmtp_channel_attach_nowait (channel, fd);
+        else {
+            //  A peer that never greets us must not hold us up for ever
+            s_set_timeouts (fd, ZMTP_LISTENER_HANDSHAKE_IVL);
+            rc = zmtp_channel_attach (channel, fd);
+            if (rc == 0)
+                s_set_timeouts (fd, 0);
+        }
+        if (rc == 0)
+            channels [count++] = channel;
+        else
+            zmtp_channel_destroy (&channel);
+    }
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept a waiting connection as a blocking socket
+
+static int
+s_accept (zmtp_listener_t *self)
+{
+#if defined (__UTYPE_LINUX)
+    return accept4 (self->fd, NULL, NULL, SOCK_CLOEXEC);
+#else
+    //  Accepted sockets may inherit O_NONBLOCK from the listener
+    const int fd = accept (self->fd, NULL, NULL);
+    if (fd != -1) {
+        const int flags = fcntl (fd, F_GETFL, 0);
+        if (flags != -1)
+            fcntl (fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    return fd;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Limit how long blocking socket calls wait, in msecs; 0 waits for ever
+
+static void
+s_set_timeouts (int fd, int timeout)
+{
+    const struct timeval tv = {
+        .tv_sec = timeout / 1000, .tv_usec = timeout % 1000 * 1000
+    };
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_client (void *arg)
+{
+    const int id = *(int *) arg;
+
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    while (zmtp_channel_connect (channel, "tcp://127.0.0.1:22004") == -1)
+        usleep (10000);
+
+    zmtp_msg_t *msg = zmtp_msg_new (0, 1);
+    zmtp_msg_data (msg) [0] = (byte) id;
+    int rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    //  The listener echoes our message back
+    msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 1 && zmtp_msg_data (msg) [0] == id);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+void
+zmtp_listener_test (bool verbose)
+{
+    printf (" * zmtp_listener: ");
+    //  @selftest
+    zmtp_listener_t *listener =
+        zmtp_listener_new ("tcp://127.0.0.1:22004", ZMTP_LISTENER_REUSEPORT);
+    assert (listener);
+
+    //  Nothing to accept yet
+    zmtp_channel_t *channels [4];
+    ssize_t count = zmtp_listener_accept_batch (listener, channels, 4);
+    assert (count == 0);
+
+    //  A second listener can share the port, as can threads
+    zmtp_listener_t *shard =
+        zmtp_listener_new ("tcp://127.0.0.1:22004", ZMTP_LISTENER_REUSEPORT);
+    assert (shard);
+    zmtp_listener_destroy (&shard);
+
+    //  Accepted sockets get the listener's profile
+    int rc = zmtp_listener_set_profile (listener, ZMTP_PROFILE_LOW_LATENCY);
+    assert (rc == 0);
+    rc = zmtp_listener_set_profile (listener, 42);
+    assert (rc == -1);
+
+    //  One listener serves many peers
+    pthread_t threads [3];
+    int ids [3];
+    for (int i = 0; i < 3; i++) {
+        ids [i] = i + 1;
+        pthread_create (&threads [i], NULL, s_client, &ids [i]);
+    }
+    size_t accepted = 0;
+    channels [accepted] = zmtp_listener_accept (listener);
+    assert (channels [accepted]);
+    accepted++;
+    while (accepted < 3) {
+        struct pollfd pollfd = {
+            .fd = zmtp_listener_fd (listener), .events = POLLIN
+        };
+        rc = poll (&pollfd, 1, -1);
+        assert (rc == 1);
+        count = zmtp_listener_accept_batch (
+            listener, channels + accepted, 3 - accepted);
+        assert (count >= 0);
+        accepted += count;
+    }
+    for (int i = 0; i < 3; i++) {
+        int nodelay = 0;
+        socklen_t optlen = sizeof nodelay;
+        rc = getsockopt (zmtp_channel_fd (channels [i]),
+            IPPROTO_TCP, TCP_NODELAY, &nodelay, &optlen);
+        assert (rc == 0 && nodelay != 0);
+
+        zmtp_msg_t *msg = zmtp_channel_recv (channels [i]);
+        assert (msg);
+        rc = zmtp_channel_send (channels [i], msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    for (int i = 0; i < 3; i++) {
+        pthread_join (threads [i], NULL);
+        zmtp_channel_destroy (&channels [i]);
+    }
+
+    //  A handshake can be done without blocking
+    ids [0] = 4;
+    pthread_create (&threads [0], NULL, s_client, &ids [0]);
+    count = 0;
+    while (count == 0) {
+        struct pollfd pollfd = {
+            .fd = zmtp_listener_fd (listener), .events = POLLIN
+        };
+        rc = poll (&pollfd, 1, -1);
+        assert (rc == 1);
+        count = zmtp_listener_accept_nowait (listener, channels, 1);
+        assert (count >= 0);
+    }
+    while ((rc = zmtp_channel_handshake (channels [0])) == -1) {
+        assert (errno == EAGAIN);
+        struct pollfd pollfd = {
+            .fd = zmtp_channel_fd (channels [0]), .events = POLLIN
+        };
+        rc = poll (&pollfd, 1, -1);
+        assert (rc == 1);
+    }
+    rc = zmtp_channel_set_nonblocking (channels [0], false);
+    assert (rc == 0);
+    zmtp_msg_t *msg = zmtp_channel_recv (channels [0]);
+    assert (msg && zmtp_msg_data (msg) [0] == 4);
+    rc = zmtp_channel_send (channels [0], msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (threads [0], NULL);
+    zmtp_channel_destroy (&channels [0]);
+
+    //  Local endpoints cannot be shared
+    zmtp_listener_t *local =
+        zmtp_listener_new ("ipc://@zmtp-listener-test", ZMTP_LISTENER_REUSEPORT);
+    assert (local == NULL);
+
+    zmtp_listener_destroy (&listener);
+    assert (listener == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,87 @@
+/*  =========================================================================
+    zmtp_listener - listener class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_LISTENER_H_INCLUDED__
+#define __ZMTP_LISTENER_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Listener flags
+enum {
+    ZMTP_LISTENER_REUSEPORT = 1,    //  Share TCP endpoint with other listeners
+};
+
+//  Msecs an accepted connection has to finish its handshake
+#define ZMTP_LISTENER_HANDSHAKE_IVL 5000
+
+//  Opaque class structure
+typedef struct _zmtp_listener_t zmtp_listener_t;
+
+//  @interface
+//  Constructor; binds to the endpoint and keeps listening until destroyed.
+//  With ZMTP_LISTENER_REUSEPORT, each of several threads can create its
+//  own listener on one TCP endpoint, and the kernel shards incoming
+//  connections across them. Returns NULL on error.
+zmtp_listener_t *
+    zmtp_listener_new (const char *endpoint_str, int flags);
+
+//  Destructor; closes the listening socket
+void
+    zmtp_listener_destroy (zmtp_listener_t **self_p);
+
+//  Wait for a connection and return it as a negotiated channel, or NULL
+//  on error
+zmtp_channel_t *
+    zmtp_listener_accept (zmtp_listener_t *self);
+
+//  Accept up to max connections that are waiting, without waiting for
+//  more, and store them as negotiated channels. Connections that fail to
+//  negotiate, or take longer than ZMTP_LISTENER_HANDSHAKE_IVL, are
+//  dropped. Returns the number of channels, or -1 on error.
+ssize_t
+    zmtp_listener_accept_batch (zmtp_listener_t *self,
+                                zmtp_channel_t **channels, size_t max);
+
+//  Accept up to max connections that are waiting, without waiting for
+//  more or for their peers, and store them as channels whose handshake
+//  has started; see zmtp_channel_handshake. Returns the number of
+//  channels, or -1 on error.
+ssize_t
+    zmtp_listener_accept_nowait (zmtp_listener_t *self,
+                                 zmtp_channel_t **channels, size_t max);
+
+//  Set a socket option (ZMTP_SOCKOPT_*) for connections accepted from now
+//  on. Returns 0 if OK, -1 if the option or value is invalid.
+int
+    zmtp_listener_set_sockopt (zmtp_listener_t *self, int option, int value);
+
+//  Set socket options for connections accepted from now on from a
+//  profile (ZMTP_PROFILE_*). Returns 0 if OK, -1 if the profile is unknown.
+int
+    zmtp_listener_set_profile (zmtp_listener_t *self, int profile);
+
+//  Return listening socket; readable when connections are waiting
+int
+    zmtp_listener_fd (zmtp_listener_t *self);
+
+//  Self test of this class
+void
+    zmtp_listener_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,8 +19,21 @@ struct _zmtp_msg_t {
     byte *data;                 //  Data part of message
     size_t size;                //  Size of data in bytes
     bool greedy;                //  Did we take ownership of data?
+    bool pooled;                //  Did data come from the pool?
+    bool inlined;               //  Is data stored inline?
+    unsigned int refcnt;        //  Number of references to message
+    zmtp_msg_pool_t *pool;      //  Pool this message came from
+    byte inline_data [];        //  Small payloads live here
 };
 
+//  Payloads up to this size are stored inline, in the same block as the
+//  message structure, so that a message takes one block from the pool
+
+#define ZMTP_MSG_INLINE_MAX (ZMTP_MSG_POOL_BLOCK_MAX - sizeof (zmtp_msg_t))
+
+static zmtp_msg_t *
+    s_msg_new (zmtp_msg_pool_t *pool, byte flags, size_t inline_size);
+
 
 //  --------------------------------------------------------------------------
 //  Constructor; it allocates buffer for message data.
@@ -29,11 +42,30 @@ struct _zmtp_msg_t {
 zmtp_msg_t *
 zmtp_msg_new (byte flags, size_t size)
 {
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
-    assert (self);              //  For now, memory exhaustion is fatal
-    self->flags = flags;
-    self->data = (byte *) malloc (size);
-    assert (size == 0 || self->data);
+    return zmtp_msg_new_pooled (zmtp_msg_pool_thread (), flags, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; allocates message and its data buffer from the given pool.
+//  The initial content of the allocated buffer is undefined.
+
+zmtp_msg_t *
+zmtp_msg_new_pooled (zmtp_msg_pool_t *pool, byte flags, size_t size)
+{
+    assert (pool);
+    zmtp_msg_t *self;
+    if (size <= ZMTP_MSG_INLINE_MAX) {
+        self = s_msg_new (pool, flags, size);
+        self->data = self->inline_data;
+        self->inlined = true;
+    }
+    else {
+        self = s_msg_new (pool, flags, 0);
+        self->data = (byte *) zmtp_msg_pool_alloc (pool, size);
+        assert (self->data);    //  For now, memory exhaustion is fatal
+        self->pooled = true;
+    }
     self->size = size;
     self->greedy = true;
     return self;
@@ -48,9 +80,7 @@ zmtp_msg_t *
 zmtp_msg_from_data (byte flags, byte **data_p, size_t size)
 {
     assert (data_p);
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
-    assert (self);              //  For now, memory exhaustion is fatal
-    self->flags = flags;
+    zmtp_msg_t *self = s_msg_new (zmtp_msg_pool_thread (), flags, 0);
     self->data = *data_p;
     self->size = size;
     self->greedy = true;
@@ -66,18 +96,16 @@ zmtp_msg_from_data (byte flags, byte **data_p, size_t size)
 zmtp_msg_t *
 zmtp_msg_from_const_data (byte flags, void *data, size_t size)
 {
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
-    assert (self);              //  For now, memory exhaustion is fatal
-    self->flags = flags;
+    zmtp_msg_t *self = s_msg_new (zmtp_msg_pool_thread (), flags, 0);
     self->data = data;
     self->size = size;
-    self->greedy = false;
     return self;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Destructor; frees message data and destroys the message
+//  Destructor; drops a reference to the message, and frees message data
+//  and destroys the message once the last reference is gone
 
 void
 zmtp_msg_destroy (zmtp_msg_t **self_p)
@@ -85,13 +113,64 @@ zmtp_msg_destroy (zmtp_msg_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_msg_t *self = *self_p;
+        *self_p = NULL;
+        //  The only reference cannot be shared meanwhile, so it needs no
+        //  atomic decrement
+        if (__atomic_load_n (&self->refcnt, __ATOMIC_ACQUIRE) > 1
+        &&  __atomic_sub_fetch (&self->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+            return;
+        size_t block_size = sizeof *self;
+        if (self->inlined)
+            block_size += self->size;
+        else
+        if (self->pooled)
+            zmtp_msg_pool_free (self->pool, self->data, self->size);
+        else
         if (self->greedy)
             free (self->data);
-        free (self);
-        *self_p = NULL;
+        zmtp_msg_pool_free (self->pool, self, block_size);
     }
 }
 
+
+//  --------------------------------------------------------------------------
+//  Take another reference to the message; the message is shared, not
+//  copied. Safe to call from any thread. Returns the message.
+
+zmtp_msg_t *
+zmtp_msg_ref (zmtp_msg_t *self)
+{
+    assert (self);
+    __atomic_add_fetch (&self->refcnt, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Drop a reference to the message and nullify the reference; same as
+//  zmtp_msg_destroy
+
+void
+zmtp_msg_unref (zmtp_msg_t **self_p)
+{
+    zmtp_msg_destroy (self_p);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate message structure from the pool, with room for inline_size
+//  bytes of inline data
+
+static zmtp_msg_t *
+s_msg_new (zmtp_msg_pool_t *pool, byte flags, size_t inline_size)
+{
+    zmtp_msg_t *self = (zmtp_msg_t *)
+        zmtp_msg_pool_alloc (pool, sizeof *self + inline_size);
+    assert (self);              //  For now, memory exhaustion is fatal
+    *self = (zmtp_msg_t) { .flags = flags, .pool = pool, .refcnt = 1 };
+    return self;
+}
+
 //  --------------------------------------------------------------------------
 //  Return message flags property
 
@@ -139,6 +218,55 @@ zmtp_msg_test (bool verbose)
     assert (memcmp (zmtp_msg_data (msg), "hello", 6) == 0);
     zmtp_msg_destroy (&msg);
     assert (msg == NULL);
+
+    //  Payloads that fit a pool block along with the message are inline
+    msg = zmtp_msg_new (0, 10);
+    assert (zmtp_msg_size (msg) == 10);
+    assert (zmtp_msg_data (msg) == (byte *) msg + sizeof (zmtp_msg_t));
+    memcpy (zmtp_msg_data (msg), "0123456789", 10);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_new (0, ZMTP_MSG_INLINE_MAX);
+    assert (zmtp_msg_data (msg) == (byte *) msg + sizeof (zmtp_msg_t));
+    memset (zmtp_msg_data (msg), 0, ZMTP_MSG_INLINE_MAX);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_new (0, ZMTP_MSG_INLINE_MAX + 1);
+    assert (zmtp_msg_data (msg) != (byte *) msg + sizeof (zmtp_msg_t));
+    memset (zmtp_msg_data (msg), 0, ZMTP_MSG_INLINE_MAX + 1);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_new (0, 0);
+    assert (zmtp_msg_size (msg) == 0);
+    zmtp_msg_destroy (&msg);
+
+    zmtp_msg_pool_t *pool = zmtp_msg_pool_new ();
+    msg = zmtp_msg_new_pooled (pool, ZMTP_MSG_MORE, 1000);
+    assert (msg);
+    assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+    assert (zmtp_msg_size (msg) == 1000);
+    memset (zmtp_msg_data (msg), 0, 1000);
+    //  Messages may outlive their pool
+    zmtp_msg_pool_destroy (&pool);
+    zmtp_msg_destroy (&msg);
+
+    //  Shared message stays alive until the last reference is dropped
+    msg = zmtp_msg_new (0, 1000);
+    memset (zmtp_msg_data (msg), 'S', 1000);
+    zmtp_msg_t *copy1 = zmtp_msg_ref (msg);
+    zmtp_msg_t *copy2 = zmtp_msg_ref (msg);
+    assert (copy1 == msg && copy2 == msg);
+    zmtp_msg_destroy (&msg);
+    assert (msg == NULL);
+    assert (zmtp_msg_data (copy1) [999] == 'S');
+    zmtp_msg_unref (&copy1);
+    assert (copy1 == NULL);
+    assert (zmtp_msg_size (copy2) == 1000);
+    zmtp_msg_unref (&copy2);
+
+    byte *data = (byte *) malloc (5);
+    memcpy (data, "world", 5);
+    msg = zmtp_msg_from_data (0, &data, 5);
+    assert (data == NULL);
+    assert (memcmp (zmtp_msg_data (msg), "world", 5) == 0);
+    zmtp_msg_destroy (&msg);
     //  @end
     printf ("OK\n");
 }
@@ -0,0 +1,480 @@
+/*  =========================================================================
+    zmtp_msg_pool - message memory pool class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Blocks are cached in power-of-two size classes, from 64 bytes up to
+//  ZMTP_MSG_POOL_BLOCK_MAX. Larger blocks come straight from the heap.
+//
+//  The default pool of a thread belongs to that thread, which takes from
+//  and gives back to its cache without locking or atomic operations, and
+//  keeps count of its blocks in a field of its own. Other threads leave
+//  the cache alone: they allocate from the heap, and push blocks they free
+//  onto a lock-free list that the owner takes over as it allocates. Other
+//  pools may be shared, and lock their cache. Either way, an atomic count
+//  of blocks outstanding, plus one until the destructor is called, keeps
+//  the pool alive; the owner adds its own count in when it is done.
+
+#define ZMTP_MSG_POOL_MIN_BLOCK 64
+#define ZMTP_MSG_POOL_CLASSES   8
+
+#if (ZMTP_MSG_POOL_MIN_BLOCK << (ZMTP_MSG_POOL_CLASSES - 1)) \
+    != ZMTP_MSG_POOL_BLOCK_MAX
+#   error "ZMTP_MSG_POOL_BLOCK_MAX must be the largest size class"
+#endif
+
+//  Maximum number of free blocks cached per size class
+
+#define ZMTP_MSG_POOL_CACHE     256
+
+//  Free block on the list of blocks returned by other threads
+
+typedef struct _remote_block_t {
+    struct _remote_block_t *next;
+    int index;                  //  Size class of the block
+} remote_block_t;
+
+//  Ends the list once the owner is gone; blocks are then freed at once
+
+#define ZMTP_MSG_POOL_CLOSED ((remote_block_t *) 1)
+
+//  Structure of our class
+
+struct _zmtp_msg_pool_t {
+    pthread_mutex_t mutex;      //  Protects cache of shared pools
+    void *free_list [ZMTP_MSG_POOL_CLASSES];
+    size_t free_count [ZMTP_MSG_POOL_CLASSES];
+    remote_block_t *remote;     //  Blocks other threads gave back
+    long refs;                  //  Blocks outstanding, plus one if alive
+    long local;                 //  Owner's count, not yet in refs
+    bool owned;                 //  Default pool of a thread?
+    bool destroyed;             //  Destructor called; free when unused
+};
+
+static pthread_key_t s_thread_pool_key;
+static pthread_once_t s_thread_pool_once = PTHREAD_ONCE_INIT;
+
+//  Default pool of the calling thread, if it has one. Initial-exec spares
+//  a shared library a call per access; one pointer fits the static TLS
+//  that the C library keeps spare for libraries loaded at run time.
+static __thread zmtp_msg_pool_t *s_thread_pool
+    __attribute__ ((tls_model ("initial-exec")));
+
+static int
+    s_size_class (size_t size);
+static void *
+    s_pop (zmtp_msg_pool_t *self, int index);
+static void
+    s_push (zmtp_msg_pool_t *self, int index, void *block);
+static bool
+    s_push_remote (zmtp_msg_pool_t *self, int index, void *block);
+static void
+    s_take_remote (zmtp_msg_pool_t *self);
+static void
+    s_purge (zmtp_msg_pool_t *self);
+static void
+    s_unref (zmtp_msg_pool_t *self, long count);
+static void
+    s_thread_pool_init (void);
+static void
+    s_thread_pool_destroy (void *arg);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; creates an empty pool. A pool may be shared by threads.
+
+zmtp_msg_pool_t *
+zmtp_msg_pool_new (void)
+{
+    zmtp_msg_pool_t *self = (zmtp_msg_pool_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    const int rc = pthread_mutex_init (&self->mutex, NULL);
+    assert (rc == 0);
+    self->refs = 1;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; releases cached memory. Blocks still held by messages go
+//  back to the system as they are freed, and the pool itself goes away
+//  with the last of them.
+
+void
+zmtp_msg_pool_destroy (zmtp_msg_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_msg_pool_t *self = *self_p;
+        long count = 1;
+        if (self->owned) {
+            //  Only the owner destroys its pool, as it exits
+            assert (self == s_thread_pool);
+            s_thread_pool = NULL;
+            __atomic_add_fetch (&self->refs, self->local, __ATOMIC_RELAXED);
+            self->local = 0;
+            //  From now on, other threads free blocks at once
+            remote_block_t *remote = __atomic_exchange_n (
+                &self->remote, ZMTP_MSG_POOL_CLOSED, __ATOMIC_ACQ_REL);
+            while (remote) {
+                remote_block_t *next = remote->next;
+                free (remote);
+                remote = next;
+                count++;
+            }
+            s_purge (self);
+        }
+        else {
+            pthread_mutex_lock (&self->mutex);
+            self->destroyed = true;
+            s_purge (self);
+            pthread_mutex_unlock (&self->mutex);
+        }
+        s_unref (self, count);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the default pool of the calling thread, creating it if needed.
+//  The calling thread allocates from and frees to it without locking;
+//  other threads may free blocks to it too. The pool is destroyed when
+//  the thread exits.
+
+zmtp_msg_pool_t *
+zmtp_msg_pool_thread (void)
+{
+    if (s_thread_pool)
+        return s_thread_pool;
+
+    pthread_once (&s_thread_pool_once, s_thread_pool_init);
+    zmtp_msg_pool_t *pool = zmtp_msg_pool_new ();
+    pool->owned = true;
+    const int rc = pthread_setspecific (s_thread_pool_key, pool);
+    assert (rc == 0);
+    s_thread_pool = pool;
+    return pool;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate a block of size bytes. The initial content of the block is
+//  undefined. Returns NULL if out of memory.
+
+void *
+zmtp_msg_pool_alloc (zmtp_msg_pool_t *self, size_t size)
+{
+    assert (self);
+
+    const bool mine = self == s_thread_pool;
+    if (mine && __atomic_load_n (&self->remote, __ATOMIC_RELAXED))
+        s_take_remote (self);
+
+    const int index = s_size_class (size);
+    void *block = NULL;
+    if (index < ZMTP_MSG_POOL_CLASSES) {
+        if (mine)
+            block = s_pop (self, index);
+        else
+        if (!self->owned) {
+            pthread_mutex_lock (&self->mutex);
+            assert (!self->destroyed);
+            block = s_pop (self, index);
+            pthread_mutex_unlock (&self->mutex);
+        }
+        size = (size_t) ZMTP_MSG_POOL_MIN_BLOCK << index;
+    }
+    if (block == NULL) {
+        block = malloc (size);
+        if (block == NULL)
+            return NULL;
+    }
+    if (mine)
+        self->local++;
+    else
+        __atomic_add_fetch (&self->refs, 1, __ATOMIC_RELAXED);
+    return block;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a block to the pool it was allocated from; size must be the
+//  size it was allocated with. Any thread may return a block.
+
+void
+zmtp_msg_pool_free (zmtp_msg_pool_t *self, void *block, size_t size)
+{
+    assert (self);
+    if (block == NULL)
+        return;
+
+    const int index = s_size_class (size);
+    if (self == s_thread_pool) {
+        if (index < ZMTP_MSG_POOL_CLASSES
+        &&  self->free_count [index] < ZMTP_MSG_POOL_CACHE)
+            s_push (self, index, block);
+        else
+            free (block);
+        self->local--;
+        return;
+    }
+    if (self->owned) {
+        //  The owner counts the block off as it takes it over
+        if (s_push_remote (self, index, block))
+            return;
+    }
+    else {
+        pthread_mutex_lock (&self->mutex);
+        if (index < ZMTP_MSG_POOL_CLASSES
+        &&  self->free_count [index] < ZMTP_MSG_POOL_CACHE
+        &&  !self->destroyed) {
+            s_push (self, index, block);
+            block = NULL;
+        }
+        pthread_mutex_unlock (&self->mutex);
+    }
+    free (block);
+    s_unref (self, 1);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return index of the size class for blocks of given size; the index
+//  past the last class means the block is not cached.
+
+static int
+s_size_class (size_t size)
+{
+    if (size <= ZMTP_MSG_POOL_MIN_BLOCK)
+        return 0;
+    if (size > ZMTP_MSG_POOL_BLOCK_MAX)
+        return ZMTP_MSG_POOL_CLASSES;
+    //  Round up to the next power of two
+    return (int) (sizeof (unsigned long) * 8)
+        - __builtin_clzl ((unsigned long) size - 1)
+        - __builtin_ctz (ZMTP_MSG_POOL_MIN_BLOCK);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a block off the cache of the size class, or return NULL
+
+static void *
+s_pop (zmtp_msg_pool_t *self, int index)
+{
+    void *block = self->free_list [index];
+    if (block) {
+        self->free_list [index] = *(void **) block;
+        self->free_count [index]--;
+    }
+    return block;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put a block on the cache of the size class
+
+static void
+s_push (zmtp_msg_pool_t *self, int index, void *block)
+{
+    *(void **) block = self->free_list [index];
+    self->free_list [index] = block;
+    self->free_count [index]++;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Give a block back to the owner of the pool from another thread. Only
+//  the owner takes blocks off, and all at once, so pushing needs no lock.
+//  Returns false if the owner is gone, leaving the block to the caller.
+
+static bool
+s_push_remote (zmtp_msg_pool_t *self, int index, void *block)
+{
+    remote_block_t *remote = (remote_block_t *) block;
+    remote->index = index;
+    remote->next = __atomic_load_n (&self->remote, __ATOMIC_RELAXED);
+    do {
+        if (remote->next == ZMTP_MSG_POOL_CLOSED)
+            return false;
+    } while (!__atomic_compare_exchange_n (&self->remote, &remote->next,
+             remote, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Move blocks other threads gave back onto our cache, as far as there is
+//  room, and free the rest
+
+static void
+s_take_remote (zmtp_msg_pool_t *self)
+{
+    remote_block_t *remote =
+        __atomic_exchange_n (&self->remote, NULL, __ATOMIC_ACQUIRE);
+    while (remote) {
+        remote_block_t *next = remote->next;
+        const int index = remote->index;
+        if (index < ZMTP_MSG_POOL_CLASSES
+        &&  self->free_count [index] < ZMTP_MSG_POOL_CACHE)
+            s_push (self, index, remote);
+        else
+            free (remote);
+        self->local--;
+        remote = next;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Free all cached blocks
+
+static void
+s_purge (zmtp_msg_pool_t *self)
+{
+    for (int index = 0; index < ZMTP_MSG_POOL_CLASSES; index++) {
+        void *block;
+        while ((block = s_pop (self, index)))
+            free (block);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Drop count references to the pool, and free it once it is destroyed
+//  and no blocks are outstanding
+
+static void
+s_unref (zmtp_msg_pool_t *self, long count)
+{
+    if (__atomic_sub_fetch (&self->refs, count, __ATOMIC_ACQ_REL) > 0)
+        return;
+    s_purge (self);
+    pthread_mutex_destroy (&self->mutex);
+    free (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Per-thread default pools
+
+static void
+s_thread_pool_init (void)
+{
+    const int rc =
+        pthread_key_create (&s_thread_pool_key, s_thread_pool_destroy);
+    assert (rc == 0);
+}
+
+static void
+s_thread_pool_destroy (void *arg)
+{
+    zmtp_msg_pool_t *pool = (zmtp_msg_pool_t *) arg;
+    zmtp_msg_pool_destroy (&pool);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_thread_alloc (void *arg)
+{
+    //  Allocate from this thread's pool and hand the block over
+    void **block_p = (void **) arg;
+    zmtp_msg_pool_t *pool = zmtp_msg_pool_thread ();
+    *block_p = zmtp_msg_pool_alloc (pool, 100);
+    return pool;
+}
+
+struct test_block {
+    zmtp_msg_pool_t *pool;      //  Pool of another thread
+    void *block;                //  Block to give back to it
+};
+
+static void *
+s_thread_free (void *arg)
+{
+    struct test_block *test_block = (struct test_block *) arg;
+    zmtp_msg_pool_free (test_block->pool, test_block->block, 100);
+    return NULL;
+}
+
+void
+zmtp_msg_pool_test (bool verbose)
+{
+    printf (" * zmtp_msg_pool: ");
+    //  @selftest
+    zmtp_msg_pool_t *pool = zmtp_msg_pool_new ();
+    assert (pool);
+
+    //  Freed blocks are reused for the same size class
+    void *block = zmtp_msg_pool_alloc (pool, 100);
+    assert (block);
+    memset (block, 0xAA, 100);
+    zmtp_msg_pool_free (pool, block, 100);
+    void *block2 = zmtp_msg_pool_alloc (pool, 128);
+    assert (block2 == block);
+    zmtp_msg_pool_free (pool, block2, 128);
+
+    //  Large blocks bypass the cache
+    block = zmtp_msg_pool_alloc (pool, 100000);
+    assert (block);
+    memset (block, 0xBB, 100000);
+    zmtp_msg_pool_free (pool, block, 100000);
+
+    //  Pool outlives its destructor until the last block is returned
+    block = zmtp_msg_pool_alloc (pool, 10);
+    zmtp_msg_pool_t *owner = pool;
+    zmtp_msg_pool_destroy (&pool);
+    assert (pool == NULL);
+    zmtp_msg_pool_free (owner, block, 10);
+
+    //  Each thread gets its own default pool
+    pool = zmtp_msg_pool_thread ();
+    assert (pool);
+    assert (zmtp_msg_pool_thread () == pool);
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_thread_alloc, &block);
+    void *thread_pool;
+    pthread_join (thread, &thread_pool);
+    assert (block);
+    assert (thread_pool != pool);
+    //  The thread has exited, so its pool goes away with this block
+    zmtp_msg_pool_free ((zmtp_msg_pool_t *) thread_pool, block, 100);
+
+    //  Blocks other threads free go back to the owner, without locking
+    block = zmtp_msg_pool_alloc (pool, 100);
+    assert (block);
+    struct test_block test_block = { pool, block };
+    pthread_create (&thread, NULL, s_thread_free, &test_block);
+    pthread_join (thread, NULL);
+    assert (pool->remote == block);
+    s_take_remote (pool);
+    assert (pool->remote == NULL);
+    assert (pool->free_list [1] == block);
+    assert (zmtp_msg_pool_alloc (pool, 100) == block);
+    zmtp_msg_pool_free (pool, block, 100);
+
+    //  Size classes round up to powers of two
+    assert (s_size_class (1) == 0);
+    assert (s_size_class (64) == 0);
+    assert (s_size_class (65) == 1);
+    assert (s_size_class (128) == 1);
+    assert (s_size_class (ZMTP_MSG_POOL_BLOCK_MAX)
+            == ZMTP_MSG_POOL_CLASSES - 1);
+    assert (s_size_class (ZMTP_MSG_POOL_BLOCK_MAX + 1)
+            == ZMTP_MSG_POOL_CLASSES);
+    //  @end
+    printf ("OK\n");
+}
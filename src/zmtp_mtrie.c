@@ -0,0 +1,435 @@
+/*  =========================================================================
+    zmtp_mtrie - subscription trie class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Each node stands for a prefix, and holds the peers subscribed to
+//  exactly that prefix. Its children are kept in an array that covers
+//  the range of next bytes in use, so that stepping down costs one index
+//  operation whatever the number of subscriptions.
+
+#include "zmtp_classes.h"
+
+//  Peer subscribed to a prefix
+
+struct mtrie_entry {
+    void *peer;                 //  Subscriber
+    size_t count;               //  Number of times subscribed
+};
+
+typedef struct _mtrie_node_t mtrie_node_t;
+
+struct _mtrie_node_t {
+    struct mtrie_entry *entries;    //  Peers subscribed to this prefix
+    size_t nentries;                //  Number of peers
+    size_t max_entries;             //  Allocated size of entries array
+    mtrie_node_t **next;            //  Children for bytes min..min+count-1
+    byte min;                       //  Lowest byte with a child slot
+    unsigned short count;           //  Number of child slots
+    unsigned short live;            //  Number of children
+};
+
+//  Structure of our class
+
+struct _zmtp_mtrie_t {
+    mtrie_node_t root;          //  Node of the empty prefix
+};
+
+static void
+    s_node_purge (mtrie_node_t *node);
+static mtrie_node_t *
+    s_node_child (mtrie_node_t *node, byte c);
+static bool
+    s_node_remove (mtrie_node_t *node,
+                   const byte *prefix, size_t size, void *peer);
+static void
+    s_node_remove_peer (mtrie_node_t *node, void *peer);
+static void
+    s_node_prune (mtrie_node_t *node, byte c);
+static void
+    s_node_apply (mtrie_node_t *node, byte **buffer, size_t *max,
+                  size_t size, zmtp_mtrie_apply_fn *fn, void *arg);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_mtrie_t *
+zmtp_mtrie_new (void)
+{
+    zmtp_mtrie_t *self = (zmtp_mtrie_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_mtrie_destroy (zmtp_mtrie_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_mtrie_t *self = *self_p;
+        s_node_purge (&self->root);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Subscribe peer to messages starting with prefix. Subscriptions are
+//  counted. Returns true if the peer was not subscribed to the prefix.
+
+bool
+zmtp_mtrie_add (zmtp_mtrie_t *self,
+                const byte *prefix, size_t size, void *peer)
+{
+    assert (self);
+    assert (prefix || size == 0);
+
+    mtrie_node_t *node = &self->root;
+    for (size_t index = 0; index < size; index++)
+        node = s_node_child (node, prefix [index]);
+
+    for (size_t index = 0; index < node->nentries; index++)
+        if (node->entries [index].peer == peer)
+            return ++node->entries [index].count == 1;
+
+    if (node->nentries == node->max_entries) {
+        node->max_entries = node->max_entries? 2 * node->max_entries: 4;
+        node->entries = (struct mtrie_entry *) realloc (
+            node->entries, node->max_entries * sizeof *node->entries);
+        assert (node->entries);     //  For now, memory exhaustion is fatal
+    }
+    node->entries [node->nentries++] = (struct mtrie_entry) { peer, 1 };
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take back one subscription of peer to prefix. Returns true if that was
+//  the last one.
+
+bool
+zmtp_mtrie_remove (zmtp_mtrie_t *self,
+                   const byte *prefix, size_t size, void *peer)
+{
+    assert (self);
+    assert (prefix || size == 0);
+    return s_node_remove (&self->root, prefix, size, peer);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take back all subscriptions of peer
+
+void
+zmtp_mtrie_remove_peer (zmtp_mtrie_t *self, void *peer)
+{
+    assert (self);
+    s_node_remove_peer (&self->root, peer);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Call fn for each peer subscribed to a prefix of data, once per
+//  matching prefix.
+
+void
+zmtp_mtrie_match (zmtp_mtrie_t *self, const byte *data, size_t size,
+                  zmtp_mtrie_match_fn *fn, void *arg)
+{
+    assert (self);
+    assert (data || size == 0);
+    assert (fn);
+
+    mtrie_node_t *node = &self->root;
+    size_t index = 0;
+    while (node) {
+        for (size_t entry = 0; entry < node->nentries; entry++)
+            fn (node->entries [entry].peer, arg);
+        if (index == size)
+            break;
+        const byte c = data [index++];
+        if (c < node->min || c - node->min >= node->count)
+            break;
+        node = node->next [c - node->min];
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if any peer is subscribed to a prefix of data
+
+bool
+zmtp_mtrie_check (zmtp_mtrie_t *self, const byte *data, size_t size)
+{
+    assert (self);
+    assert (data || size == 0);
+
+    mtrie_node_t *node = &self->root;
+    size_t index = 0;
+    while (node) {
+        if (node->nentries > 0)
+            return true;
+        if (index == size)
+            break;
+        const byte c = data [index++];
+        if (c < node->min || c - node->min >= node->count)
+            break;
+        node = node->next [c - node->min];
+    }
+    return false;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Call fn for each prefix and peer subscribed to it
+
+void
+zmtp_mtrie_apply (zmtp_mtrie_t *self, zmtp_mtrie_apply_fn *fn, void *arg)
+{
+    assert (self);
+    assert (fn);
+    byte *buffer = NULL;
+    size_t max = 0;
+    s_node_apply (&self->root, &buffer, &max, 0, fn, arg);
+    free (buffer);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Free everything below and in node, leaving it empty
+
+static void
+s_node_purge (mtrie_node_t *node)
+{
+    for (size_t index = 0; index < node->count; index++)
+        if (node->next [index]) {
+            s_node_purge (node->next [index]);
+            free (node->next [index]);
+        }
+    free (node->next);
+    free (node->entries);
+    memset (node, 0, sizeof *node);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return child of node for byte c, creating it and widening the range of
+//  child slots as needed
+
+static mtrie_node_t *
+s_node_child (mtrie_node_t *node, byte c)
+{
+    if (node->count == 0) {
+        node->next = (mtrie_node_t **) zmalloc (sizeof *node->next);
+        assert (node->next);        //  For now, memory exhaustion is fatal
+        node->min = c;
+        node->count = 1;
+    }
+    else
+    if (c < node->min) {
+        const size_t shift = node->min - c;
+        mtrie_node_t **next = (mtrie_node_t **) zmalloc (
+            (node->count + shift) * sizeof *next);
+        assert (next);              //  For now, memory exhaustion is fatal
+        memcpy (next + shift, node->next, node->count * sizeof *next);
+        free (node->next);
+        node->next = next;
+        node->min = c;
+        node->count += shift;
+    }
+    else
+    if (c - node->min >= node->count) {
+        const size_t count = c - node->min + 1;
+        node->next = (mtrie_node_t **) realloc (
+            node->next, count * sizeof *node->next);
+        assert (node->next);        //  For now, memory exhaustion is fatal
+        memset (node->next + node->count, 0,
+                (count - node->count) * sizeof *node->next);
+        node->count = count;
+    }
+    mtrie_node_t **slot = &node->next [c - node->min];
+    if (!*slot) {
+        *slot = (mtrie_node_t *) zmalloc (sizeof **slot);
+        assert (*slot);             //  For now, memory exhaustion is fatal
+        node->live++;
+    }
+    return *slot;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take back one subscription below node, freeing nodes left empty
+
+static bool
+s_node_remove (mtrie_node_t *node,
+               const byte *prefix, size_t size, void *peer)
+{
+    if (size == 0) {
+        for (size_t index = 0; index < node->nentries; index++)
+            if (node->entries [index].peer == peer) {
+                if (--node->entries [index].count > 0)
+                    return false;
+                node->entries [index] = node->entries [--node->nentries];
+                return true;
+            }
+        return false;
+    }
+    const byte c = prefix [0];
+    if (c < node->min || c - node->min >= node->count
+    || !node->next [c - node->min])
+        return false;
+    const bool last = s_node_remove (
+        node->next [c - node->min], prefix + 1, size - 1, peer);
+    s_node_prune (node, c);
+    return last;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take back all subscriptions of peer below node
+
+static void
+s_node_remove_peer (mtrie_node_t *node, void *peer)
+{
+    for (size_t index = 0; index < node->nentries; index++)
+        if (node->entries [index].peer == peer) {
+            node->entries [index] = node->entries [--node->nentries];
+            break;
+        }
+    for (size_t index = 0; index < node->count; index++)
+        if (node->next [index]) {
+            s_node_remove_peer (node->next [index], peer);
+            s_node_prune (node, node->min + index);
+        }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Free child of node for byte c if nothing is left in or below it
+
+static void
+s_node_prune (mtrie_node_t *node, byte c)
+{
+    mtrie_node_t **slot = &node->next [c - node->min];
+    if ((*slot)->nentries > 0 || (*slot)->live > 0)
+        return;
+    s_node_purge (*slot);
+    free (*slot);
+    *slot = NULL;
+    if (--node->live == 0) {
+        free (node->next);
+        node->next = NULL;
+        node->count = 0;
+        node->min = 0;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Report subscriptions in and below node, whose prefix so far is the
+//  first size bytes of buffer
+
+static void
+s_node_apply (mtrie_node_t *node, byte **buffer, size_t *max,
+              size_t size, zmtp_mtrie_apply_fn *fn, void *arg)
+{
+    for (size_t index = 0; index < node->nentries; index++)
+        fn (*buffer, size, node->entries [index].peer, arg);
+
+    if (node->live > 0 && size == *max) {
+        *max = *max? 2 * *max: 64;
+        *buffer = (byte *) realloc (*buffer, *max);
+        assert (*buffer);           //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < node->count; index++)
+        if (node->next [index]) {
+            (*buffer) [size] = node->min + index;
+            s_node_apply (node->next [index], buffer, max, size + 1, fn, arg);
+        }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void
+s_test_count (void *peer, void *arg)
+{
+    (*(int *) arg)++;
+}
+
+static void
+s_test_apply (const byte *prefix, size_t size, void *peer, void *arg)
+{
+    (*(size_t *) arg) += size;
+}
+
+void
+zmtp_mtrie_test (bool verbose)
+{
+    printf (" * zmtp_mtrie: ");
+    //  @selftest
+    zmtp_mtrie_t *mtrie = zmtp_mtrie_new ();
+    assert (mtrie);
+    int peer1, peer2;
+
+    assert (zmtp_mtrie_add (mtrie, (byte *) "AB", 2, &peer1));
+    assert (!zmtp_mtrie_add (mtrie, (byte *) "AB", 2, &peer1));
+    assert (zmtp_mtrie_add (mtrie, (byte *) "ABC", 3, &peer2));
+    assert (zmtp_mtrie_add (mtrie, (byte *) "a", 1, &peer2));
+    assert (zmtp_mtrie_add (mtrie, (byte *) "", 0, &peer2));
+
+    int matches = 0;
+    zmtp_mtrie_match (mtrie, (byte *) "ABCD", 4, s_test_count, &matches);
+    assert (matches == 3);
+    matches = 0;
+    zmtp_mtrie_match (mtrie, (byte *) "A", 1, s_test_count, &matches);
+    assert (matches == 1);
+    assert (zmtp_mtrie_check (mtrie, (byte *) "x", 1));
+
+    size_t total = 0;
+    zmtp_mtrie_apply (mtrie, s_test_apply, &total);
+    assert (total == 2 + 3 + 1 + 0);
+
+    //  Counted subscriptions go away with their last removal
+    assert (!zmtp_mtrie_remove (mtrie, (byte *) "AB", 2, &peer1));
+    assert (zmtp_mtrie_remove (mtrie, (byte *) "AB", 2, &peer1));
+    assert (!zmtp_mtrie_remove (mtrie, (byte *) "AB", 2, &peer1));
+    assert (zmtp_mtrie_remove (mtrie, (byte *) "", 0, &peer2));
+    matches = 0;
+    zmtp_mtrie_match (mtrie, (byte *) "ABCD", 4, s_test_count, &matches);
+    assert (matches == 1);
+    assert (!zmtp_mtrie_check (mtrie, (byte *) "AB", 2));
+
+    zmtp_mtrie_remove_peer (mtrie, &peer2);
+    assert (!zmtp_mtrie_check (mtrie, (byte *) "ABCD", 4));
+    assert (!zmtp_mtrie_check (mtrie, (byte *) "a", 1));
+
+    //  Many subscriptions; each topic matches only its own prefixes
+    char topic [16];
+    for (int index = 0; index < 10000; index++) {
+        snprintf (topic, sizeof topic, "T%d", index);
+        zmtp_mtrie_add (mtrie, (byte *) topic, strlen (topic), &peer1);
+    }
+    matches = 0;
+    zmtp_mtrie_match (mtrie, (byte *) "T1234.x", 7, s_test_count, &matches);
+    assert (matches == 4);          //  T1, T12, T123, T1234
+    zmtp_mtrie_destroy (&mtrie);
+    assert (mtrie == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
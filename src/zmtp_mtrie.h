@@ -0,0 +1,80 @@
+/*  =========================================================================
+    zmtp_mtrie - subscription trie class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_MTRIE_H_INCLUDED__
+#define __ZMTP_MTRIE_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_mtrie_t zmtp_mtrie_t;
+
+//  Called for each peer that matches a message
+typedef void (zmtp_mtrie_match_fn) (void *peer, void *arg);
+
+//  Called for each subscription
+typedef void (zmtp_mtrie_apply_fn) (
+    const byte *prefix, size_t size, void *peer, void *arg);
+
+//  @interface
+//  Constructor
+zmtp_mtrie_t *
+    zmtp_mtrie_new (void);
+
+//  Destructor
+void
+    zmtp_mtrie_destroy (zmtp_mtrie_t **self_p);
+
+//  Subscribe peer to messages starting with prefix. Subscriptions are
+//  counted. Returns true if the peer was not subscribed to the prefix.
+bool
+    zmtp_mtrie_add (zmtp_mtrie_t *self,
+                    const byte *prefix, size_t size, void *peer);
+
+//  Take back one subscription of peer to prefix. Returns true if that was
+//  the last one.
+bool
+    zmtp_mtrie_remove (zmtp_mtrie_t *self,
+                       const byte *prefix, size_t size, void *peer);
+
+//  Take back all subscriptions of peer
+void
+    zmtp_mtrie_remove_peer (zmtp_mtrie_t *self, void *peer);
+
+//  Call fn for each peer subscribed to a prefix of data, once per
+//  matching prefix; a peer with several matching prefixes is reported
+//  for each. Takes time in the length of data, not in the number of
+//  subscriptions.
+void
+    zmtp_mtrie_match (zmtp_mtrie_t *self, const byte *data, size_t size,
+                      zmtp_mtrie_match_fn *fn, void *arg);
+
+//  Return true if any peer is subscribed to a prefix of data
+bool
+    zmtp_mtrie_check (zmtp_mtrie_t *self, const byte *data, size_t size);
+
+//  Call fn for each prefix and peer subscribed to it
+void
+    zmtp_mtrie_apply (zmtp_mtrie_t *self, zmtp_mtrie_apply_fn *fn, void *arg);
+
+//  Self test of this class
+void
+    zmtp_mtrie_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
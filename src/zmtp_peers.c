@@ -0,0 +1,855 @@
+/*  =========================================================================
+    zmtp_peers - set of peer connections
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Holds the connections of a socket that talks to many peers, and finds
+//  out which of them have input with one poller, so that the cost of a
+//  wait goes with the number of ready peers, not the number of peers.
+//  Accepted connections do their handshake in the same poller, without
+//  blocking, and become peers once it is done; a client that connects
+//  and then says nothing holds up nobody, and is dropped after
+//  ZMTP_LISTENER_HANDSHAKE_IVL.
+
+#include "zmtp_classes.h"
+#include <poll.h>
+
+//  Events taken from the poller at once
+#define ZMTP_PEERS_EVENTS 64
+
+//  A connection whose handshake is under way
+
+struct pending {
+    zmtp_channel_t *channel;    //  NULL once done with
+    int64_t deadline;           //  When we give up on it
+};
+
+//  Structure of our class
+
+struct _zmtp_peers_t {
+    bool nonblocking;           //  Switch peers to non-blocking mode
+    zmtp_poller_t *poller;      //  Polls listeners and peers
+    zmtp_listener_t **listeners;    //  Bound endpoints
+    size_t nlisteners;          //  Number of listeners
+    zmtp_channel_t **channels;  //  Peers
+    size_t nchannels;           //  Number of peers
+    size_t max_channels;        //  Allocated size of channels array
+    zmtp_channel_t *ready [ZMTP_PEERS_EVENTS + 1];
+    size_t ready_head;          //  Next ready peer to return
+    size_t ready_tail;          //  End of ready peers
+    zmtp_channel_t *current;    //  Peer returned last
+    zmtp_channel_t *reading;    //  Peer of message in progress
+    struct pending **pending;   //  Handshakes, oldest first
+    size_t pending_head;        //  First handshake not yet dropped
+    size_t pending_tail;        //  End of handshakes
+    size_t max_pending;         //  Allocated size of pending array
+    zmtp_hashmap_t *handshakes; //  Handshakes under way, by channel
+    zmtp_peers_fn *connect_fn;  //  Called for new peers
+    void *connect_arg;          //  Argument for connect_fn
+    zmtp_peers_fn *disconnect_fn;   //  Called for peers going away
+    void *disconnect_arg;       //  Argument for disconnect_fn
+};
+
+static int
+    s_poll (zmtp_peers_t *self, int timeout);
+static void
+    s_accept (zmtp_peers_t *self, zmtp_listener_t *listener);
+static void
+    s_handshake (zmtp_peers_t *self, struct pending *pending);
+static void
+    s_expire (zmtp_peers_t *self);
+static bool
+    s_is_listener (zmtp_peers_t *self, void *arg);
+static zmtp_channel_t *
+    s_sole (zmtp_peers_t *self);
+static void
+    s_push_ready (zmtp_peers_t *self, zmtp_channel_t *channel);
+static int
+    s_wait_input (zmtp_channel_t *channel);
+static int64_t
+    s_clock (void);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_peers_t *
+zmtp_peers_new (bool nonblocking)
+{
+    zmtp_peers_t *self = (zmtp_peers_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->nonblocking = nonblocking;
+    self->poller = zmtp_poller_new ();
+    if (!self->poller) {
+        free (self);
+        return NULL;
+    }
+    self->handshakes = zmtp_hashmap_new ();
+    assert (self->handshakes);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; closes all peers and listeners
+
+void
+zmtp_peers_destroy (zmtp_peers_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_peers_t *self = *self_p;
+        for (size_t index = 0; index < self->nchannels; index++) {
+            if (self->disconnect_fn)
+                self->disconnect_fn (
+                    self->channels [index], self->disconnect_arg);
+            zmtp_channel_destroy (&self->channels [index]);
+        }
+        free (self->channels);
+        for (size_t index = 0; index < self->nlisteners; index++)
+            zmtp_listener_destroy (&self->listeners [index]);
+        free (self->listeners);
+        for (size_t index = self->pending_head;
+                    index < self->pending_tail; index++) {
+            zmtp_channel_destroy (&self->pending [index]->channel);
+            free (self->pending [index]);
+        }
+        free (self->pending);
+        zmtp_hashmap_destroy (&self->handshakes);
+        zmtp_poller_destroy (&self->poller);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Have fn called for each new peer, connected or accepted
+
+void
+zmtp_peers_set_connect_fn (zmtp_peers_t *self, zmtp_peers_fn *fn, void *arg)
+{
+    assert (self);
+    self->connect_fn = fn;
+    self->connect_arg = arg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Have fn called for each peer before it is closed
+
+void
+zmtp_peers_set_disconnect_fn (zmtp_peers_t *self,
+                              zmtp_peers_fn *fn, void *arg)
+{
+    assert (self);
+    self->disconnect_fn = fn;
+    self->disconnect_arg = arg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Listen on endpoint; connections are accepted by zmtp_peers_wait.
+//  Returns 0 if OK, -1 on error.
+
+int
+zmtp_peers_bind (zmtp_peers_t *self, const char *endpoint_str)
+{
+    assert (self);
+    assert (endpoint_str);
+
+    zmtp_listener_t *listener = zmtp_listener_new (endpoint_str, 0);
+    if (!listener)
+        return -1;
+    if (zmtp_poller_add_fd (self->poller,
+            zmtp_listener_fd (listener), ZMTP_POLLIN, listener) == -1) {
+        zmtp_listener_destroy (&listener);
+        return -1;
+    }
+    self->listeners = (zmtp_listener_t **) realloc (self->listeners,
+        (self->nlisteners + 1) * sizeof *self->listeners);
+    assert (self->listeners);   //  For now, memory exhaustion is fatal
+    self->listeners [self->nlisteners++] = listener;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to endpoint and add the channel as a peer. Returns the channel,
+//  or NULL on error.
+
+zmtp_channel_t *
+zmtp_peers_connect (zmtp_peers_t *self, const char *endpoint_str)
+{
+    assert (self);
+    assert (endpoint_str);
+
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    if (zmtp_channel_connect (channel, endpoint_str) == -1
+    ||  zmtp_peers_add (self, channel) == -1) {
+        zmtp_channel_destroy (&channel);
+        return NULL;
+    }
+    return channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add negotiated channel as a peer, which we then own. Returns 0 if OK,
+//  -1 on error, leaving the channel to the caller.
+
+int
+zmtp_peers_add (zmtp_peers_t *self, zmtp_channel_t *channel)
+{
+    assert (self);
+    assert (channel);
+
+    if (self->nonblocking
+    &&  zmtp_channel_set_nonblocking (channel, true) == -1)
+        return -1;
+    if (zmtp_poller_add_fd (self->poller,
+            zmtp_channel_fd (channel), ZMTP_POLLIN, channel) == -1)
+        return -1;
+    if (self->nchannels == self->max_channels) {
+        self->max_channels = self->max_channels? 2 * self->max_channels: 16;
+        self->channels = (zmtp_channel_t **) realloc (self->channels,
+            self->max_channels * sizeof *self->channels);
+        assert (self->channels);    //  For now, memory exhaustion is fatal
+    }
+    self->channels [self->nchannels++] = channel;
+    //  Data that came in with the handshake does not signal the handle
+    if (zmtp_channel_has_input (channel))
+        s_push_ready (self, channel);
+    if (self->connect_fn)
+        self->connect_fn (channel, self->connect_arg);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Switch peer to the given I/O engine, which may change its handle.
+//  Returns 0 if OK, -1 if not supported.
+
+int
+zmtp_peers_set_engine (zmtp_peers_t *self,
+                       zmtp_channel_t *channel, int engine)
+{
+    assert (self);
+    assert (channel);
+
+    const int fd = zmtp_channel_fd (channel);
+    if (zmtp_channel_set_engine (channel, engine) == -1)
+        return -1;
+    if (zmtp_channel_fd (channel) != fd) {
+        zmtp_poller_remove_fd (self->poller, fd);
+        if (zmtp_poller_add_fd (self->poller,
+                zmtp_channel_fd (channel), ZMTP_POLLIN, channel) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Close peer and forget it
+
+void
+zmtp_peers_remove (zmtp_peers_t *self, zmtp_channel_t *channel)
+{
+    assert (self);
+    assert (channel);
+
+    size_t index;
+    for (index = 0; index < self->nchannels; index++)
+        if (self->channels [index] == channel)
+            break;
+    assert (index < self->nchannels);
+    self->channels [index] = self->channels [--self->nchannels];
+
+    size_t kept = self->ready_head;
+    for (index = self->ready_head; index < self->ready_tail; index++)
+        if (self->ready [index] != channel)
+            self->ready [kept++] = self->ready [index];
+    self->ready_tail = kept;
+    if (self->current == channel)
+        self->current = NULL;
+    if (self->reading == channel)
+        self->reading = NULL;
+    if (self->disconnect_fn)
+        self->disconnect_fn (channel, self->disconnect_arg);
+
+    zmtp_poller_remove_fd (self->poller, zmtp_channel_fd (channel));
+    zmtp_channel_destroy (&channel);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of peers
+
+size_t
+zmtp_peers_size (zmtp_peers_t *self)
+{
+    assert (self);
+    return self->nchannels;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return peer at index
+
+zmtp_channel_t *
+zmtp_peers_get (zmtp_peers_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->nchannels);
+    return self->channels [index];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if listening on any endpoint
+
+bool
+zmtp_peers_listening (zmtp_peers_t *self)
+{
+    assert (self);
+    return self->nlisteners > 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a handle that becomes readable when a peer may have input or a
+//  connection is waiting, and stays the same while peers come and go; -1
+//  if the platform has none
+
+int
+zmtp_peers_fd (zmtp_peers_t *self)
+{
+    assert (self);
+    return zmtp_poller_fd (self->poller);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if a peer has input that its handle will not signal, as it
+//  is buffered already. Does no system calls.
+
+bool
+zmtp_peers_has_input (zmtp_peers_t *self)
+{
+    assert (self);
+    //  A sole peer is read without going through the ready list
+    zmtp_channel_t *sole = s_sole (self);
+    if (sole)
+        return zmtp_channel_has_input (sole);
+    //  Only peers we have read from can have input buffered
+    if (self->ready_head < self->ready_tail)
+        return true;
+    if (self->reading && zmtp_channel_has_input (self->reading))
+        return true;
+    return self->current && zmtp_channel_has_input (self->current);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept waiting connections and find peers with input, without waiting.
+//  Returns true if a peer has input.
+
+bool
+zmtp_peers_poll_input (zmtp_peers_t *self)
+{
+    assert (self);
+    if (zmtp_peers_has_input (self))
+        return true;
+    self->ready_head = self->ready_tail = 0;
+    if (s_poll (self, 0) == -1)
+        return false;
+    const bool ready = self->ready_tail > 0;
+    if (s_sole (self))
+        //  The list would go stale, as nothing takes peers off it
+        self->ready_tail = 0;
+    return ready;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 for ever) for a peer with input or an
+//  error, accepting new connections meanwhile. Returns the peer, or NULL
+//  with errno set to EAGAIN on timeout, or another value on error.
+
+zmtp_channel_t *
+zmtp_peers_wait (zmtp_peers_t *self, int timeout)
+{
+    assert (self);
+
+    //  The handle of the peer returned last does not signal input that
+    //  is already buffered, so we check for that ourselves
+    zmtp_channel_t *buffered = NULL;
+    if (self->current && zmtp_channel_has_input (self->current))
+        buffered = self->current;
+    self->current = NULL;
+
+    if (self->ready_head == self->ready_tail) {
+        self->ready_head = self->ready_tail = 0;
+        const int64_t deadline = timeout > 0? s_clock () + timeout: 0;
+        while (true) {
+            int wait = buffered || timeout == 0? 0: timeout;
+            if (timeout > 0) {
+                const int64_t left = deadline - s_clock ();
+                wait = buffered || left < 0? 0: (int) left;
+            }
+            if (s_poll (self, wait) == -1)
+                return NULL;
+            if (buffered)
+                s_push_ready (self, buffered);
+            if (self->ready_tail > 0)
+                break;
+            if (wait == 0) {
+                errno = EAGAIN;
+                return NULL;
+            }
+        }
+    }
+    else
+    if (buffered)
+        s_push_ready (self, buffered);
+
+    self->current = self->ready [self->ready_head++];
+    return self->current;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 for ever) until there is at least one
+//  peer, accepting new connections meanwhile. Returns 0 once there is a
+//  peer, or -1 with errno set to EAGAIN on timeout, ENOTCONN if none can
+//  come, or another value on error.
+
+int
+zmtp_peers_await (zmtp_peers_t *self, int timeout)
+{
+    assert (self);
+
+    const int64_t deadline = timeout > 0? s_clock () + timeout: 0;
+    while (self->nchannels == 0) {
+        if (self->nlisteners == 0) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        int wait = timeout;
+        if (timeout > 0) {
+            const int64_t left = deadline - s_clock ();
+            wait = left < 0? 0: (int) left;
+        }
+        if (s_poll (self, wait) == -1)
+            return -1;
+        if (self->nchannels == 0 && wait == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive the next frame from any peer, taking peers in turn between
+//  messages. Returns NULL on error.
+
+zmtp_msg_t *
+zmtp_peers_recv (zmtp_peers_t *self, zmtp_channel_t **channel_p)
+{
+    assert (self);
+
+    while (true) {
+        //  With one peer and nobody to come, there is nobody to be fair to
+        //  and we skip the poller
+        zmtp_channel_t *channel = self->reading? self->reading: s_sole (self);
+        if (!channel) {
+            if (self->nchannels == 0 && self->nlisteners == 0) {
+                errno = ENOTCONN;
+                return NULL;
+            }
+            channel = zmtp_peers_wait (self, -1);
+            if (!channel)
+                return NULL;
+        }
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        if (!msg && errno == EAGAIN) {
+            //  Non-blocking peer; the rest of its message is on its way,
+            //  or it is our only peer
+            if ((self->reading || s_sole (self))
+            &&  s_wait_input (channel) == -1)
+                return NULL;
+            continue;
+        }
+        if (!msg && (errno == EMSGSIZE || errno == EBUSY)) {
+            //  Frame refused; the peer is fine, and a message that was
+            //  skipped is over
+            if (errno == EMSGSIZE)
+                self->reading = NULL;
+            return NULL;
+        }
+        if (!msg) {
+            const int error = errno;
+            const bool truncated = self->reading != NULL;
+            zmtp_peers_remove (self, channel);
+            if (truncated) {
+                errno = error;
+                return NULL;
+            }
+            continue;
+        }
+        self->reading = zmtp_msg_flags (msg) & ZMTP_MSG_MORE? channel: NULL;
+        if (channel_p)
+            *channel_p = channel;
+        return msg;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive up to max frames into the out array, as zmtp_peers_recv does.
+//  Blocks only for the first frame; takes more while it is still the same
+//  peer's turn and they are buffered. Returns the number of frames, or -1
+//  on error.
+
+ssize_t
+zmtp_peers_recv_batch (zmtp_peers_t *self, zmtp_msg_t **out, size_t max)
+{
+    assert (self);
+    assert (out);
+
+    if (max == 0)
+        return 0;
+    zmtp_channel_t *channel;
+    out [0] = zmtp_peers_recv (self, &channel);
+    if (!out [0])
+        return -1;
+    size_t count = 1;
+    while (count < max
+    &&    (self->reading == channel || s_sole (self) == channel)
+    &&     zmtp_channel_has_input (channel)) {
+        //  An error here shows up on the next call
+        out [count] = zmtp_peers_recv (self, NULL);
+        if (!out [count])
+            break;
+        count++;
+    }
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the peer whose message zmtp_peers_recv is in the middle of, or
+//  NULL if the next frame starts a message
+
+zmtp_channel_t *
+zmtp_peers_reading (zmtp_peers_t *self)
+{
+    assert (self);
+    return self->reading;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs for events, accepting new connections and
+//  adding peers with input or errors to the ready list. Returns 0 if OK,
+//  -1 on error.
+
+static int
+s_poll (zmtp_peers_t *self, int timeout)
+{
+    //  We wake up in time to drop the oldest handshake
+    s_expire (self);
+    if (self->pending_head < self->pending_tail) {
+        const int64_t left =
+            self->pending [self->pending_head]->deadline - s_clock ();
+        if (timeout == -1 || left < timeout)
+            timeout = left < 0? 0: (int) left;
+    }
+    zmtp_poller_event_t events [ZMTP_PEERS_EVENTS];
+    const int count = zmtp_poller_wait (
+        self->poller, events, ZMTP_PEERS_EVENTS, timeout);
+    if (count == -1)
+        return -1;
+    for (int index = 0; index < count; index++) {
+        void *arg = events [index].arg;
+        struct pending *pending = NULL;
+        if (zmtp_hashmap_size (self->handshakes) > 0)
+            pending = (struct pending *) zmtp_hashmap_lookup (
+                self->handshakes, &arg, sizeof arg);
+        if (pending)
+            s_handshake (self, pending);
+        else
+        if (s_is_listener (self, arg))
+            s_accept (self, (zmtp_listener_t *) arg);
+        else
+            s_push_ready (self, (zmtp_channel_t *) arg);
+    }
+    s_expire (self);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start the handshake of connections waiting on listener
+
+static void
+s_accept (zmtp_peers_t *self, zmtp_listener_t *listener)
+{
+    zmtp_channel_t *channels [16];
+    const ssize_t count = zmtp_listener_accept_nowait (listener, channels, 16);
+    const int64_t deadline = s_clock () + ZMTP_LISTENER_HANDSHAKE_IVL;
+    for (ssize_t index = 0; index < count; index++) {
+        zmtp_channel_t *channel = channels [index];
+        if (zmtp_poller_add_fd (self->poller,
+                zmtp_channel_fd (channel), ZMTP_POLLIN, channel) == -1) {
+            zmtp_channel_destroy (&channel);
+            continue;
+        }
+        if (self->pending_tail == self->max_pending) {
+            if (self->pending_head > 0) {
+                memmove (self->pending, self->pending + self->pending_head,
+                    (self->pending_tail - self->pending_head)
+                    * sizeof *self->pending);
+                self->pending_tail -= self->pending_head;
+                self->pending_head = 0;
+            }
+            else {
+                self->max_pending = self->max_pending?
+                    2 * self->max_pending: 16;
+                self->pending = (struct pending **) realloc (self->pending,
+                    self->max_pending * sizeof *self->pending);
+                assert (self->pending); //  For now, memory exhaustion is fatal
+            }
+        }
+        struct pending *pending =
+            (struct pending *) zmalloc (sizeof *pending);
+        assert (pending);       //  For now, memory exhaustion is fatal
+        pending->channel = channel;
+        pending->deadline = deadline;
+        self->pending [self->pending_tail++] = pending;
+        const int rc = zmtp_hashmap_insert (
+            self->handshakes, &channel, sizeof channel, pending);
+        assert (rc == 0);
+        //  The greeting may be here already
+        s_handshake (self, pending);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take what the peer of a pending handshake has sent, and add it as a
+//  peer once the handshake is done, or drop it if that failed
+
+static void
+s_handshake (zmtp_peers_t *self, struct pending *pending)
+{
+    zmtp_channel_t *channel = pending->channel;
+    int rc = zmtp_channel_handshake (channel);
+    if (rc == -1 && errno == EAGAIN)
+        return;
+
+    zmtp_poller_remove_fd (self->poller, zmtp_channel_fd (channel));
+    zmtp_hashmap_delete (self->handshakes, &channel, sizeof channel);
+    pending->channel = NULL;
+    if (rc == 0 && !self->nonblocking)
+        rc = zmtp_channel_set_nonblocking (channel, false);
+    if (rc == 0)
+        rc = zmtp_peers_add (self, channel);
+    if (rc == -1)
+        zmtp_channel_destroy (&channel);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget handshakes that are done from the front of the list, and drop
+//  those that took too long
+
+static void
+s_expire (zmtp_peers_t *self)
+{
+    if (self->pending_head == self->pending_tail)
+        return;
+    const int64_t now = s_clock ();
+    while (self->pending_head < self->pending_tail) {
+        struct pending *pending = self->pending [self->pending_head];
+        zmtp_channel_t *channel = pending->channel;
+        if (channel && pending->deadline > now)
+            break;
+        if (channel) {
+            zmtp_poller_remove_fd (self->poller, zmtp_channel_fd (channel));
+            zmtp_hashmap_delete (self->handshakes, &channel, sizeof channel);
+            zmtp_channel_destroy (&channel);
+        }
+        free (pending);
+        self->pending_head++;
+    }
+    if (self->pending_head == self->pending_tail)
+        self->pending_head = self->pending_tail = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if poller argument is one of our listeners
+
+static bool
+s_is_listener (zmtp_peers_t *self, void *arg)
+{
+    for (size_t index = 0; index < self->nlisteners; index++)
+        if (self->listeners [index] == arg)
+            return true;
+    return false;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return our only peer if no others can come, else NULL
+
+static zmtp_channel_t *
+s_sole (zmtp_peers_t *self)
+{
+    return self->nchannels == 1 && self->nlisteners == 0?
+        self->channels [0]: NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append peer to the ready list unless it is there already
+
+static void
+s_push_ready (zmtp_peers_t *self, zmtp_channel_t *channel)
+{
+    for (size_t index = self->ready_head; index < self->ready_tail; index++)
+        if (self->ready [index] == channel)
+            return;
+    if (self->ready_tail == ZMTP_PEERS_EVENTS + 1) {
+        //  There is room at the front once any peer was returned
+        assert (self->ready_head > 0);
+        memmove (self->ready, self->ready + self->ready_head,
+            (self->ready_tail - self->ready_head) * sizeof *self->ready);
+        self->ready_tail -= self->ready_head;
+        self->ready_head = 0;
+    }
+    self->ready [self->ready_tail++] = channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait until channel has more input. Returns 0 if OK, -1 on error.
+
+static int
+s_wait_input (zmtp_channel_t *channel)
+{
+    struct pollfd item = { .fd = zmtp_channel_fd (channel), .events = POLLIN };
+    return poll (&item, 1, -1) == -1? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return monotonic time in msecs
+
+static int64_t
+s_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_test_peer (void *arg)
+{
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    assert (channel);
+    while (zmtp_channel_connect (channel, "ipc://@zmtp-peers-test") == -1)
+        usleep (10000);
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    int rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    //  Wait until the other side is done with us
+    msg = zmtp_channel_recv (channel);
+    assert (msg == NULL);
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+static void
+s_test_connected (zmtp_channel_t *channel, void *arg)
+{
+    (*(int *) arg)++;
+}
+
+void
+zmtp_peers_test (bool verbose)
+{
+    printf (" * zmtp_peers: ");
+    //  @selftest
+    zmtp_peers_t *peers = zmtp_peers_new (true);
+    assert (peers);
+    int connected = 0;
+    zmtp_peers_set_connect_fn (peers, s_test_connected, &connected);
+    int rc = zmtp_peers_bind (peers, "ipc://@zmtp-peers-test");
+    assert (rc == 0);
+    assert (zmtp_peers_listening (peers));
+    zmtp_channel_t *channel = zmtp_peers_wait (peers, 0);
+    assert (channel == NULL && errno == EAGAIN);
+
+    //  A client that never greets us does not hold up the others
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_new ("ipc://@zmtp-peers-test");
+    assert (endpoint);
+    const int silent = zmtp_endpoint_connect (endpoint, -1);
+    assert (silent != -1);
+    zmtp_endpoint_destroy (&endpoint);
+    channel = zmtp_peers_wait (peers, 100);
+    assert (channel == NULL && errno == EAGAIN);
+
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_test_peer, NULL);
+    channel = zmtp_peers_wait (peers, 5000);
+    assert (channel);
+    assert (connected == 1);
+    assert (zmtp_peers_size (peers) == 1);
+    assert (zmtp_peers_get (peers, 0) == channel);
+
+    //  Both messages come through, whether buffered or not
+    int received = 0;
+    while (received < 2) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        if (msg) {
+            assert (zmtp_msg_size (msg) == 5);
+            zmtp_msg_destroy (&msg);
+            received++;
+        }
+        else {
+            assert (errno == EAGAIN);
+            channel = zmtp_peers_wait (peers, 5000);
+            assert (channel);
+        }
+    }
+    zmtp_peers_remove (peers, channel);
+    assert (zmtp_peers_size (peers) == 0);
+    pthread_join (thread, NULL);
+    close (silent);
+    zmtp_peers_destroy (&peers);
+    assert (peers == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,149 @@
+/*  =========================================================================
+    zmtp_peers - set of peer connections
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_PEERS_H_INCLUDED__
+#define __ZMTP_PEERS_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_peers_t zmtp_peers_t;
+
+//  Called for each new peer, once it is negotiated, and for each peer
+//  about to be closed
+typedef void (zmtp_peers_fn) (zmtp_channel_t *channel, void *arg);
+
+//  @interface
+//  Constructor. Peer channels are switched to non-blocking mode if so
+//  asked.
+zmtp_peers_t *
+    zmtp_peers_new (bool nonblocking);
+
+//  Destructor; closes all peers and listeners
+void
+    zmtp_peers_destroy (zmtp_peers_t **self_p);
+
+//  Have fn called for each new peer, connected or accepted
+void
+    zmtp_peers_set_connect_fn (zmtp_peers_t *self,
+                               zmtp_peers_fn *fn, void *arg);
+
+//  Have fn called for each peer before it is closed, whether by
+//  zmtp_peers_remove, zmtp_peers_recv, or the destructor
+void
+    zmtp_peers_set_disconnect_fn (zmtp_peers_t *self,
+                                  zmtp_peers_fn *fn, void *arg);
+
+//  Listen on endpoint; connections are accepted by zmtp_peers_wait.
+//  Returns 0 if OK, -1 on error.
+int
+    zmtp_peers_bind (zmtp_peers_t *self, const char *endpoint_str);
+
+//  Connect to endpoint and add the channel as a peer. Returns the
+//  channel, or NULL on error.
+zmtp_channel_t *
+    zmtp_peers_connect (zmtp_peers_t *self, const char *endpoint_str);
+
+//  Add negotiated channel as a peer, which we then own. Returns 0 if OK,
+//  -1 on error, leaving the channel to the caller.
+int
+    zmtp_peers_add (zmtp_peers_t *self, zmtp_channel_t *channel);
+
+//  Switch peer to the given I/O engine, which may change its handle.
+//  Returns 0 if OK, -1 if not supported.
+int
+    zmtp_peers_set_engine (zmtp_peers_t *self,
+                           zmtp_channel_t *channel, int engine);
+
+//  Close peer and forget it
+void
+    zmtp_peers_remove (zmtp_peers_t *self, zmtp_channel_t *channel);
+
+//  Return number of peers
+size_t
+    zmtp_peers_size (zmtp_peers_t *self);
+
+//  Return peer at index, in order of arrival except that removing a peer
+//  moves the last one into its place
+zmtp_channel_t *
+    zmtp_peers_get (zmtp_peers_t *self, size_t index);
+
+//  Return true if listening on any endpoint
+bool
+    zmtp_peers_listening (zmtp_peers_t *self);
+
+//  Return a handle that becomes readable when a peer may have input or a
+//  connection is waiting, and stays the same while peers come and go; -1
+//  if the platform has none
+int
+    zmtp_peers_fd (zmtp_peers_t *self);
+
+//  Return true if a peer has input that its handle will not signal, as it
+//  is buffered already. Does no system calls.
+bool
+    zmtp_peers_has_input (zmtp_peers_t *self);
+
+//  Accept waiting connections and find peers with input, without waiting.
+//  Returns true if a peer has input.
+bool
+    zmtp_peers_poll_input (zmtp_peers_t *self);
+
+//  Wait up to timeout msecs (-1 for ever) for a peer with input or an
+//  error, accepting new connections meanwhile. Peers that are ready
+//  together are returned in turn; a peer that still has input after it
+//  was returned goes behind them. Returns the peer, or NULL with errno
+//  set to EAGAIN on timeout, or another value on error.
+zmtp_channel_t *
+    zmtp_peers_wait (zmtp_peers_t *self, int timeout);
+
+//  Wait up to timeout msecs (-1 for ever) until there is at least one
+//  peer, accepting new connections meanwhile. Returns 0 once there is a
+//  peer, or -1 with errno set to EAGAIN on timeout, ENOTCONN if none can
+//  come, or another value on error.
+int
+    zmtp_peers_await (zmtp_peers_t *self, int timeout);
+
+//  Receive the next frame from any peer, taking peers in turn between
+//  messages and staying with one peer until its message is complete.
+//  Waits as long as it takes. Closes peers that fail between messages.
+//  Stores the peer of the frame in channel_p, if not NULL. Returns NULL
+//  on error, including when the peer fails in the middle of a message,
+//  with errno set to ENOTCONN if there are no peers and none can come.
+//  A frame the peer refuses (EMSGSIZE) fails the call but keeps the peer.
+zmtp_msg_t *
+    zmtp_peers_recv (zmtp_peers_t *self, zmtp_channel_t **channel_p);
+
+//  Receive up to max frames into the out array, as zmtp_peers_recv does.
+//  Blocks only for the first frame; takes more while it is still the same
+//  peer's turn and they are buffered. Returns the number of frames, or -1
+//  on error.
+ssize_t
+    zmtp_peers_recv_batch (zmtp_peers_t *self,
+                           zmtp_msg_t **out, size_t max);
+
+//  Return the peer whose message zmtp_peers_recv is in the middle of, or
+//  NULL if the next frame starts a message
+zmtp_channel_t *
+    zmtp_peers_reading (zmtp_peers_t *self);
+
+//  Self test of this class
+void
+    zmtp_peers_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,587 @@
+/*  =========================================================================
+    zmtp_poller - poller class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#if defined (__UTYPE_LINUX)
+#   include <sys/epoll.h>
+#else
+#   include <poll.h>
+#endif
+
+//  Plain descriptors are indexed by descriptor, so that registering and
+//  unregistering one does not go through all of them, and a wait costs
+//  what the ready events cost. Dealers are few and are kept on their own
+//  list, as each wait has to ask them for buffered input. A dealer is
+//  polled through its own descriptor, which stays the same while its
+//  peers come and go.
+
+//  How often we look again at a dealer that waits for room to send, in
+//  msecs, as nothing signals that
+#define ZMTP_POLLER_RETRY_IVL 10
+
+//  Registered socket or file descriptor
+
+struct poller_item {
+    int fd;                     //  Descriptor to wait on
+    zmtp_dealer_t *dealer;      //  Dealer, or NULL for plain descriptors
+    int events;                 //  Events we are interested in
+    void *arg;                  //  Reported back to caller
+    size_t index;               //  Position in items or dealers array
+};
+
+//  Structure of our class
+
+struct _zmtp_poller_t {
+#if defined (__UTYPE_LINUX)
+    int epoll_fd;               //  Kernel event poll set
+#endif
+    struct poller_item **items; //  Registered descriptors
+    size_t nitems;              //  Number of registered descriptors
+    size_t max_items;           //  Allocated size of items array
+    zmtp_hashmap_t *items_by_fd;    //  Registered descriptors, by fd
+    struct poller_item **dealers;   //  Registered dealers
+    size_t ndealers;            //  Number of registered dealers
+    size_t max_dealers;         //  Allocated size of dealers array
+};
+
+static int
+    s_add (zmtp_poller_t *self, struct poller_item ***items_p,
+           size_t *count_p, size_t *max_p, struct poller_item *item);
+static void
+    s_remove (zmtp_poller_t *self, struct poller_item **items,
+              size_t *count_p, struct poller_item *item);
+static int
+    s_wait (zmtp_poller_t *self,
+            zmtp_poller_event_t *events, int *count, int max, int timeout);
+static void
+    s_report_dealer (zmtp_poller_event_t *events, int *count,
+                     struct poller_item *item);
+static int64_t
+    s_clock (void);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_poller_t *
+zmtp_poller_new (void)
+{
+    zmtp_poller_t *self = (zmtp_poller_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+#if defined (__UTYPE_LINUX)
+    self->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (self->epoll_fd == -1) {
+        free (self);
+        return NULL;
+    }
+#endif
+    self->items_by_fd = zmtp_hashmap_new ();
+    assert (self->items_by_fd);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; does not touch the registered sockets
+
+void
+zmtp_poller_destroy (zmtp_poller_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_poller_t *self = *self_p;
+        for (size_t index = 0; index < self->nitems; index++)
+            free (self->items [index]);
+        free (self->items);
+        for (size_t index = 0; index < self->ndealers; index++)
+            free (self->dealers [index]);
+        free (self->dealers);
+        zmtp_hashmap_destroy (&self->items_by_fd);
+#if defined (__UTYPE_LINUX)
+        close (self->epoll_fd);
+#endif
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Register a dealer socket for the given events. The arg is reported
+//  back with each event. Returns 0 if OK, -1 on error.
+
+int
+zmtp_poller_add_dealer (zmtp_poller_t *self, zmtp_dealer_t *dealer,
+                        int events, void *arg)
+{
+    assert (self);
+    assert (dealer);
+
+    for (size_t index = 0; index < self->ndealers; index++)
+        if (self->dealers [index]->dealer == dealer)
+            return -1;
+
+    //  Messages may sit in the read-ahead buffer, so we cannot rely on
+    //  edges and always poll dealers level-triggered. The descriptor only
+    //  tells us to ask the dealer; it says nothing about room to send.
+    struct poller_item *item = (struct poller_item *) zmalloc (sizeof *item);
+    assert (item);              //  For now, memory exhaustion is fatal
+    *item = (struct poller_item) {
+        .dealer = dealer, .events = events & ~ZMTP_POLLET, .arg = arg
+    };
+#if defined (__UTYPE_LINUX)
+    item->fd = zmtp_dealer_fd (dealer);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = item };
+    if (item->fd == -1
+    ||  epoll_ctl (self->epoll_fd, EPOLL_CTL_ADD, item->fd, &event) == -1) {
+        free (item);
+        return -1;
+    }
+#else
+    //  Looked up on each wait, as it changes with the dealer's peers
+    item->fd = -1;
+#endif
+    if (s_add (self, &self->dealers,
+               &self->ndealers, &self->max_dealers, item) == -1) {
+#if defined (__UTYPE_LINUX)
+        epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, item->fd, NULL);
+#endif
+        free (item);
+        return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop polling a dealer socket. Returns 0 if OK, -1 if not registered.
+
+int
+zmtp_poller_remove_dealer (zmtp_poller_t *self, zmtp_dealer_t *dealer)
+{
+    assert (self);
+    assert (dealer);
+
+    for (size_t index = 0; index < self->ndealers; index++)
+        if (self->dealers [index]->dealer == dealer) {
+            s_remove (self, self->dealers,
+                      &self->ndealers, self->dealers [index]);
+            return 0;
+        }
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Register a file descriptor for the given events. Add ZMTP_POLLET to
+//  have the descriptor reported only when it becomes ready. Returns 0 if
+//  OK, -1 on error.
+
+int
+zmtp_poller_add_fd (zmtp_poller_t *self, int fd, int events, void *arg)
+{
+    assert (self);
+    if (fd == -1 || zmtp_hashmap_lookup (self->items_by_fd, &fd, sizeof fd))
+        return -1;
+
+    struct poller_item *item = (struct poller_item *) zmalloc (sizeof *item);
+    assert (item);              //  For now, memory exhaustion is fatal
+    *item = (struct poller_item) { .fd = fd, .events = events, .arg = arg };
+#if defined (__UTYPE_LINUX)
+    struct epoll_event event = { .data.ptr = item };
+    if (events & ZMTP_POLLIN)
+        event.events |= EPOLLIN;
+    if (events & ZMTP_POLLOUT)
+        event.events |= EPOLLOUT;
+    if (events & ZMTP_POLLET)
+        event.events |= EPOLLET;
+    if (epoll_ctl (self->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        free (item);
+        return -1;
+    }
+#endif
+    if (s_add (self, &self->items,
+               &self->nitems, &self->max_items, item) == -1) {
+#if defined (__UTYPE_LINUX)
+        epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+        free (item);
+        return -1;
+    }
+    const int rc =
+        zmtp_hashmap_insert (self->items_by_fd, &fd, sizeof fd, item);
+    assert (rc == 0);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop polling a file descriptor. Returns 0 if OK, -1 if not registered.
+
+int
+zmtp_poller_remove_fd (zmtp_poller_t *self, int fd)
+{
+    assert (self);
+
+    struct poller_item *item = (struct poller_item *)
+        zmtp_hashmap_lookup (self->items_by_fd, &fd, sizeof fd);
+    if (!item)
+        return -1;
+    zmtp_hashmap_delete (self->items_by_fd, &fd, sizeof fd);
+    s_remove (self, self->items, &self->nitems, item);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a descriptor that becomes readable when a registered item may
+//  be ready, so that the poller can be waited on by another; -1 if the
+//  platform has none
+
+int
+zmtp_poller_fd (zmtp_poller_t *self)
+{
+    assert (self);
+#if defined (__UTYPE_LINUX)
+    return self->epoll_fd;
+#else
+    return -1;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 for ever) until at least one registered
+//  item is ready, and store up to max events. Dealers with buffered
+//  messages are reported readable without waiting. Returns the number of
+//  events, 0 on timeout, or -1 on error (e.g. interrupted).
+
+int
+zmtp_poller_wait (zmtp_poller_t *self,
+                  zmtp_poller_event_t *events, int max, int timeout)
+{
+    assert (self);
+    assert (events);
+    assert (max > 0);
+
+    const int64_t deadline = timeout > 0? s_clock () + timeout: 0;
+    while (true) {
+        //  Report dealers that have input already buffered, or room to
+        //  send, and note those that wait for room
+        int count = 0;
+        bool blocked = false;
+        for (size_t index = 0;
+                    index < self->ndealers && count < max; index++) {
+            struct poller_item *item = self->dealers [index];
+            int revents = 0;
+            if ((item->events & ZMTP_POLLIN) == ZMTP_POLLIN
+            &&  zmtp_dealer_has_input (item->dealer))
+                revents |= ZMTP_POLLIN;
+            if ((item->events & ZMTP_POLLOUT) == ZMTP_POLLOUT) {
+                if (zmtp_dealer_events (item->dealer) & ZMTP_POLLOUT)
+                    revents |= ZMTP_POLLOUT;
+                else
+                    blocked = true;
+            }
+            if (revents) {
+                events [count].arg = item->arg;
+                events [count].events = revents;
+                count++;
+            }
+        }
+        if (count == max)
+            return count;
+
+        int wait = count > 0? 0: timeout;
+        if (count == 0 && timeout > 0) {
+            const int64_t left = deadline - s_clock ();
+            wait = left < 0? 0: (int) left;
+        }
+        if (blocked && (wait == -1 || wait > ZMTP_POLLER_RETRY_IVL))
+            wait = ZMTP_POLLER_RETRY_IVL;
+        if (s_wait (self, events, &count, max, wait) == -1)
+            return count > 0? count: -1;
+        //  A dealer may wake us for events that are not input, such as a
+        //  peer connecting
+        if (count > 0 || timeout == 0
+        || (timeout > 0 && s_clock () >= deadline))
+            return count;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add item to an array of items
+
+static int
+s_add (zmtp_poller_t *self, struct poller_item ***items_p,
+       size_t *count_p, size_t *max_p, struct poller_item *item)
+{
+    if (*count_p == *max_p) {
+        const size_t max_items = *max_p? 2 * *max_p: 16;
+        struct poller_item **items = (struct poller_item **)
+            realloc (*items_p, max_items * sizeof *items);
+        if (!items)
+            return -1;
+        *items_p = items;
+        *max_p = max_items;
+    }
+    item->index = *count_p;
+    (*items_p) [(*count_p)++] = item;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Unregister item, moving the last item of its array into its place
+
+static void
+s_remove (zmtp_poller_t *self, struct poller_item **items,
+          size_t *count_p, struct poller_item *item)
+{
+#if defined (__UTYPE_LINUX)
+    //  The descriptor may be closed already, which removed it from the set
+    epoll_ctl (self->epoll_fd, EPOLL_CTL_DEL, item->fd, NULL);
+#endif
+    struct poller_item *last = items [--*count_p];
+    items [item->index] = last;
+    last->index = item->index;
+    free (item);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs for descriptors, adding events after the
+//  count already stored. Returns 0 if OK, -1 on error.
+
+static int
+s_wait (zmtp_poller_t *self,
+        zmtp_poller_event_t *events, int *count, int max, int timeout)
+{
+#if defined (__UTYPE_LINUX)
+    struct epoll_event ready [max];
+    const int rc = epoll_wait (self->epoll_fd, ready, max - *count, timeout);
+    if (rc == -1)
+        return -1;
+
+    for (int index = 0; index < rc; index++) {
+        struct poller_item *item =
+            (struct poller_item *) ready [index].data.ptr;
+        if (item->dealer) {
+            s_report_dealer (events, count, item);
+            continue;
+        }
+        int revents = 0;
+        if (ready [index].events & EPOLLIN)
+            revents |= ZMTP_POLLIN;
+        if (ready [index].events & EPOLLOUT)
+            revents |= ZMTP_POLLOUT;
+        if (ready [index].events & (EPOLLERR | EPOLLHUP))
+            revents |= ZMTP_POLLERR;
+        events [*count].arg = item->arg;
+        events [*count].events = revents;
+        (*count)++;
+    }
+#else
+    const size_t total = self->nitems + self->ndealers;
+    struct pollfd pollfds [total];
+    for (size_t index = 0; index < self->nitems; index++) {
+        pollfds [index].fd = self->items [index]->fd;
+        pollfds [index].events = 0;
+        if (self->items [index]->events & ZMTP_POLLIN)
+            pollfds [index].events |= POLLIN;
+        if (self->items [index]->events & ZMTP_POLLOUT)
+            pollfds [index].events |= POLLOUT;
+    }
+    //  A dealer without a descriptor of its own is skipped, as poll
+    //  ignores negative descriptors
+    for (size_t index = 0; index < self->ndealers; index++) {
+        pollfds [self->nitems + index].fd =
+            zmtp_dealer_fd (self->dealers [index]->dealer);
+        pollfds [self->nitems + index].events = POLLIN;
+    }
+    const int rc = poll (pollfds, total, timeout);
+    if (rc == -1)
+        return -1;
+
+    for (size_t index = 0; index < self->nitems && *count < max; index++) {
+        int revents = 0;
+        if (pollfds [index].revents & POLLIN)
+            revents |= ZMTP_POLLIN;
+        if (pollfds [index].revents & POLLOUT)
+            revents |= ZMTP_POLLOUT;
+        if (pollfds [index].revents & (POLLERR | POLLHUP | POLLNVAL))
+            revents |= ZMTP_POLLERR;
+        if (revents) {
+            events [*count].arg = self->items [index]->arg;
+            events [*count].events = revents;
+            (*count)++;
+        }
+    }
+    for (size_t index = 0; index < self->ndealers && *count < max; index++)
+        if (pollfds [self->nitems + index].revents)
+            s_report_dealer (events, count, self->dealers [index]);
+#endif
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Ask a dealer whose descriptor is ready what it is ready for, and add
+//  that to the result array, merging with an event reported before the
+//  wait
+
+static void
+s_report_dealer (zmtp_poller_event_t *events, int *count,
+                 struct poller_item *item)
+{
+    const int revents = zmtp_dealer_events (item->dealer) & item->events;
+    if (revents == 0)
+        return;
+    for (int index = 0; index < *count; index++)
+        if (events [index].arg == item->arg) {
+            events [index].events |= revents;
+            return;
+        }
+    events [*count].arg = item->arg;
+    events [*count].events = revents;
+    (*count)++;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return monotonic time in msecs
+
+static int64_t
+s_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_dealer_peer (void *arg)
+{
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    int rc = zmtp_dealer_listen (dealer, "ipc://@zmtp-poller-test");
+    assert (rc == 0);
+
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    //  Wait for peer to finish
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    zmtp_msg_destroy (&msg);
+    zmtp_dealer_destroy (&dealer);
+    return NULL;
+}
+
+void
+zmtp_poller_test (bool verbose)
+{
+    printf (" * zmtp_poller: ");
+    //  @selftest
+    zmtp_poller_t *poller = zmtp_poller_new ();
+    assert (poller);
+    zmtp_poller_event_t events [4];
+
+    //  Plain file descriptors, level and edge triggered
+    int pipe_fds [2];
+    int rc = pipe (pipe_fds);
+    assert (rc == 0);
+    rc = zmtp_poller_add_fd (poller, pipe_fds [0], ZMTP_POLLIN, &pipe_fds [0]);
+    assert (rc == 0);
+    rc = zmtp_poller_add_fd (poller, pipe_fds [0], ZMTP_POLLIN, NULL);
+    assert (rc == -1);
+    rc = zmtp_poller_wait (poller, events, 4, 0);
+    assert (rc == 0);
+    rc = write (pipe_fds [1], "x", 1);
+    assert (rc == 1);
+    rc = zmtp_poller_wait (poller, events, 4, 1000);
+    assert (rc == 1);
+    assert (events [0].arg == &pipe_fds [0]);
+    assert (events [0].events == ZMTP_POLLIN);
+    rc = zmtp_poller_wait (poller, events, 4, 0);
+    assert (rc == 1);
+    rc = zmtp_poller_remove_fd (poller, pipe_fds [0]);
+    assert (rc == 0);
+    rc = zmtp_poller_remove_fd (poller, pipe_fds [0]);
+    assert (rc == -1);
+#if defined (__UTYPE_LINUX)
+    rc = zmtp_poller_add_fd (poller, pipe_fds [0],
+        ZMTP_POLLIN | ZMTP_POLLET, &pipe_fds [0]);
+    assert (rc == 0);
+    rc = zmtp_poller_wait (poller, events, 4, 0);
+    assert (rc == 1);
+    rc = zmtp_poller_wait (poller, events, 4, 0);
+    assert (rc == 0);
+    rc = zmtp_poller_remove_fd (poller, pipe_fds [0]);
+    assert (rc == 0);
+#endif
+    close (pipe_fds [0]);
+    close (pipe_fds [1]);
+
+    //  Dealer sockets
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_dealer_peer, NULL);
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    while (zmtp_dealer_connect (dealer, "ipc://@zmtp-poller-test") == -1)
+        usleep (10000);
+
+    rc = zmtp_poller_add_dealer (poller, dealer, ZMTP_POLLOUT, dealer);
+    assert (rc == 0);
+    rc = zmtp_poller_wait (poller, events, 4, 1000);
+    assert (rc == 1);
+    assert (events [0].arg == dealer);
+    assert (events [0].events == ZMTP_POLLOUT);
+    rc = zmtp_poller_remove_dealer (poller, dealer);
+    assert (rc == 0);
+
+    rc = zmtp_poller_add_dealer (poller, dealer, ZMTP_POLLIN, dealer);
+    assert (rc == 0);
+    for (int count = 0; count < 2; count++) {
+        rc = zmtp_poller_wait (poller, events, 4, 1000);
+        assert (rc == 1);
+        assert (events [0].arg == dealer);
+        assert (events [0].events == ZMTP_POLLIN);
+        zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 5);
+        zmtp_msg_destroy (&msg);
+    }
+    rc = zmtp_poller_wait (poller, events, 4, 0);
+    assert (rc == 0);
+
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "bye", 3);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+
+    zmtp_poller_destroy (&poller);
+    zmtp_dealer_destroy (&dealer);
+    //  @end
+    printf ("OK\n");
+}
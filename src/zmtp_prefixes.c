@@ -0,0 +1,381 @@
+/*  =========================================================================
+    zmtp_prefixes - set of short prefixes matched with vector compares
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Each prefix sits zero-padded in an aligned slot of ZMTP_PREFIXES_MAX
+//  bytes, next to a mask with one bit per prefix byte. Matching compares
+//  the first bytes of the message with a whole slot at once, and checks
+//  that the compare set all the bits of the mask. Where the CPU has no
+//  vector unit we know of, we compare byte by byte.
+
+#include "zmtp_classes.h"
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#   define ZMTP_PREFIXES_X86
+#   include <immintrin.h>
+#endif
+
+typedef size_t (match_fn) (zmtp_prefixes_t *self,
+    const byte *topic, size_t size, size_t *indexes, bool any);
+
+//  Structure of our class
+
+struct _zmtp_prefixes_t {
+    byte *slots;                //  Padded prefixes, aligned
+    uint32_t *masks;            //  Bit n set if prefix has byte n
+    byte *sizes;                //  Prefix sizes
+    size_t count;               //  Number of prefixes
+    size_t max_count;           //  Allocated number of slots
+    match_fn *match;            //  Selected implementation
+};
+
+static match_fn s_match_scalar;
+#if defined (ZMTP_PREFIXES_X86)
+static match_fn s_match_sse2;
+static match_fn s_match_avx2;
+#endif
+static size_t
+    s_match (zmtp_prefixes_t *self, const byte *data, size_t size,
+             size_t *indexes, bool any);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_prefixes_t *
+zmtp_prefixes_new (void)
+{
+    zmtp_prefixes_t *self = (zmtp_prefixes_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    zmtp_prefixes_set_impl (self, ZMTP_PREFIXES_AUTO);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_prefixes_destroy (zmtp_prefixes_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_prefixes_t *self = *self_p;
+        free (self->slots);
+        free (self->masks);
+        free (self->sizes);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add prefix of up to ZMTP_PREFIXES_MAX bytes to the set. Returns 0 if
+//  OK, -1 with errno set to EINVAL if the prefix is too long.
+
+int
+zmtp_prefixes_add (zmtp_prefixes_t *self, const byte *prefix, size_t size)
+{
+    assert (self);
+    assert (prefix || size == 0);
+    if (size > ZMTP_PREFIXES_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (self->count == self->max_count) {
+        self->max_count = self->max_count? 2 * self->max_count: 16;
+        //  Slots are realigned by hand, as realloc does not keep alignment
+        byte *slots = NULL;
+        const int rc = posix_memalign ((void **) &slots,
+            ZMTP_PREFIXES_MAX, self->max_count * ZMTP_PREFIXES_MAX);
+        assert (rc == 0);           //  For now, memory exhaustion is fatal
+        if (self->count > 0)
+            memcpy (slots, self->slots, self->count * ZMTP_PREFIXES_MAX);
+        free (self->slots);
+        self->slots = slots;
+        self->masks = (uint32_t *) realloc (
+            self->masks, self->max_count * sizeof *self->masks);
+        assert (self->masks);       //  For now, memory exhaustion is fatal
+        self->sizes = (byte *) realloc (self->sizes, self->max_count);
+        assert (self->sizes);       //  For now, memory exhaustion is fatal
+    }
+    byte *slot = self->slots + self->count * ZMTP_PREFIXES_MAX;
+    memset (slot, 0, ZMTP_PREFIXES_MAX);
+    if (size > 0)
+        memcpy (slot, prefix, size);
+    self->masks [self->count] =
+        size == ZMTP_PREFIXES_MAX? 0xFFFFFFFF: ((uint32_t) 1 << size) - 1;
+    self->sizes [self->count] = (byte) size;
+    self->count++;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove one copy of prefix from the set. Returns 0 if OK, -1 if the
+//  prefix is not in the set.
+
+int
+zmtp_prefixes_remove (zmtp_prefixes_t *self, const byte *prefix, size_t size)
+{
+    assert (self);
+    assert (prefix || size == 0);
+    for (size_t index = 0; index < self->count; index++) {
+        const byte *slot = self->slots + index * ZMTP_PREFIXES_MAX;
+        if (self->sizes [index] == size && memcmp (slot, prefix, size) == 0) {
+            const size_t last = --self->count;
+            memcpy (self->slots + index * ZMTP_PREFIXES_MAX,
+                    self->slots + last * ZMTP_PREFIXES_MAX, ZMTP_PREFIXES_MAX);
+            self->masks [index] = self->masks [last];
+            self->sizes [index] = self->sizes [last];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of prefixes in the set
+
+size_t
+zmtp_prefixes_size (zmtp_prefixes_t *self)
+{
+    assert (self);
+    return self->count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Match data against every prefix in the set at once, storing the
+//  indexes of matching prefixes in indexes, if not NULL. Returns the
+//  number of matching prefixes.
+
+size_t
+zmtp_prefixes_match (zmtp_prefixes_t *self,
+                     const byte *data, size_t size, size_t *indexes)
+{
+    assert (self);
+    assert (data || size == 0);
+    return s_match (self, data, size, indexes, false);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if any prefix in the set matches data
+
+bool
+zmtp_prefixes_check (zmtp_prefixes_t *self, const byte *data, size_t size)
+{
+    assert (self);
+    assert (data || size == 0);
+    return s_match (self, data, size, NULL, true) > 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Select matching implementation (ZMTP_PREFIXES_*). Returns 0 if OK, -1
+//  if the CPU or build does not support it.
+
+int
+zmtp_prefixes_set_impl (zmtp_prefixes_t *self, int impl)
+{
+    assert (self);
+#if defined (ZMTP_PREFIXES_X86)
+    __builtin_cpu_init ();
+    const bool avx2 = __builtin_cpu_supports ("avx2");
+    const bool sse2 = __builtin_cpu_supports ("sse2");
+#else
+    const bool avx2 = false;
+    const bool sse2 = false;
+#endif
+    if (impl == ZMTP_PREFIXES_AUTO)
+        impl = avx2? ZMTP_PREFIXES_AVX2:
+               sse2? ZMTP_PREFIXES_SSE2: ZMTP_PREFIXES_SCALAR;
+
+    if (impl == ZMTP_PREFIXES_SCALAR)
+        self->match = s_match_scalar;
+#if defined (ZMTP_PREFIXES_X86)
+    else
+    if (impl == ZMTP_PREFIXES_SSE2 && sse2)
+        self->match = s_match_sse2;
+    else
+    if (impl == ZMTP_PREFIXES_AVX2 && avx2)
+        self->match = s_match_avx2;
+#endif
+    else {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pad the head of data out to a whole slot and run the implementation
+
+static size_t
+s_match (zmtp_prefixes_t *self, const byte *data, size_t size,
+         size_t *indexes, bool any)
+{
+    byte topic [ZMTP_PREFIXES_MAX] __attribute__ ((aligned (32))) = { 0 };
+    if (size > 0)
+        memcpy (topic, data,
+                size < ZMTP_PREFIXES_MAX? size: ZMTP_PREFIXES_MAX);
+    return self->match (self, topic, size, indexes, any);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Match byte by byte
+
+static size_t
+s_match_scalar (zmtp_prefixes_t *self,
+                const byte *topic, size_t size, size_t *indexes, bool any)
+{
+    size_t matches = 0;
+    for (size_t index = 0; index < self->count; index++) {
+        if (self->sizes [index] > size
+        ||  memcmp (self->slots + index * ZMTP_PREFIXES_MAX,
+                    topic, self->sizes [index]) != 0)
+            continue;
+        if (indexes)
+            indexes [matches] = index;
+        matches++;
+        if (any)
+            break;
+    }
+    return matches;
+}
+
+
+#if defined (ZMTP_PREFIXES_X86)
+//  --------------------------------------------------------------------------
+//  Match 16 bytes at a time with SSE2
+
+__attribute__ ((target ("sse2")))
+static size_t
+s_match_sse2 (zmtp_prefixes_t *self,
+              const byte *topic, size_t size, size_t *indexes, bool any)
+{
+    const __m128i low = _mm_load_si128 ((const __m128i *) topic);
+    const __m128i high = _mm_load_si128 ((const __m128i *) (topic + 16));
+    size_t matches = 0;
+    for (size_t index = 0; index < self->count; index++) {
+        const byte *slot = self->slots + index * ZMTP_PREFIXES_MAX;
+        const uint32_t equal = (uint32_t) _mm_movemask_epi8 (
+                _mm_cmpeq_epi8 (_mm_load_si128 ((const __m128i *) slot), low))
+            | (uint32_t) _mm_movemask_epi8 (
+                _mm_cmpeq_epi8 (_mm_load_si128 (
+                    (const __m128i *) (slot + 16)), high)) << 16;
+        if ((equal & self->masks [index]) != self->masks [index]
+        ||  self->sizes [index] > size)
+            continue;
+        if (indexes)
+            indexes [matches] = index;
+        matches++;
+        if (any)
+            break;
+    }
+    return matches;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Match 32 bytes at a time with AVX2
+
+__attribute__ ((target ("avx2")))
+static size_t
+s_match_avx2 (zmtp_prefixes_t *self,
+              const byte *topic, size_t size, size_t *indexes, bool any)
+{
+    const __m256i head = _mm256_load_si256 ((const __m256i *) topic);
+    size_t matches = 0;
+    for (size_t index = 0; index < self->count; index++) {
+        const byte *slot = self->slots + index * ZMTP_PREFIXES_MAX;
+        const uint32_t equal = (uint32_t) _mm256_movemask_epi8 (
+            _mm256_cmpeq_epi8 (
+                _mm256_load_si256 ((const __m256i *) slot), head));
+        if ((equal & self->masks [index]) != self->masks [index]
+        ||  self->sizes [index] > size)
+            continue;
+        if (indexes)
+            indexes [matches] = index;
+        matches++;
+        if (any)
+            break;
+    }
+    return matches;
+}
+#endif
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_prefixes_test (bool verbose)
+{
+    printf (" * zmtp_prefixes: ");
+    //  @selftest
+    zmtp_prefixes_t *prefixes = zmtp_prefixes_new ();
+    assert (prefixes);
+    const byte long_prefix [ZMTP_PREFIXES_MAX + 1] = { 0 };
+    int rc = zmtp_prefixes_add (prefixes, long_prefix, sizeof long_prefix);
+    assert (rc == -1 && errno == EINVAL);
+
+    //  Every implementation agrees with the plain one, including on
+    //  prefixes that are longer than the data or hold zero bytes
+    const char *words [] = {
+        "", "A", "AB", "ABC", "B", "weather.", "weather.london",
+        "0123456789abcdef0123456789abcdef", "0123456789abcdef0", "\0\0"
+    };
+    const size_t word_sizes [] = { 0, 1, 2, 3, 1, 8, 14, 32, 17, 2 };
+    for (size_t index = 0; index < 10; index++) {
+        rc = zmtp_prefixes_add (prefixes,
+            (const byte *) words [index], word_sizes [index]);
+        assert (rc == 0);
+    }
+    assert (zmtp_prefixes_size (prefixes) == 10);
+
+    const char *topics [] = {
+        "", "A", "ABCD", "weather.london.rain", "weather.paris",
+        "0123456789abcdef0123456789abcdefXYZ", "0123456789abcdef", "\0",
+        "Z"
+    };
+    const size_t topic_sizes [] = { 0, 1, 4, 19, 13, 35, 16, 1, 1 };
+    const size_t expected [] = { 1, 2, 4, 3, 2, 3, 1, 1, 1 };
+    for (int impl = ZMTP_PREFIXES_SCALAR; impl <= ZMTP_PREFIXES_AVX2; impl++) {
+        if (zmtp_prefixes_set_impl (prefixes, impl) == -1)
+            continue;               //  Not on this CPU
+        for (size_t index = 0; index < 9; index++) {
+            size_t indexes [10];
+            const size_t matches = zmtp_prefixes_match (prefixes,
+                (const byte *) topics [index], topic_sizes [index], indexes);
+            assert (matches == expected [index]);
+            assert (zmtp_prefixes_check (prefixes,
+                (const byte *) topics [index], topic_sizes [index]));
+        }
+    }
+    rc = zmtp_prefixes_remove (prefixes, (const byte *) "", 0);
+    assert (rc == 0);
+    rc = zmtp_prefixes_remove (prefixes, (const byte *) "", 0);
+    assert (rc == -1);
+    assert (!zmtp_prefixes_check (prefixes, (const byte *) "Z", 1));
+    assert (zmtp_prefixes_match (
+        prefixes, (const byte *) "ABCD", 4, NULL) == 3);
+    zmtp_prefixes_destroy (&prefixes);
+    assert (prefixes == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,85 @@
+/*  =========================================================================
+    zmtp_prefixes - set of short prefixes matched with vector compares
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_PREFIXES_H_INCLUDED__
+#define __ZMTP_PREFIXES_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Longest prefix the set holds
+#define ZMTP_PREFIXES_MAX 32
+
+//  Matching implementations, for zmtp_prefixes_set_impl
+enum {
+    ZMTP_PREFIXES_AUTO = 0,     //  Best the CPU supports; the default
+    ZMTP_PREFIXES_SCALAR = 1,   //  Byte compares
+    ZMTP_PREFIXES_SSE2 = 2,     //  Two 16-byte compares per prefix
+    ZMTP_PREFIXES_AVX2 = 3,     //  One 32-byte compare per prefix
+};
+
+//  Opaque class structure
+typedef struct _zmtp_prefixes_t zmtp_prefixes_t;
+
+//  @interface
+//  Constructor
+zmtp_prefixes_t *
+    zmtp_prefixes_new (void);
+
+//  Destructor
+void
+    zmtp_prefixes_destroy (zmtp_prefixes_t **self_p);
+
+//  Add prefix of up to ZMTP_PREFIXES_MAX bytes to the set. Returns 0 if
+//  OK, -1 with errno set to EINVAL if the prefix is too long.
+int
+    zmtp_prefixes_add (zmtp_prefixes_t *self,
+                       const byte *prefix, size_t size);
+
+//  Remove one copy of prefix from the set; this moves the last prefix into
+//  its place. Returns 0 if OK, -1 if the prefix is not in the set.
+int
+    zmtp_prefixes_remove (zmtp_prefixes_t *self,
+                          const byte *prefix, size_t size);
+
+//  Return number of prefixes in the set
+size_t
+    zmtp_prefixes_size (zmtp_prefixes_t *self);
+
+//  Match data against every prefix in the set at once, storing the
+//  indexes of matching prefixes in indexes, if not NULL, which must have
+//  room for all. Returns the number of matching prefixes.
+size_t
+    zmtp_prefixes_match (zmtp_prefixes_t *self,
+                         const byte *data, size_t size, size_t *indexes);
+
+//  Return true if any prefix in the set matches data
+bool
+    zmtp_prefixes_check (zmtp_prefixes_t *self,
+                         const byte *data, size_t size);
+
+//  Select matching implementation (ZMTP_PREFIXES_*). Returns 0 if OK, -1
+//  if the CPU or build does not support it.
+int
+    zmtp_prefixes_set_impl (zmtp_prefixes_t *self, int impl);
+
+//  Self test of this class
+void
+    zmtp_prefixes_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,514 @@
+/*  =========================================================================
+    zmtp_pub - PUB socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Subscribers send us messages of one byte, 1 to subscribe or 0 to
+//  unsubscribe, followed by the prefix. We keep all subscriptions in one
+//  trie, with the subscriber channel as the peer, so that matching a
+//  message costs the same however many subscriptions there are.
+//
+//  A message a slow subscriber took only part of stays queued on its
+//  channel. We keep such subscribers on a backlog and write the rest as
+//  they make room, whenever we send or wait, so that they are not left
+//  with half a message until the next one that matches.
+
+#include "zmtp_classes.h"
+#include <poll.h>
+
+//  How long we wait for room at a time, in msecs, where the peers have
+//  no handle to wait on along with the backlog
+#define ZMTP_PUB_WAIT_IVL 100
+
+//  Structure of our class
+
+struct _zmtp_pub_t {
+    zmtp_peers_t *peers;            //  Subscriber connections
+    zmtp_mtrie_t *subscriptions;    //  Prefixes by subscriber
+    zmtp_channel_t **matched;       //  Subscribers of current message
+    size_t nmatched;                //  Number of matched subscribers
+    size_t max_matched;             //  Allocated size of matched array
+    zmtp_msg_t **frames;            //  Frames of current message
+    size_t nframes;                 //  Number of frames so far
+    size_t max_frames;              //  Allocated size of frames array
+    zmtp_channel_t **backlog;       //  Subscribers with output pending
+    size_t nbacklog;                //  Number of subscribers on backlog
+    size_t max_backlog;             //  Allocated size of backlog array
+    struct pollfd *items;           //  For waiting on the backlog
+    size_t max_items;               //  Allocated size of items array
+};
+
+static int
+    s_process (zmtp_pub_t *self, int timeout);
+static int
+    s_wait_room (zmtp_pub_t *self, int timeout);
+static void
+    s_flush (zmtp_pub_t *self);
+static void
+    s_push_backlog (zmtp_pub_t *self, zmtp_channel_t *channel);
+static void
+    s_drop (zmtp_pub_t *self, zmtp_channel_t *channel);
+static void
+    s_match (void *peer, void *arg);
+static int
+    s_compare (const void *item1, const void *item2);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_pub_t *
+zmtp_pub_new (void)
+{
+    zmtp_pub_t *self = (zmtp_pub_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    //  Slow subscribers miss messages rather than hold up the others
+    self->peers = zmtp_peers_new (true);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    self->subscriptions = zmtp_mtrie_new ();
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; closes all subscriber connections
+
+void
+zmtp_pub_destroy (zmtp_pub_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_pub_t *self = *self_p;
+        for (size_t index = 0; index < self->nframes; index++)
+            zmtp_msg_destroy (&self->frames [index]);
+        free (self->frames);
+        free (self->matched);
+        free (self->backlog);
+        free (self->items);
+        zmtp_mtrie_destroy (&self->subscriptions);
+        zmtp_peers_destroy (&self->peers);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept subscribers on endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_pub_bind (zmtp_pub_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to a subscriber at endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_pub_connect (zmtp_pub_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_connect (self->peers, endpoint_str)? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send message to every subscriber with a subscription that is a prefix
+//  of its first frame. Returns 0 if OK, -1 on error.
+
+int
+zmtp_pub_send (zmtp_pub_t *self, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    //  Subscriptions change between messages only
+    if (self->nframes == 0 && s_process (self, 0) == -1)
+        return -1;
+
+    if (self->nframes == self->max_frames) {
+        self->max_frames = self->max_frames? 2 * self->max_frames: 4;
+        self->frames = (zmtp_msg_t **) realloc (
+            self->frames, self->max_frames * sizeof *self->frames);
+        assert (self->frames);      //  For now, memory exhaustion is fatal
+    }
+    self->frames [self->nframes++] = zmtp_msg_ref (msg);
+    if (zmtp_msg_flags (msg) & ZMTP_MSG_MORE)
+        return 0;
+
+    //  A subscriber with several matching prefixes gets the message once
+    self->nmatched = 0;
+    zmtp_msg_t *first = self->frames [0];
+    zmtp_mtrie_match (self->subscriptions,
+        zmtp_msg_data (first), zmtp_msg_size (first), s_match, self);
+    if (self->nmatched > 1)
+        qsort (self->matched, self->nmatched,
+               sizeof *self->matched, s_compare);
+
+    for (size_t index = 0; index < self->nmatched; index++) {
+        zmtp_channel_t *channel = self->matched [index];
+        if (index > 0 && channel == self->matched [index - 1])
+            continue;
+        //  The frames go out together or not at all
+        const bool backlogged = zmtp_channel_has_output (channel);
+        if (zmtp_channel_send_batch (channel, self->frames, self->nframes)
+        &&  errno != EAGAIN && errno != ENOBUFS)
+            s_drop (self, channel);
+        else
+        if (!backlogged && zmtp_channel_has_output (channel))
+            s_push_backlog (self, channel);
+    }
+    for (size_t index = 0; index < self->nframes; index++)
+        zmtp_msg_destroy (&self->frames [index]);
+    self->nframes = 0;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 for ever) for new subscribers and
+//  subscriptions and take them in, writing what slow subscribers have
+//  pending as they make room; returns early once one does. Returns 0 if
+//  OK, -1 on error.
+
+int
+zmtp_pub_wait (zmtp_pub_t *self, int timeout)
+{
+    assert (self);
+    return s_process (self, timeout);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of connected subscribers
+
+size_t
+zmtp_pub_subscribers (zmtp_pub_t *self)
+{
+    assert (self);
+    return zmtp_peers_size (self->peers);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take in what subscribers sent, waiting up to timeout msecs for the
+//  first of it, or for room to write pending output. Returns 0 if OK, -1
+//  on error.
+
+static int
+s_process (zmtp_pub_t *self, int timeout)
+{
+    s_flush (self);
+    if (self->nbacklog > 0 && timeout != 0) {
+        if (s_wait_room (self, timeout) == -1)
+            return -1;
+        s_flush (self);
+        timeout = 0;
+    }
+    zmtp_channel_t *channel;
+    while ((channel = zmtp_peers_wait (self->peers, timeout))) {
+        timeout = 0;
+        zmtp_msg_t *msg;
+        while ((msg = zmtp_channel_recv (channel))) {
+            const byte *data = zmtp_msg_data (msg);
+            const size_t size = zmtp_msg_size (msg);
+            //  Anything but subscriptions is none of our business
+            if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == 0 && size > 0) {
+                if (data [0] == 1)
+                    zmtp_mtrie_add (self->subscriptions,
+                        data + 1, size - 1, channel);
+                else
+                if (data [0] == 0)
+                    zmtp_mtrie_remove (self->subscriptions,
+                        data + 1, size - 1, channel);
+            }
+            zmtp_msg_destroy (&msg);
+        }
+        if (errno != EAGAIN)
+            s_drop (self, channel);
+    }
+    return errno == EAGAIN? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs until a subscriber on the backlog has room or
+//  any subscriber has input. Returns 0 if OK, -1 on error.
+
+static int
+s_wait_room (zmtp_pub_t *self, int timeout)
+{
+    if (zmtp_peers_has_input (self->peers))
+        return 0;
+    const size_t count = self->nbacklog + 1;
+    if (count > self->max_items) {
+        self->max_items = count;
+        self->items = (struct pollfd *) realloc (
+            self->items, count * sizeof *self->items);
+        assert (self->items);       //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < self->nbacklog; index++) {
+        self->items [index].fd = zmtp_channel_fd (self->backlog [index]);
+        self->items [index].events = POLLOUT;
+    }
+    self->items [self->nbacklog].fd = zmtp_peers_fd (self->peers);
+    self->items [self->nbacklog].events = POLLIN;
+    if (self->items [self->nbacklog].fd == -1
+    && (timeout == -1 || timeout > ZMTP_PUB_WAIT_IVL))
+        timeout = ZMTP_PUB_WAIT_IVL;
+    const int rc = poll (self->items, count, timeout);
+    return rc == -1 && errno != EINTR? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write what subscribers on the backlog have pending, and take those that
+//  are done off it
+
+static void
+s_flush (zmtp_pub_t *self)
+{
+    size_t index = 0;
+    while (index < self->nbacklog) {
+        zmtp_channel_t *channel = self->backlog [index];
+        if (zmtp_channel_flush (channel) == 0)
+            self->backlog [index] = self->backlog [--self->nbacklog];
+        else
+        if (errno != EAGAIN)
+            s_drop (self, channel);
+        else
+            index++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put subscriber on the backlog
+
+static void
+s_push_backlog (zmtp_pub_t *self, zmtp_channel_t *channel)
+{
+    if (self->nbacklog == self->max_backlog) {
+        self->max_backlog = self->max_backlog? 2 * self->max_backlog: 16;
+        self->backlog = (zmtp_channel_t **) realloc (
+            self->backlog, self->max_backlog * sizeof *self->backlog);
+        assert (self->backlog);     //  For now, memory exhaustion is fatal
+    }
+    self->backlog [self->nbacklog++] = channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget subscriber and its subscriptions
+
+static void
+s_drop (zmtp_pub_t *self, zmtp_channel_t *channel)
+{
+    for (size_t index = 0; index < self->nbacklog; index++)
+        if (self->backlog [index] == channel) {
+            self->backlog [index] = self->backlog [--self->nbacklog];
+            break;
+        }
+    zmtp_mtrie_remove_peer (self->subscriptions, channel);
+    zmtp_peers_remove (self->peers, channel);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add matching subscriber to the matched array
+
+static void
+s_match (void *peer, void *arg)
+{
+    zmtp_pub_t *self = (zmtp_pub_t *) arg;
+    if (self->nmatched == self->max_matched) {
+        self->max_matched = self->max_matched? 2 * self->max_matched: 16;
+        self->matched = (zmtp_channel_t **) realloc (
+            self->matched, self->max_matched * sizeof *self->matched);
+        assert (self->matched);     //  For now, memory exhaustion is fatal
+    }
+    self->matched [self->nmatched++] = (zmtp_channel_t *) peer;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Order subscribers by address, so that duplicates come together
+
+static int
+s_compare (const void *item1, const void *item2)
+{
+    const uintptr_t peer1 = (uintptr_t) *(zmtp_channel_t * const *) item1;
+    const uintptr_t peer2 = (uintptr_t) *(zmtp_channel_t * const *) item2;
+    return (peer1 > peer2) - (peer1 < peer2);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_test_subscriber (void *arg)
+{
+    int *done = (int *) arg;
+    zmtp_sub_t *sub = zmtp_sub_new ();
+    assert (sub);
+    int rc = zmtp_sub_subscribe (sub, "weather", 7);
+    assert (rc == 0);
+    while (zmtp_sub_connect (sub, "tcp://127.0.0.1:22006") == -1)
+        usleep (10000);
+
+    //  Only two-frame weather messages come through
+    for (int count = 0; count < 10; count++) {
+        zmtp_msg_t *msg = zmtp_sub_recv (sub);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 9);
+        assert (memcmp (zmtp_msg_data (msg), "weather.x", 9) == 0);
+        assert (zmtp_msg_flags (msg) & ZMTP_MSG_MORE);
+        zmtp_msg_destroy (&msg);
+        msg = zmtp_sub_recv (sub);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 4);
+        assert ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_sub_destroy (&sub);
+    __atomic_store_n (done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+#define TEST_PUB_SIZE (64 * 1024)
+
+struct test_slow {
+    int subscribed;             //  Set once a probe came through
+    int go;                     //  Set when the subscriber may read
+    int last;                   //  Number of the last message sent
+    int done;                   //  Set once the last message came
+};
+
+static void *
+s_test_slow_subscriber (void *arg)
+{
+    struct test_slow *slow = (struct test_slow *) arg;
+    zmtp_sub_t *sub = zmtp_sub_new ();
+    assert (sub);
+    int rc = zmtp_sub_subscribe (sub, "", 0);
+    assert (rc == 0);
+    while (zmtp_sub_connect (sub, "ipc://@zmtp-pub-test-slow") == -1)
+        usleep (10000);
+    zmtp_msg_t *msg = zmtp_sub_recv (sub);
+    assert (msg);
+    zmtp_msg_destroy (&msg);
+    __atomic_store_n (&slow->subscribed, 1, __ATOMIC_RELEASE);
+
+    //  Take nothing while the publisher fills our buffers, then take all
+    //  up to the last message, the one left half sent
+    while (!__atomic_load_n (&slow->go, __ATOMIC_ACQUIRE))
+        usleep (1000);
+    const int last = __atomic_load_n (&slow->last, __ATOMIC_ACQUIRE);
+    int number = -1;
+    while (number != last) {
+        msg = zmtp_sub_recv (sub);
+        assert (msg);
+        if (zmtp_msg_size (msg) == TEST_PUB_SIZE)
+            memcpy (&number, zmtp_msg_data (msg), sizeof number);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_sub_destroy (&sub);
+    __atomic_store_n (&slow->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void
+zmtp_pub_test (bool verbose)
+{
+    printf (" * zmtp_pub: ");
+    //  @selftest
+    zmtp_pub_t *pub = zmtp_pub_new ();
+    assert (pub);
+    int rc = zmtp_pub_bind (pub, "tcp://127.0.0.1:22006");
+    assert (rc == 0);
+    rc = zmtp_pub_wait (pub, 0);
+    assert (rc == 0);
+    assert (zmtp_pub_subscribers (pub) == 0);
+
+    int done = 0;
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_test_subscriber, &done);
+
+    zmtp_msg_t *news = zmtp_msg_from_const_data (0, "news", 4);
+    zmtp_msg_t *topic =
+        zmtp_msg_from_const_data (ZMTP_MSG_MORE, "weather.x", 9);
+    zmtp_msg_t *body = zmtp_msg_from_const_data (0, "data", 4);
+    //  Publish until the subscriber, joining late, has seen enough
+    while (!__atomic_load_n (&done, __ATOMIC_ACQUIRE)) {
+        rc = zmtp_pub_send (pub, news);
+        assert (rc == 0);
+        rc = zmtp_pub_send (pub, topic);
+        assert (rc == 0);
+        rc = zmtp_pub_send (pub, body);
+        assert (rc == 0);
+        zmtp_pub_wait (pub, 10);
+    }
+    pthread_join (thread, NULL);
+
+    //  The subscriber is gone once we see it close
+    while (zmtp_pub_subscribers (pub) > 0) {
+        rc = zmtp_pub_wait (pub, 100);
+        assert (rc == 0);
+    }
+    zmtp_msg_destroy (&news);
+    zmtp_msg_destroy (&topic);
+    zmtp_msg_destroy (&body);
+    zmtp_pub_destroy (&pub);
+    assert (pub == NULL);
+
+    //  A message a slow subscriber took part of is written out while we
+    //  wait, without another message to push it
+    pub = zmtp_pub_new ();
+    assert (pub);
+    rc = zmtp_pub_bind (pub, "ipc://@zmtp-pub-test-slow");
+    assert (rc == 0);
+    struct test_slow slow = { 0 };
+    pthread_create (&thread, NULL, s_test_slow_subscriber, &slow);
+    zmtp_msg_t *probe = zmtp_msg_from_const_data (0, "probe", 5);
+    while (!__atomic_load_n (&slow.subscribed, __ATOMIC_ACQUIRE)) {
+        rc = zmtp_pub_send (pub, probe);
+        assert (rc == 0);
+        zmtp_pub_wait (pub, 10);
+    }
+    zmtp_msg_destroy (&probe);
+    int number = 0;
+    while (pub->nbacklog == 0) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, TEST_PUB_SIZE);
+        memcpy (zmtp_msg_data (msg), &number, sizeof number);
+        rc = zmtp_pub_send (pub, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+        number++;
+    }
+    __atomic_store_n (&slow.last, number - 1, __ATOMIC_RELEASE);
+    __atomic_store_n (&slow.go, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n (&slow.done, __ATOMIC_ACQUIRE)) {
+        rc = zmtp_pub_wait (pub, 100);
+        assert (rc == 0);
+    }
+    pthread_join (thread, NULL);
+    assert (pub->nbacklog == 0);
+    zmtp_pub_destroy (&pub);
+    //  @end
+
+    printf ("OK\n");
+}
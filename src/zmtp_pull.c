@@ -0,0 +1,166 @@
+/*  =========================================================================
+    zmtp_pull - PULL socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Structure of our class
+
+struct _zmtp_pull_t {
+    zmtp_peers_t *peers;        //  Peer connections
+};
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_pull_t *
+zmtp_pull_new (void)
+{
+    zmtp_pull_t *self = (zmtp_pull_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->peers = zmtp_peers_new (false);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; closes all peer connections
+
+void
+zmtp_pull_destroy (zmtp_pull_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_pull_t *self = *self_p;
+        zmtp_peers_destroy (&self->peers);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept peers on endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_pull_bind (zmtp_pull_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_pull_connect (zmtp_pull_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_connect (self->peers, endpoint_str)? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a frame, taking peers with messages waiting in turn. Returns
+//  NULL on error.
+
+zmtp_msg_t *
+zmtp_pull_recv (zmtp_pull_t *self)
+{
+    assert (self);
+    return zmtp_peers_recv (self->peers, NULL);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_PULL_COUNT 1000
+
+struct test_pusher {
+    byte tag;                   //  Body of each message
+    pthread_barrier_t *barrier; //  Start sending together
+};
+
+static void *
+s_test_pusher (void *arg)
+{
+    struct test_pusher *pusher = (struct test_pusher *) arg;
+    zmtp_push_t *push = zmtp_push_new ();
+    assert (push);
+    while (zmtp_push_connect (push, "tcp://127.0.0.1:22011") == -1)
+        usleep (10000);
+    pthread_barrier_wait (pusher->barrier);
+
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, &pusher->tag, 1);
+    for (int count = 0; count < TEST_PULL_COUNT; count++) {
+        const int rc = zmtp_push_send (push, msg);
+        assert (rc == 0);
+    }
+    zmtp_msg_destroy (&msg);
+    zmtp_push_destroy (&push);
+    return NULL;
+}
+
+void
+zmtp_pull_test (bool verbose)
+{
+    printf (" * zmtp_pull: ");
+    //  @selftest
+    zmtp_pull_t *pull = zmtp_pull_new ();
+    assert (pull);
+    zmtp_msg_t *msg = zmtp_pull_recv (pull);
+    assert (msg == NULL && errno == ENOTCONN);
+    int rc = zmtp_pull_bind (pull, "tcp://127.0.0.1:22011");
+    assert (rc == 0);
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init (&barrier, NULL, 2);
+    struct test_pusher pushers [2] = {
+        { 'A', &barrier }, { 'B', &barrier }
+    };
+    pthread_t threads [2];
+    for (int index = 0; index < 2; index++)
+        pthread_create (&threads [index], NULL,
+                        s_test_pusher, &pushers [index]);
+
+    //  Once both peers have all their messages queued, they take turns
+    int counts [2] = { 0, 0 };
+    for (int total = 0; total < 2 * TEST_PULL_COUNT; total++) {
+        msg = zmtp_pull_recv (pull);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 1);
+        const int index = zmtp_msg_data (msg) [0] - 'A';
+        assert (index == 0 || index == 1);
+        counts [index]++;
+        zmtp_msg_destroy (&msg);
+        if (total == 0)
+            usleep (100000);
+        else
+        if (counts [0] < TEST_PULL_COUNT && counts [1] < TEST_PULL_COUNT)
+            assert (abs (counts [0] - counts [1]) <= 2);
+    }
+    assert (counts [0] == TEST_PULL_COUNT && counts [1] == TEST_PULL_COUNT);
+    for (int index = 0; index < 2; index++)
+        pthread_join (threads [index], NULL);
+    pthread_barrier_destroy (&barrier);
+    zmtp_pull_destroy (&pull);
+    assert (pull == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
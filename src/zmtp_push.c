@@ -0,0 +1,531 @@
+/*  =========================================================================
+    zmtp_push - PUSH socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Peer channels are non-blocking, so that a peer whose send buffer is
+//  full, our high-water mark, fails the send with EAGAIN instead of
+//  holding up the others. We then try the next peer in turn, and wait
+//  for room only when every peer is full.
+//
+//  A message a peer took only part of stays queued on its channel. We keep
+//  such peers on a backlog and write the rest as they make room, whenever
+//  we send or wait, so that they are not left with half a message until
+//  their next turn.
+
+#include "zmtp_classes.h"
+#include <poll.h>
+
+//  How long we wait for room at a time, in msecs, before looking for new
+//  peers again
+#define ZMTP_PUSH_WAIT_IVL 100
+
+//  Structure of our class
+
+struct _zmtp_push_t {
+    zmtp_peers_t *peers;        //  Peer connections
+    size_t next;                //  Index of next peer in turn
+    zmtp_msg_t **frames;        //  Frames of message so far
+    size_t nframes;             //  Number of frames
+    size_t max_frames;          //  Allocated size of frames array
+    zmtp_channel_t **backlog;   //  Peers with output pending
+    size_t nbacklog;            //  Number of peers on backlog
+    size_t max_backlog;         //  Allocated size of backlog array
+    struct pollfd *items;       //  For waiting on peers
+    size_t max_items;           //  Allocated size of items array
+};
+
+static int
+    s_process (zmtp_push_t *self, int timeout);
+static int
+    s_send_next (zmtp_push_t *self);
+static int
+    s_wait_room (zmtp_push_t *self);
+static int
+    s_wait_backlog (zmtp_push_t *self, int timeout);
+static void
+    s_flush (zmtp_push_t *self);
+static void
+    s_push_backlog (zmtp_push_t *self, zmtp_channel_t *channel);
+static void
+    s_drop (zmtp_push_t *self, zmtp_channel_t *channel);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_push_t *
+zmtp_push_new (void)
+{
+    zmtp_push_t *self = (zmtp_push_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->peers = zmtp_peers_new (true);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; waits until messages on their way are written, then
+//  closes all peer connections
+
+void
+zmtp_push_destroy (zmtp_push_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_push_t *self = *self_p;
+        //  Going back to blocking mode writes what is left
+        for (size_t index = 0; index < zmtp_peers_size (self->peers); index++)
+            zmtp_channel_set_nonblocking (
+                zmtp_peers_get (self->peers, index), false);
+        zmtp_peers_destroy (&self->peers);
+        for (size_t index = 0; index < self->nframes; index++)
+            zmtp_msg_destroy (&self->frames [index]);
+        free (self->frames);
+        free (self->backlog);
+        free (self->items);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept peers on endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_push_bind (zmtp_push_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_push_connect (zmtp_push_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_connect (self->peers, endpoint_str)? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send a frame; each whole message goes to the next peer in turn that can
+//  take it without blocking. Returns 0 if OK, -1 on error.
+
+int
+zmtp_push_send (zmtp_push_t *self, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    if (self->nframes == self->max_frames) {
+        self->max_frames = self->max_frames? 2 * self->max_frames: 4;
+        self->frames = (zmtp_msg_t **) realloc (
+            self->frames, self->max_frames * sizeof *self->frames);
+        assert (self->frames);      //  For now, memory exhaustion is fatal
+    }
+    self->frames [self->nframes++] = zmtp_msg_ref (msg);
+    if (zmtp_msg_flags (msg) & ZMTP_MSG_MORE)
+        return 0;
+
+    int rc = s_process (self, 0);
+    while (rc == 0) {
+        rc = s_send_next (self);
+        if (rc == 0 || errno != EAGAIN)
+            break;
+        //  Every peer is full, or there are none yet
+        if (zmtp_peers_size (self->peers) > 0)
+            rc = s_wait_room (self);
+        else
+        if (zmtp_peers_listening (self->peers))
+            rc = s_process (self, ZMTP_PUSH_WAIT_IVL);
+        else {
+            errno = ENOTCONN;
+            rc = -1;
+        }
+        if (rc == 0)
+            rc = s_process (self, 0);
+    }
+    for (size_t index = 0; index < self->nframes; index++)
+        zmtp_msg_destroy (&self->frames [index]);
+    self->nframes = 0;
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 for ever) for new peers and take them in,
+//  writing what peers have pending as they make room; returns early once
+//  one does. Returns 0 if OK, -1 on error.
+
+int
+zmtp_push_wait (zmtp_push_t *self, int timeout)
+{
+    assert (self);
+    return s_process (self, timeout);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of connected peers
+
+size_t
+zmtp_push_peers (zmtp_push_t *self)
+{
+    assert (self);
+    return zmtp_peers_size (self->peers);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take in new peers and close peers that went away, waiting up to
+//  timeout msecs for either, or for room to write pending output. Peers
+//  have nothing to say to us otherwise. Returns 0 if OK, -1 on error.
+
+static int
+s_process (zmtp_push_t *self, int timeout)
+{
+    s_flush (self);
+    if (self->nbacklog > 0 && timeout != 0) {
+        if (s_wait_backlog (self, timeout) == -1)
+            return -1;
+        s_flush (self);
+        timeout = 0;
+    }
+    zmtp_channel_t *channel;
+    while ((channel = zmtp_peers_wait (self->peers, timeout))) {
+        timeout = 0;
+        zmtp_msg_t *msg;
+        while ((msg = zmtp_channel_recv (channel)))
+            zmtp_msg_destroy (&msg);
+        if (errno != EAGAIN)
+            s_drop (self, channel);
+    }
+    return errno == EAGAIN? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send message to the next peer in turn that can take it. Returns 0 if
+//  OK, -1 with errno set to EAGAIN if no peer can.
+
+static int
+s_send_next (zmtp_push_t *self)
+{
+    size_t tried = 0;
+    while (tried < zmtp_peers_size (self->peers)) {
+        if (self->next >= zmtp_peers_size (self->peers))
+            self->next = 0;
+        zmtp_channel_t *channel = zmtp_peers_get (self->peers, self->next);
+        const bool backlogged = zmtp_channel_has_output (channel);
+        if (zmtp_channel_send_batch (
+                channel, self->frames, self->nframes) == 0) {
+            if (!backlogged && zmtp_channel_has_output (channel))
+                s_push_backlog (self, channel);
+            self->next++;
+            return 0;
+        }
+        if (errno == EAGAIN || errno == ENOBUFS) {
+            self->next++;
+            tried++;
+        }
+        else
+            //  The last peer takes its place, and its turn
+            s_drop (self, channel);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait until any peer has room to send, for a while at most. Returns 0
+//  if OK, -1 on error.
+
+static int
+s_wait_room (zmtp_push_t *self)
+{
+    const size_t count = zmtp_peers_size (self->peers);
+    if (count > self->max_items) {
+        self->max_items = count;
+        self->items = (struct pollfd *) realloc (
+            self->items, count * sizeof *self->items);
+        assert (self->items);       //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < count; index++) {
+        self->items [index].fd =
+            zmtp_channel_fd (zmtp_peers_get (self->peers, index));
+        self->items [index].events = POLLOUT;
+    }
+    return poll (self->items, count, ZMTP_PUSH_WAIT_IVL) == -1? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs until a peer on the backlog has room or any
+//  peer has input. Returns 0 if OK, -1 on error.
+
+static int
+s_wait_backlog (zmtp_push_t *self, int timeout)
+{
+    if (zmtp_peers_has_input (self->peers))
+        return 0;
+    const size_t count = self->nbacklog + 1;
+    if (count > self->max_items) {
+        self->max_items = count;
+        self->items = (struct pollfd *) realloc (
+            self->items, count * sizeof *self->items);
+        assert (self->items);       //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < self->nbacklog; index++) {
+        self->items [index].fd = zmtp_channel_fd (self->backlog [index]);
+        self->items [index].events = POLLOUT;
+    }
+    self->items [self->nbacklog].fd = zmtp_peers_fd (self->peers);
+    self->items [self->nbacklog].events = POLLIN;
+    if (self->items [self->nbacklog].fd == -1
+    && (timeout == -1 || timeout > ZMTP_PUSH_WAIT_IVL))
+        timeout = ZMTP_PUSH_WAIT_IVL;
+    const int rc = poll (self->items, count, timeout);
+    return rc == -1 && errno != EINTR? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write what peers on the backlog have pending, and take those that are
+//  done off it
+
+static void
+s_flush (zmtp_push_t *self)
+{
+    size_t index = 0;
+    while (index < self->nbacklog) {
+        zmtp_channel_t *channel = self->backlog [index];
+        if (zmtp_channel_flush (channel) == 0)
+            self->backlog [index] = self->backlog [--self->nbacklog];
+        else
+        if (errno != EAGAIN)
+            s_drop (self, channel);
+        else
+            index++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put peer on the backlog
+
+static void
+s_push_backlog (zmtp_push_t *self, zmtp_channel_t *channel)
+{
+    if (self->nbacklog == self->max_backlog) {
+        self->max_backlog = self->max_backlog? 2 * self->max_backlog: 16;
+        self->backlog = (zmtp_channel_t **) realloc (
+            self->backlog, self->max_backlog * sizeof *self->backlog);
+        assert (self->backlog);     //  For now, memory exhaustion is fatal
+    }
+    self->backlog [self->nbacklog++] = channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Close peer and take it off the backlog
+
+static void
+s_drop (zmtp_push_t *self, zmtp_channel_t *channel)
+{
+    for (size_t index = 0; index < self->nbacklog; index++)
+        if (self->backlog [index] == channel) {
+            self->backlog [index] = self->backlog [--self->nbacklog];
+            break;
+        }
+    zmtp_peers_remove (self->peers, channel);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+struct test_puller {
+    const char *endpoint;       //  Where to connect
+    bool sleepy;                //  Do not receive at all until stopped
+    int stop;                   //  Set to stop a sleepy puller
+    int count;                  //  Messages received
+};
+
+static void *
+s_test_puller (void *arg)
+{
+    struct test_puller *puller = (struct test_puller *) arg;
+    zmtp_pull_t *pull = zmtp_pull_new ();
+    assert (pull);
+    while (zmtp_pull_connect (pull, puller->endpoint) == -1)
+        usleep (10000);
+    if (puller->sleepy)
+        while (!__atomic_load_n (&puller->stop, __ATOMIC_ACQUIRE))
+            usleep (1000);
+    else
+        //  An empty message means stop
+        while (true) {
+            zmtp_msg_t *msg = zmtp_pull_recv (pull);
+            assert (msg);
+            const size_t size = zmtp_msg_size (msg);
+            zmtp_msg_destroy (&msg);
+            if (size == 0)
+                break;
+            __atomic_add_fetch (&puller->count, 1, __ATOMIC_RELEASE);
+        }
+    zmtp_pull_destroy (&pull);
+    return NULL;
+}
+
+#define TEST_PUSH_SIZE (8 * 1024 * 1024)
+
+struct test_big {
+    int go;                     //  Set when the puller may receive
+    int done;                   //  Set once the job came through
+};
+
+static void *
+s_test_big_puller (void *arg)
+{
+    struct test_big *big = (struct test_big *) arg;
+    zmtp_pull_t *pull = zmtp_pull_new ();
+    assert (pull);
+    while (zmtp_pull_connect (pull, "ipc://@zmtp-push-test-big") == -1)
+        usleep (10000);
+    while (!__atomic_load_n (&big->go, __ATOMIC_ACQUIRE))
+        usleep (1000);
+    zmtp_msg_t *msg = zmtp_pull_recv (pull);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == TEST_PUSH_SIZE);
+    zmtp_msg_destroy (&msg);
+    __atomic_store_n (&big->done, 1, __ATOMIC_RELEASE);
+    zmtp_pull_destroy (&pull);
+    return NULL;
+}
+
+void
+zmtp_push_test (bool verbose)
+{
+    printf (" * zmtp_push: ");
+    //  @selftest
+    zmtp_msg_t *tick = zmtp_msg_from_const_data (0, "x", 1);
+    zmtp_msg_t *stop = zmtp_msg_from_const_data (0, "", 0);
+
+    //  Work is dealt out in turn
+    zmtp_push_t *push = zmtp_push_new ();
+    assert (push);
+    int rc = zmtp_push_bind (push, "tcp://127.0.0.1:22009");
+    assert (rc == 0);
+    struct test_puller pullers [2] = {
+        { .endpoint = "tcp://127.0.0.1:22009" },
+        { .endpoint = "tcp://127.0.0.1:22009" }
+    };
+    pthread_t threads [2];
+    for (int index = 0; index < 2; index++)
+        pthread_create (&threads [index], NULL,
+                        s_test_puller, &pullers [index]);
+    //  Messages sent meanwhile all go to the first peer
+    int early = 0;
+    for (; zmtp_push_peers (push) < 2; early++) {
+        rc = zmtp_push_send (push, tick);
+        assert (rc == 0);
+    }
+    for (int count = 0; count < 100; count++) {
+        rc = zmtp_push_send (push, tick);
+        assert (rc == 0);
+    }
+    for (int index = 0; index < 2; index++) {
+        rc = zmtp_push_send (push, stop);
+        assert (rc == 0);
+    }
+    for (int index = 0; index < 2; index++)
+        pthread_join (threads [index], NULL);
+    assert (pullers [0].count >= 50 && pullers [1].count >= 50);
+    assert (pullers [0].count + pullers [1].count == early + 100);
+    zmtp_push_destroy (&push);
+
+    //  Peers that do not keep up are skipped
+    push = zmtp_push_new ();
+    assert (push);
+    rc = zmtp_push_bind (push, "tcp://127.0.0.1:22010");
+    assert (rc == 0);
+    pullers [0] = (struct test_puller) {
+        .endpoint = "tcp://127.0.0.1:22010", .sleepy = true };
+    pullers [1] = (struct test_puller) {
+        .endpoint = "tcp://127.0.0.1:22010" };
+    for (int index = 0; index < 2; index++)
+        pthread_create (&threads [index], NULL,
+                        s_test_puller, &pullers [index]);
+    while (zmtp_push_peers (push) < 2) {
+        rc = zmtp_push_send (push, tick);
+        assert (rc == 0);
+    }
+    const size_t size = 64 * 1024;
+    byte *data = (byte *) zmalloc (size);
+    zmtp_msg_t *big = zmtp_msg_from_const_data (0, data, size);
+    const int total = 2000;
+    for (int count = 0; count < total; count++) {
+        rc = zmtp_push_send (push, big);
+        assert (rc == 0);
+    }
+    zmtp_msg_destroy (&big);
+    //  Once the sleepy peer is gone, the last message can only go to the
+    //  other one
+    __atomic_store_n (&pullers [0].stop, 1, __ATOMIC_RELEASE);
+    pthread_join (threads [0], NULL);
+    rc = zmtp_push_send (push, stop);
+    assert (rc == 0);
+    pthread_join (threads [1], NULL);
+    assert (pullers [1].count > total / 2);
+    zmtp_push_destroy (&push);
+    assert (push == NULL);
+    free (data);
+
+    //  A job larger than the socket buffers is written out while we wait,
+    //  without another job to push it
+    push = zmtp_push_new ();
+    assert (push);
+    rc = zmtp_push_bind (push, "ipc://@zmtp-push-test-big");
+    assert (rc == 0);
+    struct test_big test_big = { 0 };
+    pthread_create (&threads [0], NULL, s_test_big_puller, &test_big);
+    while (zmtp_push_peers (push) == 0) {
+        rc = zmtp_push_wait (push, 10);
+        assert (rc == 0);
+    }
+    big = zmtp_msg_new (0, TEST_PUSH_SIZE);
+    rc = zmtp_push_send (push, big);
+    assert (rc == 0);
+    zmtp_msg_destroy (&big);
+    assert (push->nbacklog == 1);
+    __atomic_store_n (&test_big.go, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n (&test_big.done, __ATOMIC_ACQUIRE)) {
+        rc = zmtp_push_wait (push, 100);
+        assert (rc == 0);
+    }
+    pthread_join (threads [0], NULL);
+    assert (push->nbacklog == 0);
+    zmtp_push_destroy (&push);
+    zmtp_msg_destroy (&tick);
+    zmtp_msg_destroy (&stop);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,517 @@
+/*  =========================================================================
+    zmtp_router - ROUTER socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  Each peer gets an identity of a zero byte and a 32-bit serial number,
+//  as libzmq does. Two hash tables map identities to peers for sending,
+//  and channels to peers for receiving, so that neither costs more with
+//  more peers.
+//
+//  A reply a peer took only part of stays queued on its channel. We keep
+//  such peers on a backlog and write the rest as they make room, whenever
+//  we send or wait to receive, so that they are not left with half a
+//  message until the next one we route to them.
+
+#include "zmtp_classes.h"
+#include <poll.h>
+
+//  How long we wait for room at a time, in msecs, where the peers have
+//  no handle to wait on along with the backlog
+#define ZMTP_ROUTER_WAIT_IVL 100
+
+//  Peer and its routing identity
+
+typedef struct {
+    zmtp_channel_t *channel;    //  Connection to peer
+    byte id [ZMTP_ROUTER_ID_SIZE];
+} router_peer_t;
+
+//  Structure of our class
+
+struct _zmtp_router_t {
+    zmtp_peers_t *peers;        //  Peer connections
+    zmtp_hashmap_t *by_id;      //  Peers by routing identity
+    zmtp_hashmap_t *by_channel; //  Peers by channel address
+    uint32_t next_id;           //  Serial number of next identity
+    zmtp_msg_t *first;          //  First frame, held behind the identity
+    //  Sending
+    bool routing;               //  Identity frame was sent
+    router_peer_t *target;      //  Peer it named, unless since gone
+    zmtp_msg_t **frames;        //  Frames of message so far
+    size_t nframes;             //  Number of frames
+    size_t max_frames;          //  Allocated size of frames array
+    zmtp_channel_t **backlog;   //  Peers with output pending
+    size_t nbacklog;            //  Number of peers on backlog
+    size_t max_backlog;         //  Allocated size of backlog array
+    struct pollfd *items;       //  For waiting on the backlog
+    size_t max_items;           //  Allocated size of items array
+};
+
+static void
+    s_connected (zmtp_channel_t *channel, void *arg);
+static void
+    s_disconnected (zmtp_channel_t *channel, void *arg);
+static int
+    s_wait_room (zmtp_router_t *self);
+static void
+    s_flush (zmtp_router_t *self);
+static void
+    s_push_backlog (zmtp_router_t *self, zmtp_channel_t *channel);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_router_t *
+zmtp_router_new (void)
+{
+    zmtp_router_t *self = (zmtp_router_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    //  A peer that does not read holds up nobody but itself
+    self->peers = zmtp_peers_new (true);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    zmtp_peers_set_connect_fn (self->peers, s_connected, self);
+    zmtp_peers_set_disconnect_fn (self->peers, s_disconnected, self);
+    self->by_id = zmtp_hashmap_new ();
+    self->by_channel = zmtp_hashmap_new ();
+    self->next_id = 1;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; waits until replies on their way are written, then closes
+//  all peer connections
+
+void
+zmtp_router_destroy (zmtp_router_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_router_t *self = *self_p;
+        //  Going back to blocking mode writes what is left
+        for (size_t index = 0; index < self->nbacklog; index++)
+            zmtp_channel_set_nonblocking (self->backlog [index], false);
+        self->nbacklog = 0;
+        zmtp_peers_destroy (&self->peers);
+        zmtp_hashmap_destroy (&self->by_id);
+        zmtp_hashmap_destroy (&self->by_channel);
+        zmtp_msg_destroy (&self->first);
+        for (size_t index = 0; index < self->nframes; index++)
+            zmtp_msg_destroy (&self->frames [index]);
+        free (self->frames);
+        free (self->backlog);
+        free (self->items);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept peers on endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_router_bind (zmtp_router_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to a peer at endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_router_connect (zmtp_router_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_connect (self->peers, endpoint_str)? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send a frame; the first frame of each message is the routing identity
+//  of a peer. Returns 0 if OK, -1 on error.
+
+int
+zmtp_router_send (zmtp_router_t *self, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (msg);
+
+    if (!self->routing) {
+        if ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        self->target = (router_peer_t *) zmtp_hashmap_lookup (
+            self->by_id, zmtp_msg_data (msg), zmtp_msg_size (msg));
+        if (!self->target) {
+            errno = EHOSTUNREACH;
+            return -1;
+        }
+        self->routing = true;
+        return 0;
+    }
+    if (self->nframes == self->max_frames) {
+        self->max_frames = self->max_frames? 2 * self->max_frames: 4;
+        self->frames = (zmtp_msg_t **) realloc (
+            self->frames, self->max_frames * sizeof *self->frames);
+        assert (self->frames);      //  For now, memory exhaustion is fatal
+    }
+    self->frames [self->nframes++] = zmtp_msg_ref (msg);
+    if (zmtp_msg_flags (msg) & ZMTP_MSG_MORE)
+        return 0;
+
+    s_flush (self);
+    int rc = 0;
+    if (!self->target) {
+        errno = EHOSTUNREACH;       //  Peer went away meanwhile
+        rc = -1;
+    }
+    else {
+        zmtp_channel_t *channel = self->target->channel;
+        const bool backlogged = zmtp_channel_has_output (channel);
+        if (zmtp_channel_send_batch (
+                channel, self->frames, self->nframes) == -1) {
+            if (errno != EAGAIN && errno != ENOBUFS) {
+                zmtp_peers_remove (self->peers, channel);
+                errno = EHOSTUNREACH;
+            }
+            rc = -1;
+        }
+        else
+        if (!backlogged && zmtp_channel_has_output (channel))
+            s_push_backlog (self, channel);
+    }
+    for (size_t index = 0; index < self->nframes; index++)
+        zmtp_msg_destroy (&self->frames [index]);
+    self->nframes = 0;
+    self->routing = false;
+    self->target = NULL;
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a frame; each message from a peer starts with a frame holding
+//  its routing identity. While waiting, writes what peers on the backlog
+//  have pending as they make room. Returns NULL on error.
+
+zmtp_msg_t *
+zmtp_router_recv (zmtp_router_t *self)
+{
+    assert (self);
+
+    if (self->first) {
+        zmtp_msg_t *msg = self->first;
+        self->first = NULL;
+        return msg;
+    }
+    s_flush (self);
+    const bool first = zmtp_peers_reading (self->peers) == NULL;
+    if (first) {
+        while (self->nbacklog > 0 && !zmtp_peers_poll_input (self->peers)) {
+            if (s_wait_room (self) == -1)
+                return NULL;
+            s_flush (self);
+        }
+    }
+    zmtp_channel_t *channel;
+    zmtp_msg_t *msg = zmtp_peers_recv (self->peers, &channel);
+    if (!msg || !first)
+        return msg;
+
+    //  Start of a message; hand out the identity of the peer first
+    router_peer_t *peer = (router_peer_t *) zmtp_hashmap_lookup (
+        self->by_channel, &channel, sizeof channel);
+    assert (peer);
+    self->first = msg;
+    zmtp_msg_t *id = zmtp_msg_new (ZMTP_MSG_MORE, ZMTP_ROUTER_ID_SIZE);
+    memcpy (zmtp_msg_data (id), peer->id, ZMTP_ROUTER_ID_SIZE);
+    return id;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of connected peers
+
+size_t
+zmtp_router_peers (zmtp_router_t *self)
+{
+    assert (self);
+    return zmtp_peers_size (self->peers);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Give new peer an identity
+
+static void
+s_connected (zmtp_channel_t *channel, void *arg)
+{
+    zmtp_router_t *self = (zmtp_router_t *) arg;
+    router_peer_t *peer = (router_peer_t *) zmalloc (sizeof *peer);
+    assert (peer);              //  For now, memory exhaustion is fatal
+    peer->channel = channel;
+    //  Identities are unique as long as fewer than 2^32 peers are
+    //  connected at once
+    do {
+        const uint32_t id = self->next_id++;
+        peer->id [0] = 0;
+        peer->id [1] = (byte) (id >> 24);
+        peer->id [2] = (byte) (id >> 16);
+        peer->id [3] = (byte) (id >> 8);
+        peer->id [4] = (byte) id;
+    } while (zmtp_hashmap_insert (
+        self->by_id, peer->id, ZMTP_ROUTER_ID_SIZE, peer) == -1);
+    const int rc = zmtp_hashmap_insert (
+        self->by_channel, &channel, sizeof channel, peer);
+    assert (rc == 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget peer that is about to be closed
+
+static void
+s_disconnected (zmtp_channel_t *channel, void *arg)
+{
+    zmtp_router_t *self = (zmtp_router_t *) arg;
+    router_peer_t *peer = (router_peer_t *) zmtp_hashmap_lookup (
+        self->by_channel, &channel, sizeof channel);
+    assert (peer);
+    if (self->target == peer)
+        self->target = NULL;
+    for (size_t index = 0; index < self->nbacklog; index++)
+        if (self->backlog [index] == channel) {
+            self->backlog [index] = self->backlog [--self->nbacklog];
+            break;
+        }
+    zmtp_hashmap_delete (self->by_id, peer->id, ZMTP_ROUTER_ID_SIZE);
+    zmtp_hashmap_delete (self->by_channel, &channel, sizeof channel);
+    free (peer);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait until a peer on the backlog has room or any peer has input, for a
+//  while at most where the peers have no handle. Returns 0 if OK, -1 on
+//  error.
+
+static int
+s_wait_room (zmtp_router_t *self)
+{
+    const size_t count = self->nbacklog + 1;
+    if (count > self->max_items) {
+        self->max_items = count;
+        self->items = (struct pollfd *) realloc (
+            self->items, count * sizeof *self->items);
+        assert (self->items);       //  For now, memory exhaustion is fatal
+    }
+    for (size_t index = 0; index < self->nbacklog; index++) {
+        self->items [index].fd = zmtp_channel_fd (self->backlog [index]);
+        self->items [index].events = POLLOUT;
+    }
+    self->items [self->nbacklog].fd = zmtp_peers_fd (self->peers);
+    self->items [self->nbacklog].events = POLLIN;
+    const int timeout = self->items [self->nbacklog].fd == -1?
+        ZMTP_ROUTER_WAIT_IVL: -1;
+    const int rc = poll (self->items, count, timeout);
+    return rc == -1 && errno != EINTR? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write what peers on the backlog have pending, and take those that are
+//  done off it. Peers that fail are closed.
+
+static void
+s_flush (zmtp_router_t *self)
+{
+    size_t index = 0;
+    while (index < self->nbacklog) {
+        zmtp_channel_t *channel = self->backlog [index];
+        if (zmtp_channel_flush (channel) == 0)
+            self->backlog [index] = self->backlog [--self->nbacklog];
+        else
+        if (errno != EAGAIN)
+            //  Takes the peer off the backlog too
+            zmtp_peers_remove (self->peers, channel);
+        else
+            index++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put peer on the backlog
+
+static void
+s_push_backlog (zmtp_router_t *self, zmtp_channel_t *channel)
+{
+    if (self->nbacklog == self->max_backlog) {
+        self->max_backlog = self->max_backlog? 2 * self->max_backlog: 16;
+        self->backlog = (zmtp_channel_t **) realloc (
+            self->backlog, self->max_backlog * sizeof *self->backlog);
+        assert (self->backlog);     //  For now, memory exhaustion is fatal
+    }
+    self->backlog [self->nbacklog++] = channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_test_client (void *arg)
+{
+    zmtp_dealer_t *dealers [2];
+    for (int index = 0; index < 2; index++) {
+        dealers [index] = zmtp_dealer_new ();
+        assert (dealers [index]);
+        while (zmtp_dealer_connect (
+                dealers [index], "tcp://127.0.0.1:22008") == -1)
+            usleep (10000);
+    }
+    //  Each client gets back its own request
+    for (int index = 0; index < 2; index++) {
+        byte request = (byte) ('A' + index);
+        zmtp_msg_t *msg = zmtp_msg_from_const_data (0, &request, 1);
+        int rc = zmtp_dealer_send (dealers [index], msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    for (int index = 0; index < 2; index++) {
+        zmtp_msg_t *msg = zmtp_dealer_recv (dealers [index]);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == 1);
+        assert (zmtp_msg_data (msg) [0] == 'A' + index);
+        zmtp_msg_destroy (&msg);
+        zmtp_dealer_destroy (&dealers [index]);
+    }
+    return NULL;
+}
+
+#define TEST_ROUTER_SIZE (8 * 1024 * 1024)
+
+static void *
+s_test_big_client (void *arg)
+{
+    int *go = (int *) arg;
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    while (zmtp_dealer_connect (dealer, "ipc://@zmtp-router-test-big") == -1)
+        usleep (10000);
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "big", 3);
+    int rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    //  Take nothing until the router has only part of the reply out, then
+    //  tell it we got the whole of it
+    while (!__atomic_load_n (go, __ATOMIC_ACQUIRE))
+        usleep (1000);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == TEST_ROUTER_SIZE);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_from_const_data (0, "done", 4);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_dealer_destroy (&dealer);
+    return NULL;
+}
+
+void
+zmtp_router_test (bool verbose)
+{
+    printf (" * zmtp_router: ");
+    //  @selftest
+    zmtp_router_t *router = zmtp_router_new ();
+    assert (router);
+    int rc = zmtp_router_bind (router, "tcp://127.0.0.1:22008");
+    assert (rc == 0);
+
+    //  Unknown identities go nowhere
+    zmtp_msg_t *nobody = zmtp_msg_from_const_data (
+        ZMTP_MSG_MORE, "\0\0\0\0\0", ZMTP_ROUTER_ID_SIZE);
+    rc = zmtp_router_send (router, nobody);
+    assert (rc == -1 && errno == EHOSTUNREACH);
+    zmtp_msg_destroy (&nobody);
+
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_test_client, NULL);
+
+    //  Echo both requests back to where they came from
+    for (int count = 0; count < 2; count++) {
+        zmtp_msg_t *id = zmtp_router_recv (router);
+        assert (id);
+        assert (zmtp_msg_size (id) == ZMTP_ROUTER_ID_SIZE);
+        assert (zmtp_msg_flags (id) & ZMTP_MSG_MORE);
+        zmtp_msg_t *body = zmtp_router_recv (router);
+        assert (body);
+        assert ((zmtp_msg_flags (body) & ZMTP_MSG_MORE) == 0);
+        rc = zmtp_router_send (router, id);
+        assert (rc == 0);
+        rc = zmtp_router_send (router, body);
+        assert (rc == 0);
+        zmtp_msg_destroy (&id);
+        zmtp_msg_destroy (&body);
+    }
+    assert (zmtp_router_peers (router) == 2);
+    pthread_join (thread, NULL);
+    zmtp_router_destroy (&router);
+    assert (router == NULL);
+
+    //  A reply larger than the socket buffers is written out while we wait
+    //  for the next request, without another reply to push it
+    router = zmtp_router_new ();
+    assert (router);
+    rc = zmtp_router_bind (router, "ipc://@zmtp-router-test-big");
+    assert (rc == 0);
+    int go = 0;
+    pthread_create (&thread, NULL, s_test_big_client, &go);
+    zmtp_msg_t *id = zmtp_router_recv (router);
+    assert (id);
+    zmtp_msg_t *body = zmtp_router_recv (router);
+    assert (body);
+    zmtp_msg_destroy (&body);
+    rc = zmtp_router_send (router, id);
+    assert (rc == 0);
+    zmtp_msg_t *big = zmtp_msg_new (0, TEST_ROUTER_SIZE);
+    rc = zmtp_router_send (router, big);
+    assert (rc == 0);
+    zmtp_msg_destroy (&big);
+    assert (router->nbacklog == 1);
+    __atomic_store_n (&go, 1, __ATOMIC_RELEASE);
+    zmtp_msg_t *reply = zmtp_router_recv (router);
+    assert (reply);
+    assert (memcmp (zmtp_msg_data (reply), zmtp_msg_data (id),
+                    ZMTP_ROUTER_ID_SIZE) == 0);
+    zmtp_msg_destroy (&reply);
+    reply = zmtp_router_recv (router);
+    assert (reply);
+    assert (zmtp_msg_size (reply) == 4);
+    assert (router->nbacklog == 0);
+    zmtp_msg_destroy (&reply);
+    zmtp_msg_destroy (&id);
+    pthread_join (thread, NULL);
+    zmtp_router_destroy (&router);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -23,7 +23,20 @@ int main (int argc, char *argv [])
 //     printf ("Running self tests...\n");
 //     zmtp_msg_test (verbose);
 //     printf ("Tests passed OK\n");
+    zmtp_msg_pool_test (false);
     zmtp_msg_test (false);
     zmtp_channel_test (false);
+    zmtp_listener_test (false);
+    zmtp_dealer_test (false);
+    zmtp_poller_test (false);
+    zmtp_mtrie_test (false);
+    zmtp_prefixes_test (false);
+    zmtp_peers_test (false);
+    zmtp_pub_test (false);
+    zmtp_sub_test (false);
+    zmtp_hashmap_test (false);
+    zmtp_router_test (false);
+    zmtp_push_test (false);
+    zmtp_pull_test (false);
     return 0;
 }
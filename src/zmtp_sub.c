@@ -0,0 +1,309 @@
+/*  =========================================================================
+    zmtp_sub - SUB socket class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+//  We keep our own subscriptions in a trie as well, to tell new publishers
+//  about them. To drop messages that match none of them, we check short
+//  prefixes all at once with vector compares, and fall back to the trie
+//  while any prefix is too long for that.
+
+#include "zmtp_classes.h"
+
+//  Structure of our class
+
+struct _zmtp_sub_t {
+    zmtp_peers_t *peers;            //  Publisher connections
+    zmtp_mtrie_t *subscriptions;    //  Our prefixes
+    zmtp_prefixes_t *filter;        //  Our prefixes, if short enough
+    size_t long_prefixes;           //  Prefixes not in filter
+    bool dropping;                  //  Message in progress is unwanted
+};
+
+static bool
+    s_wanted (zmtp_sub_t *self, zmtp_msg_t *msg);
+static void
+    s_connected (zmtp_channel_t *channel, void *arg);
+static void
+    s_send_subscription (const byte *prefix, size_t size,
+                         void *peer, void *arg);
+static void
+    s_tell_all (zmtp_sub_t *self, byte action,
+                const void *prefix, size_t size);
+static int
+    s_tell (zmtp_channel_t *channel, byte action,
+            const void *prefix, size_t size);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_sub_t *
+zmtp_sub_new (void)
+{
+    zmtp_sub_t *self = (zmtp_sub_t *) zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->peers = zmtp_peers_new (false);
+    if (!self->peers) {
+        free (self);
+        return NULL;
+    }
+    zmtp_peers_set_connect_fn (self->peers, s_connected, self);
+    self->subscriptions = zmtp_mtrie_new ();
+    self->filter = zmtp_prefixes_new ();
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; closes all publisher connections
+
+void
+zmtp_sub_destroy (zmtp_sub_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_sub_t *self = *self_p;
+        zmtp_mtrie_destroy (&self->subscriptions);
+        zmtp_prefixes_destroy (&self->filter);
+        zmtp_peers_destroy (&self->peers);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Accept publishers on endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_sub_bind (zmtp_sub_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_bind (self->peers, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to a publisher at endpoint. Returns 0 if OK, -1 on error.
+
+int
+zmtp_sub_connect (zmtp_sub_t *self, const char *endpoint_str)
+{
+    assert (self);
+    return zmtp_peers_connect (self->peers, endpoint_str)? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive messages whose first frame starts with prefix. Returns 0 if OK,
+//  -1 on error.
+
+int
+zmtp_sub_subscribe (zmtp_sub_t *self, const void *prefix, size_t size)
+{
+    assert (self);
+    assert (prefix || size == 0);
+    if (zmtp_mtrie_add (
+            self->subscriptions, (const byte *) prefix, size, self)) {
+        if (zmtp_prefixes_add (self->filter, (const byte *) prefix, size))
+            self->long_prefixes++;
+        s_tell_all (self, 1, prefix, size);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take back one subscription to prefix. Returns 0 if OK, -1 on error.
+
+int
+zmtp_sub_unsubscribe (zmtp_sub_t *self, const void *prefix, size_t size)
+{
+    assert (self);
+    assert (prefix || size == 0);
+    if (zmtp_mtrie_remove (
+            self->subscriptions, (const byte *) prefix, size, self)) {
+        if (zmtp_prefixes_remove (self->filter, (const byte *) prefix, size))
+            self->long_prefixes--;
+        s_tell_all (self, 0, prefix, size);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive the next frame of a subscribed message, taking publishers in
+//  turn between messages. Returns NULL on error.
+
+zmtp_msg_t *
+zmtp_sub_recv (zmtp_sub_t *self)
+{
+    assert (self);
+
+    while (true) {
+        const bool first = zmtp_peers_reading (self->peers) == NULL;
+        zmtp_msg_t *msg = zmtp_peers_recv (self->peers, NULL);
+        if (!msg)
+            return NULL;
+        if (first)
+            self->dropping = !s_wanted (self, msg);
+        if (!self->dropping)
+            return msg;
+        zmtp_msg_destroy (&msg);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if first frame of message matches any of our subscriptions
+
+static bool
+s_wanted (zmtp_sub_t *self, zmtp_msg_t *msg)
+{
+    if (self->long_prefixes > 0)
+        return zmtp_mtrie_check (self->subscriptions,
+            zmtp_msg_data (msg), zmtp_msg_size (msg));
+    else
+        return zmtp_prefixes_check (self->filter,
+            zmtp_msg_data (msg), zmtp_msg_size (msg));
+}
+
+
+//  --------------------------------------------------------------------------
+//  Tell new publisher about all our subscriptions
+
+static void
+s_connected (zmtp_channel_t *channel, void *arg)
+{
+    zmtp_sub_t *self = (zmtp_sub_t *) arg;
+    zmtp_mtrie_apply (self->subscriptions, s_send_subscription, channel);
+}
+
+static void
+s_send_subscription (const byte *prefix, size_t size, void *peer, void *arg)
+{
+    //  Errors show up when we next receive from the publisher
+    s_tell ((zmtp_channel_t *) arg, 1, prefix, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Tell all publishers we subscribe to or unsubscribe from prefix
+
+static void
+s_tell_all (zmtp_sub_t *self, byte action, const void *prefix, size_t size)
+{
+    size_t index = 0;
+    while (index < zmtp_peers_size (self->peers)) {
+        zmtp_channel_t *channel = zmtp_peers_get (self->peers, index);
+        //  A publisher in the middle of a message is dropped when we next
+        //  receive from it
+        if (s_tell (channel, action, prefix, size) == -1
+        &&  channel != zmtp_peers_reading (self->peers))
+            zmtp_peers_remove (self->peers, channel);
+        else
+            index++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send subscription message to publisher. Returns 0 if OK, -1 on error.
+
+static int
+s_tell (zmtp_channel_t *channel, byte action, const void *prefix, size_t size)
+{
+    zmtp_msg_t *msg = zmtp_msg_new (0, size + 1);
+    byte *data = zmtp_msg_data (msg);
+    data [0] = action;
+    if (size > 0)
+        memcpy (data + 1, prefix, size);
+    const int rc = zmtp_channel_send (channel, msg);
+    zmtp_msg_destroy (&msg);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void *
+s_test_publisher (void *arg)
+{
+    int *done = (int *) arg;
+    zmtp_pub_t *pub = zmtp_pub_new ();
+    assert (pub);
+    while (zmtp_pub_connect (pub, "tcp://127.0.0.1:22007") == -1)
+        usleep (10000);
+
+    zmtp_msg_t *msgs [3] = {
+        zmtp_msg_from_const_data (0, "A-1", 3),
+        zmtp_msg_from_const_data (0, "B-1", 3),
+        zmtp_msg_from_const_data (0, "AB-1", 4)
+    };
+    while (!__atomic_load_n (done, __ATOMIC_ACQUIRE)) {
+        for (int index = 0; index < 3; index++) {
+            const int rc = zmtp_pub_send (pub, msgs [index]);
+            assert (rc == 0);
+        }
+        usleep (1000);
+    }
+    for (int index = 0; index < 3; index++)
+        zmtp_msg_destroy (&msgs [index]);
+    zmtp_pub_destroy (&pub);
+    return NULL;
+}
+
+void
+zmtp_sub_test (bool verbose)
+{
+    printf (" * zmtp_sub: ");
+    //  @selftest
+    zmtp_sub_t *sub = zmtp_sub_new ();
+    assert (sub);
+    zmtp_msg_t *msg = zmtp_sub_recv (sub);
+    assert (msg == NULL && errno == ENOTCONN);
+
+    //  Subscriptions made before publishers come go to them as they come
+    int rc = zmtp_sub_subscribe (sub, "A", 1);
+    assert (rc == 0);
+    rc = zmtp_sub_subscribe (sub, "AB", 2);
+    assert (rc == 0);
+    rc = zmtp_sub_bind (sub, "tcp://127.0.0.1:22007");
+    assert (rc == 0);
+
+    int done = 0;
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_test_publisher, &done);
+
+    //  Overlapping subscriptions do not duplicate messages
+    int count_a = 0, count_ab = 0;
+    while (count_a < 5 || count_ab < 5) {
+        msg = zmtp_sub_recv (sub);
+        assert (msg);
+        assert (zmtp_msg_data (msg) [0] == 'A');
+        if (zmtp_msg_size (msg) == 3)
+            count_a++;
+        else
+            count_ab++;
+        assert (count_a - count_ab <= 1 && count_ab - count_a <= 1);
+        zmtp_msg_destroy (&msg);
+    }
+    rc = zmtp_sub_unsubscribe (sub, "A", 1);
+    assert (rc == 0);
+    __atomic_store_n (&done, 1, __ATOMIC_RELEASE);
+    pthread_join (thread, NULL);
+    zmtp_sub_destroy (&sub);
+    assert (sub == NULL);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,87 @@
+/*  =========================================================================
+    zmtp_sys_engine - system call I/O engine class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  The default engine; does one plain system call per operation
+
+struct zmtp_sys_engine {
+    zmtp_engine_t base;
+};
+
+zmtp_sys_engine_t *
+zmtp_sys_engine_new (void)
+{
+    zmtp_sys_engine_t *self =
+        (zmtp_sys_engine_t *) zmalloc (sizeof *self);
+    if (!self)
+        return NULL;
+
+    //  Initialize base class
+    self->base = (zmtp_engine_t) {
+        .destroy = (void (*) (zmtp_engine_t **)) zmtp_sys_engine_destroy,
+        .sendmsg = (ssize_t (*) (zmtp_engine_t *, int,
+            const struct msghdr *, int)) zmtp_sys_engine_sendmsg,
+        .recv = (ssize_t (*) (zmtp_engine_t *, int, void *, size_t, int))
+            zmtp_sys_engine_recv,
+        .pending = (size_t (*) (zmtp_engine_t *)) zmtp_sys_engine_pending,
+        .handle = (int (*) (zmtp_engine_t *, int)) zmtp_sys_engine_handle,
+    };
+
+    return self;
+}
+
+
+void
+zmtp_sys_engine_destroy (zmtp_sys_engine_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_sys_engine_t *self = *self_p;
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+ssize_t
+zmtp_sys_engine_sendmsg (zmtp_sys_engine_t *self,
+                         int fd, const struct msghdr *msghdr, int flags)
+{
+    assert (self);
+    return sendmsg (fd, msghdr, flags);
+}
+
+
+ssize_t
+zmtp_sys_engine_recv (zmtp_sys_engine_t *self,
+                      int fd, void *buffer, size_t len, int flags)
+{
+    assert (self);
+    return recv (fd, buffer, len, flags);
+}
+
+
+size_t
+zmtp_sys_engine_pending (zmtp_sys_engine_t *self)
+{
+    assert (self);
+    return 0;
+}
+
+
+int
+zmtp_sys_engine_handle (zmtp_sys_engine_t *self, int fd)
+{
+    assert (self);
+    return fd;
+}
@@ -0,0 +1,44 @@
+/*  =========================================================================
+    zmtp_sys_engine - system call I/O engine class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_SYS_ENGINE_H_INCLUDED__
+#define __ZMTP_SYS_ENGINE_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zmtp_engine.h"
+
+typedef struct zmtp_sys_engine zmtp_sys_engine_t;
+
+zmtp_sys_engine_t *
+    zmtp_sys_engine_new (void);
+
+void
+    zmtp_sys_engine_destroy (zmtp_sys_engine_t **self_p);
+
+ssize_t
+    zmtp_sys_engine_sendmsg (zmtp_sys_engine_t *self,
+                             int fd, const struct msghdr *msghdr, int flags);
+
+ssize_t
+    zmtp_sys_engine_recv (zmtp_sys_engine_t *self,
+                          int fd, void *buffer, size_t len, int flags);
+
+size_t
+    zmtp_sys_engine_pending (zmtp_sys_engine_t *self);
+
+int
+    zmtp_sys_engine_handle (zmtp_sys_engine_t *self, int fd);
+
+#endif
@@ -28,8 +28,10 @@ zmtp_tcp_endpoint_new (const char *ip_addr, unsigned short port)
 
     //  Initialize base class
     self->base = (zmtp_endpoint_t) {
-        .connect = (int (*) (zmtp_endpoint_t *)) zmtp_tcp_endpoint_connect,
+        .connect =
+            (int (*) (zmtp_endpoint_t *, int)) zmtp_tcp_endpoint_connect,
         .listen = (int (*) (zmtp_endpoint_t *)) zmtp_tcp_endpoint_listen,
+        .bind = (int (*) (zmtp_endpoint_t *, bool)) zmtp_tcp_endpoint_bind,
         .destroy = (void (*) (zmtp_endpoint_t **)) zmtp_tcp_endpoint_destroy,
     };
 
@@ -64,7 +66,7 @@ zmtp_tcp_endpoint_destroy (zmtp_tcp_endpoint_t **self_p)
 
 
 int
-zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self)
+zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self, int timeout)
 {
     assert (self);
 
@@ -72,8 +74,8 @@ zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self)
     if (s == -1)
         return -1;
 
-    const int rc = connect (
-        s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen);
+    const int rc = zmtp_endpoint_connect_socket (
+        s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen, timeout);
     if (rc == -1) {
         close (s);
         return -1;
@@ -87,6 +89,21 @@ zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self)
 {
     assert (self);
 
+    const int s = zmtp_tcp_endpoint_bind (self, false);
+    if (s == -1)
+        return -1;
+
+    const int rc = accept (s, NULL, NULL);
+    close (s);
+    return rc;
+}
+
+
+int
+zmtp_tcp_endpoint_bind (zmtp_tcp_endpoint_t *self, bool reuseport)
+{
+    assert (self);
+
     const int s = socket (AF_INET, SOCK_STREAM, 0);
     if (s == -1)
         return -1;
@@ -94,14 +111,22 @@ zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self)
     const int flag = 1;
     int rc = setsockopt (s, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
     assert (rc == 0);
-
-    rc = bind (
-        s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen);
-    if (rc == 0) {
-        rc = listen (s, 1);
-        if (rc == 0)
-            rc = accept (s, NULL, NULL);
+    if (reuseport) {
+#if defined (SO_REUSEPORT)
+        rc = setsockopt (s, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof flag);
+#else
+        errno = ENOTSUP;
+        rc = -1;
+#endif
     }
-    close (s);
-    return rc;
+    if (rc == 0)
+        rc = bind (
+            s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen);
+    if (rc == 0)
+        rc = listen (s, SOMAXCONN);
+    if (rc == -1) {
+        close (s);
+        return -1;
+    }
+    return s;
 }
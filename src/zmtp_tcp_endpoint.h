@@ -28,9 +28,12 @@ void
     zmtp_tcp_endpoint_destroy (zmtp_tcp_endpoint_t **self_p);
 
 int
-    zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self);
+    zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self, int timeout);
 
 int
     zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self);
 
+int
+    zmtp_tcp_endpoint_bind (zmtp_tcp_endpoint_t *self, bool reuseport);
+
 #endif
@@ -0,0 +1,602 @@
+/*  =========================================================================
+    zmtp_uring_engine - io_uring I/O engine class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#if defined (__UTYPE_LINUX) && defined (__has_include)
+#   if __has_include (<linux/io_uring.h>)
+#       include <linux/io_uring.h>
+#       include <sys/mman.h>
+#       include <sys/syscall.h>
+#   endif
+#endif
+#if defined (IORING_RECV_MULTISHOT) && defined (__NR_io_uring_setup)
+#   define ZMTP_HAVE_URING
+#endif
+
+//  The engine keeps one multishot receive armed on the socket, so the
+//  kernel reads into a ring of provided buffers as data arrives, and a
+//  receive costs no system call while completions are queued.
+//
+//  Small blocking sends are copied into a buffer of ours and submitted
+//  without waiting; the call returns at once and the completion is
+//  reaped later, so the caller frames the next message while the kernel
+//  sends this one. One send is in flight at a time, which keeps them in
+//  order: the next send, or destroying the engine, waits for it first,
+//  and an error it met fails that next send. Larger sends, non-blocking
+//  sends, and sends with other flags are submitted and waited for, as
+//  the copy would cost more than the wait saves, or the caller needs the
+//  count.
+//
+//  Each engine has its own ring rather than sharing one per thread or
+//  process. A channel's handle must signal input for its own socket only,
+//  since peer sets poll every channel by its handle, and channels move
+//  between threads; a shared ring would need a dispatcher for its
+//  completions and a lock on its queues. The cost is a ring, its memory
+//  mappings and a descriptor per connection, and one io_uring_enter per
+//  channel where a shared ring could batch submissions across channels.
+
+//  Number of submission queue entries
+
+#define ZMTP_URING_ENTRIES      8
+
+//  Number and size of receive buffers; the number must be a power of two
+
+#define ZMTP_URING_BUFFERS      8
+#define ZMTP_URING_BUFFER_SIZE  8192
+
+//  Largest send we copy and leave to complete in the background
+
+#define ZMTP_URING_SEND_COPY_MAX 65536
+
+//  Tags for operations in flight
+
+enum {
+    ZMTP_URING_RECV = 1,
+    ZMTP_URING_SEND = 2,
+    ZMTP_URING_CANCEL = 3,
+};
+
+//  Receive buffer filled by the kernel and not consumed yet
+
+struct uring_chunk {
+    unsigned short bid;         //  Buffer ID
+    size_t size;                //  Bytes received into buffer
+    size_t offset;              //  Bytes handed out so far
+};
+
+struct zmtp_uring_engine {
+    zmtp_engine_t base;
+#if defined (ZMTP_HAVE_URING)
+    int ring_fd;                //  io_uring instance
+    int fd;                     //  Socket being received from
+    void *ring;                 //  Submission and completion rings
+    size_t ring_size;
+    struct io_uring_sqe *sqes;  //  Submission queue entries
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_pending;        //  Entries not submitted yet
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;     //  Provided buffer ring
+    size_t buf_ring_size;
+    unsigned short buf_tail;    //  Our copy of buffer ring tail
+    byte *buffers;              //  Receive buffers
+    struct uring_chunk chunks [ZMTP_URING_BUFFERS];
+    size_t chunk_head;          //  First filled buffer in chunks
+    size_t chunk_count;         //  Number of filled buffers
+    size_t pending;             //  Bytes in filled buffers
+    bool armed;                 //  Receive is in flight
+    bool multishot;             //  Kernel supports multishot receive
+    bool eof;                   //  Peer closed the connection
+    int error;                  //  Receive error, if any
+    bool sending;               //  Send is in flight
+    int send_result;            //  Result of last send
+    int send_fd;                //  Socket of background send
+    int send_flags;             //  Flags of background send
+    byte *send_buffer;          //  Copy of data sent in background
+    size_t send_max;            //  Allocated size of send_buffer
+    size_t send_size;           //  Bytes of background send, 0 if none
+    size_t send_done;           //  Bytes of it sent so far
+    struct iovec send_iov;      //  What the kernel sends from
+    struct msghdr send_msghdr;
+#endif
+};
+
+#if defined (ZMTP_HAVE_URING)
+static int
+    s_enter (zmtp_uring_engine_t *self, unsigned min_complete);
+static struct io_uring_sqe *
+    s_get_sqe (zmtp_uring_engine_t *self);
+static void
+    s_arm (zmtp_uring_engine_t *self);
+static void
+    s_submit_send (zmtp_uring_engine_t *self,
+                   int fd, const struct msghdr *msghdr, int flags);
+static int
+    s_finish_send (zmtp_uring_engine_t *self);
+static void
+    s_reap (zmtp_uring_engine_t *self);
+static void
+    s_provide (zmtp_uring_engine_t *self, unsigned short bid);
+#endif
+
+
+zmtp_uring_engine_t *
+zmtp_uring_engine_new (int fd)
+{
+#if defined (ZMTP_HAVE_URING)
+    zmtp_uring_engine_t *self =
+        (zmtp_uring_engine_t *) zmalloc (sizeof *self);
+    if (!self)
+        return NULL;
+
+    //  Initialize base class
+    self->base = (zmtp_engine_t) {
+        .destroy = (void (*) (zmtp_engine_t **)) zmtp_uring_engine_destroy,
+        .sendmsg = (ssize_t (*) (zmtp_engine_t *, int,
+            const struct msghdr *, int)) zmtp_uring_engine_sendmsg,
+        .recv = (ssize_t (*) (zmtp_engine_t *, int, void *, size_t, int))
+            zmtp_uring_engine_recv,
+        .pending = (size_t (*) (zmtp_engine_t *)) zmtp_uring_engine_pending,
+        .handle = (int (*) (zmtp_engine_t *, int)) zmtp_uring_engine_handle,
+    };
+    self->fd = fd;
+    self->multishot = true;
+    self->ring = MAP_FAILED;
+    self->sqes = (struct io_uring_sqe *) MAP_FAILED;
+    self->buf_ring = (struct io_uring_buf_ring *) MAP_FAILED;
+
+    //  Set up rings
+    struct io_uring_params params;
+    memset (&params, 0, sizeof params);
+    self->ring_fd = syscall (__NR_io_uring_setup, ZMTP_URING_ENTRIES, &params);
+    if (self->ring_fd == -1) {
+        free (self);
+        return NULL;
+    }
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+        goto error;
+
+    self->ring_size = params.sq_off.array
+                    + params.sq_entries * sizeof (unsigned);
+    const size_t cq_size = params.cq_off.cqes
+                         + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (self->ring_size < cq_size)
+        self->ring_size = cq_size;
+    self->ring = mmap (NULL, self->ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, self->ring_fd, IORING_OFF_SQ_RING);
+    if (self->ring == MAP_FAILED)
+        goto error;
+    self->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+    self->sqes = (struct io_uring_sqe *) mmap (NULL, self->sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        self->ring_fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED)
+        goto error;
+
+    byte *ring = (byte *) self->ring;
+    self->sq_head = (unsigned *) (ring + params.sq_off.head);
+    self->sq_tail = (unsigned *) (ring + params.sq_off.tail);
+    self->sq_mask = (unsigned *) (ring + params.sq_off.ring_mask);
+    self->sq_array = (unsigned *) (ring + params.sq_off.array);
+    self->cq_head = (unsigned *) (ring + params.cq_off.head);
+    self->cq_tail = (unsigned *) (ring + params.cq_off.tail);
+    self->cq_mask = (unsigned *) (ring + params.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+
+    //  Register receive buffers with the kernel
+    self->buf_ring_size = ZMTP_URING_BUFFERS * sizeof (struct io_uring_buf);
+    self->buf_ring = (struct io_uring_buf_ring *) mmap (NULL,
+        self->buf_ring_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->buf_ring == MAP_FAILED)
+        goto error;
+    self->buffers =
+        (byte *) malloc (ZMTP_URING_BUFFERS * ZMTP_URING_BUFFER_SIZE);
+    if (!self->buffers)
+        goto error;
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) self->buf_ring,
+        .ring_entries = ZMTP_URING_BUFFERS,
+        .bgid = 0
+    };
+    if (syscall (__NR_io_uring_register, self->ring_fd,
+                 IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        goto error;
+    for (unsigned short bid = 0; bid < ZMTP_URING_BUFFERS; bid++)
+        s_provide (self, bid);
+
+    //  Start receiving
+    s_arm (self);
+    if (s_enter (self, 0) == -1)
+        goto error;
+    return self;
+
+error:
+    zmtp_uring_engine_destroy (&self);
+    return NULL;
+#else
+    errno = ENOTSUP;
+    return NULL;
+#endif
+}
+
+
+void
+zmtp_uring_engine_destroy (zmtp_uring_engine_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_uring_engine_t *self = *self_p;
+#if defined (ZMTP_HAVE_URING)
+        //  What we said was sent goes out, as a blocking send would have
+        //  made sure of
+        s_finish_send (self);
+        //  The kernel must be done with our buffers before they go
+        if (self->armed) {
+            struct io_uring_sqe *sqe = s_get_sqe (self);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = ZMTP_URING_RECV;
+            sqe->user_data = ZMTP_URING_CANCEL;
+            while (self->armed) {
+                if (s_enter (self, 1) == -1 && errno != EINTR)
+                    break;
+                s_reap (self);
+            }
+        }
+        close (self->ring_fd);
+        if (self->ring != MAP_FAILED)
+            munmap (self->ring, self->ring_size);
+        if (self->sqes != MAP_FAILED)
+            munmap (self->sqes, self->sqes_size);
+        if (self->buf_ring != MAP_FAILED)
+            munmap (self->buf_ring, self->buf_ring_size);
+        free (self->buffers);
+        free (self->send_buffer);
+#endif
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+ssize_t
+zmtp_uring_engine_sendmsg (zmtp_uring_engine_t *self,
+                           int fd, const struct msghdr *msghdr, int flags)
+{
+    assert (self);
+#if defined (ZMTP_HAVE_URING)
+    if (self->sending && (flags & MSG_DONTWAIT) == MSG_DONTWAIT) {
+        s_reap (self);
+        if (self->sending) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    if (s_finish_send (self) == -1)
+        return -1;
+
+    size_t size = 0;
+    for (size_t index = 0; index < (size_t) msghdr->msg_iovlen; index++)
+        size += msghdr->msg_iov [index].iov_len;
+    if ((flags & ~MSG_NOSIGNAL) == 0 && size <= ZMTP_URING_SEND_COPY_MAX) {
+        if (size > self->send_max) {
+            self->send_buffer = (byte *) realloc (self->send_buffer, size);
+            assert (self->send_buffer);
+            self->send_max = size;
+        }
+        size_t offset = 0;
+        for (size_t index = 0; index < (size_t) msghdr->msg_iovlen; index++) {
+            memcpy (self->send_buffer + offset,
+                msghdr->msg_iov [index].iov_base,
+                msghdr->msg_iov [index].iov_len);
+            offset += msghdr->msg_iov [index].iov_len;
+        }
+        self->send_iov = (struct iovec) {
+            .iov_base = self->send_buffer, .iov_len = size
+        };
+        self->send_msghdr = (struct msghdr) {
+            .msg_iov = &self->send_iov, .msg_iovlen = 1
+        };
+        //  Stream sockets then send it all, or fail
+        self->send_fd = fd;
+        self->send_flags = flags | MSG_WAITALL;
+        self->send_size = size;
+        self->send_done = 0;
+        s_submit_send (self, fd, &self->send_msghdr, self->send_flags);
+        if (s_enter (self, 0) == -1 && errno != EINTR)
+            return -1;
+        return size;
+    }
+
+    //  Receive completions may come in while we wait
+    s_submit_send (self, fd, msghdr, flags);
+    while (self->sending) {
+        if (s_enter (self, 1) == -1 && errno != EINTR)
+            return -1;
+        s_reap (self);
+    }
+    if (self->send_result < 0) {
+        errno = -self->send_result;
+        return -1;
+    }
+    return self->send_result;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+
+ssize_t
+zmtp_uring_engine_recv (zmtp_uring_engine_t *self,
+                        int fd, void *buffer, size_t len, int flags)
+{
+    assert (self);
+#if defined (ZMTP_HAVE_URING)
+    assert (fd == self->fd);
+
+    s_reap (self);
+    while (self->chunk_count == 0) {
+        if (self->eof)
+            return 0;
+        if (self->error) {
+            errno = self->error;
+            return -1;
+        }
+        if (!self->armed)
+            s_arm (self);
+        if ((flags & MSG_DONTWAIT) == MSG_DONTWAIT) {
+            if (self->sq_pending > 0 && s_enter (self, 0) == -1)
+                return -1;
+            s_reap (self);
+            if (self->chunk_count == 0 && !self->eof && !self->error) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+        else {
+            if (s_enter (self, 1) == -1 && errno != EINTR)
+                return -1;
+            s_reap (self);
+        }
+    }
+
+    //  Hand out received data, returning emptied buffers to the kernel
+    size_t bytes_read = 0;
+    while (bytes_read < len && self->chunk_count > 0) {
+        struct uring_chunk *chunk = &self->chunks [self->chunk_head];
+        size_t size = chunk->size - chunk->offset;
+        if (size > len - bytes_read)
+            size = len - bytes_read;
+        memcpy ((byte *) buffer + bytes_read,
+            self->buffers + (size_t) chunk->bid * ZMTP_URING_BUFFER_SIZE
+                          + chunk->offset, size);
+        bytes_read += size;
+        chunk->offset += size;
+        self->pending -= size;
+        if (chunk->offset == chunk->size) {
+            s_provide (self, chunk->bid);
+            self->chunk_head = (self->chunk_head + 1) % ZMTP_URING_BUFFERS;
+            self->chunk_count--;
+        }
+    }
+
+    //  Receive stops when the kernel runs out of buffers; start it again
+    //  so that our handle signals new input
+    if (!self->armed && !self->eof && !self->error) {
+        s_arm (self);
+        s_enter (self, 0);
+    }
+    return bytes_read;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+
+size_t
+zmtp_uring_engine_pending (zmtp_uring_engine_t *self)
+{
+    assert (self);
+#if defined (ZMTP_HAVE_URING)
+    s_reap (self);
+    return self->pending;
+#else
+    return 0;
+#endif
+}
+
+
+//  Our ring descriptor is readable when completions are queued
+
+int
+zmtp_uring_engine_handle (zmtp_uring_engine_t *self, int fd)
+{
+    assert (self);
+#if defined (ZMTP_HAVE_URING)
+    return self->ring_fd;
+#else
+    return fd;
+#endif
+}
+
+
+#if defined (ZMTP_HAVE_URING)
+
+//  Submit queued entries, and wait for min_complete completions
+
+static int
+s_enter (zmtp_uring_engine_t *self, unsigned min_complete)
+{
+    const int rc = syscall (__NR_io_uring_enter, self->ring_fd,
+        self->sq_pending, min_complete,
+        min_complete > 0? IORING_ENTER_GETEVENTS: 0, NULL, 0);
+    if (rc == -1)
+        return -1;
+    self->sq_pending -= rc;
+    return 0;
+}
+
+//  Return a cleared submission queue entry, queued for submission by the
+//  next s_enter
+
+static struct io_uring_sqe *
+s_get_sqe (zmtp_uring_engine_t *self)
+{
+    //  We never queue more than a receive, a send and a cancel
+    const unsigned tail = *self->sq_tail;
+    assert (tail - __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE)
+            < ZMTP_URING_ENTRIES);
+    const unsigned index = tail & *self->sq_mask;
+    struct io_uring_sqe *sqe = &self->sqes [index];
+    memset (sqe, 0, sizeof *sqe);
+    self->sq_array [index] = index;
+    __atomic_store_n (self->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    self->sq_pending++;
+    return sqe;
+}
+
+//  Queue a receive into the provided buffers; multishot if the kernel
+//  supports it
+
+static void
+s_arm (zmtp_uring_engine_t *self)
+{
+    struct io_uring_sqe *sqe = s_get_sqe (self);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = self->fd;
+    sqe->ioprio = self->multishot? IORING_RECV_MULTISHOT: 0;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = ZMTP_URING_RECV;
+    self->armed = true;
+}
+
+//  Queue a send for submission by the next s_enter
+
+static void
+s_submit_send (zmtp_uring_engine_t *self,
+               int fd, const struct msghdr *msghdr, int flags)
+{
+    struct io_uring_sqe *sqe = s_get_sqe (self);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) msghdr;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = ZMTP_URING_SEND;
+    self->sending = true;
+}
+
+//  Wait until the background send, if any, is done, sending the rest if
+//  the kernel sent only part. Returns 0 if OK, -1 if it failed.
+
+static int
+s_finish_send (zmtp_uring_engine_t *self)
+{
+    while (self->send_size > 0) {
+        while (self->sending) {
+            if (s_enter (self, 1) == -1 && errno != EINTR) {
+                self->send_size = 0;
+                return -1;
+            }
+            s_reap (self);
+        }
+        if (self->send_result < 0) {
+            self->send_size = 0;
+            errno = -self->send_result;
+            return -1;
+        }
+        self->send_done += self->send_result;
+        if (self->send_done >= self->send_size)
+            self->send_size = 0;
+        else {
+            self->send_iov = (struct iovec) {
+                .iov_base = self->send_buffer + self->send_done,
+                .iov_len = self->send_size - self->send_done
+            };
+            s_submit_send (self,
+                self->send_fd, &self->send_msghdr, self->send_flags);
+        }
+    }
+    return 0;
+}
+
+//  Process queued completions
+
+static void
+s_reap (zmtp_uring_engine_t *self)
+{
+    unsigned head = *self->cq_head;
+    const unsigned tail = __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &self->cqes [head & *self->cq_mask];
+        if (cqe->user_data == ZMTP_URING_RECV) {
+            if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+                self->armed = false;
+            if (cqe->res > 0) {
+                assert (self->chunk_count < ZMTP_URING_BUFFERS);
+                struct uring_chunk *chunk = &self->chunks [
+                    (self->chunk_head + self->chunk_count++)
+                    % ZMTP_URING_BUFFERS];
+                chunk->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                chunk->size = cqe->res;
+                chunk->offset = 0;
+                self->pending += cqe->res;
+            }
+            else
+            if (cqe->res == 0)
+                self->eof = true;
+            else
+            if (cqe->res == -EINVAL && self->multishot)
+                self->multishot = false;    //  Retry with single shots
+            else
+            if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+                self->error = -cqe->res;
+        }
+        else
+        if (cqe->user_data == ZMTP_URING_SEND) {
+            self->sending = false;
+            self->send_result = cqe->res;
+        }
+        head++;
+    }
+    __atomic_store_n (self->cq_head, head, __ATOMIC_RELEASE);
+}
+
+//  Give buffer back to the kernel to receive into
+
+static void
+s_provide (zmtp_uring_engine_t *self, unsigned short bid)
+{
+    //  The ring tail shares memory with the first entry, so set fields
+    //  one by one
+    struct io_uring_buf *buf = &self->buf_ring->bufs [
+        self->buf_tail & (ZMTP_URING_BUFFERS - 1)];
+    buf->addr = (uint64_t) (uintptr_t)
+        (self->buffers + (size_t) bid * ZMTP_URING_BUFFER_SIZE);
+    buf->len = ZMTP_URING_BUFFER_SIZE;
+    buf->bid = bid;
+    self->buf_tail++;
+    __atomic_store_n (&self->buf_ring->tail, self->buf_tail, __ATOMIC_RELEASE);
+}
+
+#endif